@@ -0,0 +1,49 @@
+#ifndef ALLOCTRACKER_H
+#define ALLOCTRACKER_H
+
+// Counts heap allocations made through the global operator new/delete (replaced in Sources/alloc_tracker.cpp).
+// C libraries that call malloc directly (GLFW, ImGui, the GL driver) are not seen.
+// Like the profiler, the whole layer is compiled out when BOIDS_NO_PROFILE is defined.
+
+#ifndef BOIDS_NO_PROFILE
+
+#include <cstdint>
+#include <string>
+
+namespace alloctracker {
+	const unsigned int MAX_STACK_DEPTH = 12;
+	const unsigned int MAX_CALL_SITES = 512;
+
+	struct Counts {
+		uint64_t Allocations;
+		uint64_t Frees;
+		uint64_t Bytes;
+	};
+
+	struct CallSite {
+		void* Frames[MAX_STACK_DEPTH];
+		unsigned int Depth;
+		uint64_t Allocations;
+		uint64_t Bytes;
+	};
+
+	// Totals over all threads since startup.
+	Counts getGlobalCounts();
+	// Totals of the calling thread since it started.
+	Counts getThreadCounts();
+
+	// Capture the call stack of every period-th allocation, 0 turns sampling off.
+	void setSamplePeriod(unsigned int period);
+	unsigned int getSamplePeriod();
+
+	// Copy out the sampled call sites with the most allocations, heaviest first.
+	unsigned int getTopCallSites(CallSite* out, unsigned int maxCount);
+	void clearCallSites();
+
+	// Symbol name (and line when available) of a captured frame. Allocates, so call it outside hot paths.
+	std::string describeFrame(void* address);
+}
+
+#endif // !BOIDS_NO_PROFILE
+
+#endif // !ALLOCTRACKER_H
@@ -0,0 +1,144 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../Headers/logging.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Bytes reserved per thread for transient frame data, sized from the high-water marks in the Frame Time tab.
+const size_t FRAME_ARENA_CAPACITY = 1 << 20;
+
+// Bump allocator for data that only lives until the end of the frame.
+// Nothing is freed individually; reset() releases everything at once. When the buffer runs out,
+// allocations fall back to the heap until the next reset and the high-water mark shows how much was missing.
+class FrameArena {
+public:
+	FrameArena(size_t capacity) : Buffer(new char[capacity]), Capacity(capacity), Used(0), HighWater(0), OverflowBytes(0), OverflowList(nullptr), Warned(false) {}
+
+	~FrameArena() {
+		this->releaseOverflow();
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment) {
+		size_t offset = (Used + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= Capacity) {
+			Used = offset + size;
+			return Buffer.get() + offset;
+		}
+
+		// Overflow blocks are chained through a header in front of the returned memory
+		char* block = static_cast<char*>(::operator new(OVERFLOW_HEADER + size));
+		*reinterpret_cast<void**>(block) = OverflowList;
+		OverflowList = block;
+		OverflowBytes += size;
+		return block + OVERFLOW_HEADER;
+	}
+
+	// Release everything allocated since the last reset.
+	void reset(const char* name) {
+		size_t total = Used + OverflowBytes;
+		HighWater = std::max(HighWater, total);
+		if (OverflowBytes > 0 && !Warned) {
+			Warned = true;
+			logging::loggingMessage(logging::LogType::WARNING, std::string(name) + " needed " + std::to_string(total) + " bytes, FRAME_ARENA_CAPACITY is "
+				+ std::to_string(Capacity) + ". The rest came from the heap.");
+		}
+		this->releaseOverflow();
+		Used = 0;
+	}
+
+	size_t getCapacity() const { return Capacity; }
+	size_t getUsed() const { return Used + OverflowBytes; }
+	size_t getHighWater() const { return std::max(HighWater, Used + OverflowBytes); }
+
+private:
+	static const size_t OVERFLOW_HEADER = alignof(std::max_align_t) > sizeof(void*) ? alignof(std::max_align_t) : sizeof(void*);
+
+	std::unique_ptr<char[]> Buffer;
+	size_t Capacity;
+	size_t Used;
+	size_t HighWater;
+	size_t OverflowBytes;
+	void* OverflowList;
+	bool Warned;
+
+	void releaseOverflow() {
+		while (OverflowList != nullptr) {
+			void* next = *static_cast<void**>(OverflowList);
+			::operator delete(OverflowList);
+			OverflowList = next;
+		}
+		OverflowBytes = 0;
+	}
+};
+
+// One arena per thread of the pool (index 0 is the main thread), so workers never share a bump pointer.
+class FrameArenas {
+public:
+	void init(unsigned int threadCount, size_t capacity = FRAME_ARENA_CAPACITY) {
+		Arenas.clear();
+		for (unsigned int i = 0; i < threadCount; i++) {
+			Arenas.emplace_back(new FrameArena(capacity));
+		}
+	}
+
+	FrameArena& get(unsigned int threadIndex) { return *Arenas[threadIndex]; }
+	const FrameArena& get(unsigned int threadIndex) const { return *Arenas[threadIndex]; }
+	unsigned int getCount() const { return (unsigned int)Arenas.size(); }
+
+	// Call once per frame, while no worker is running.
+	void reset() {
+		char name[32];
+		for (unsigned int i = 0; i < Arenas.size(); i++) {
+			std::snprintf(name, sizeof(name), "Frame arena %u", i);
+			Arenas[i]->reset(name);
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<FrameArena>> Arenas;
+};
+
+// STL allocator drawing from a FrameArena, so standard containers can hold per-frame data.
+// Reserve up front: memory released by a growing container is only reclaimed at reset.
+template <typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	ArenaAllocator(FrameArena& arena) : Arena(&arena) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : Arena(other.getArena()) {}
+
+	T* allocate(size_t count) {
+		return static_cast<T*>(Arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	FrameArena* getArena() const { return Arena; }
+
+private:
+	FrameArena* Arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.getArena() == b.getArena(); }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.getArena() != b.getArena(); }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // !ARENA_H
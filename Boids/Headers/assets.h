@@ -0,0 +1,349 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <glad/glad.h>
+
+#include "../Headers/logging.h"
+#include "../Headers/profiler.h"
+#include "../Headers/texturecache.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Threads decoding image files, kept apart from the frame pool so a slow JPEG never delays the flock update.
+const unsigned int ASSET_DECODE_THREADS = 2;
+
+// Milliseconds of texture uploads allowed per frame. One upload always goes through, so large images still arrive.
+const double ASSET_UPLOAD_BUDGET_MS = 2.0;
+
+typedef unsigned int TextureHandle;
+
+// Textures registered by path and loaded the first time something binds them.
+// Files are decoded (or mapped from their .btex conversion) on background threads, then uploaded on the
+// GL thread in update() within a time budget. Until then texture() returns a 1x1 placeholder, so drawing never waits for the disk.
+class AssetRegistry {
+public:
+	AssetRegistry() : Placeholder2D(0), PlaceholderCube(0), PlaceholderArray(0), ReadyCount(0), CachedCount(0), ConvertedCount(0), CachedMilliseconds(0.0), ConvertedMilliseconds(0.0), Stop(false) {}
+
+	~AssetRegistry() {
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stop = true;
+		}
+		WakeCondition.notify_all();
+		for (std::thread& worker : Workers) {
+			worker.join();
+		}
+	}
+
+	AssetRegistry(const AssetRegistry&) = delete;
+	AssetRegistry& operator=(const AssetRegistry&) = delete;
+
+	// Needs a current context for the placeholders.
+	void init() {
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &Placeholder2D);
+		glBindTexture(GL_TEXTURE_2D, Placeholder2D);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		// Roughly the default fog color, so the sky fades in instead of flashing
+		const unsigned char sky[4] = { 68, 128, 155, 255 };
+		glGenTextures(1, &PlaceholderCube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, PlaceholderCube);
+		for (unsigned int i = 0; i < 6; i++) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, sky);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenTextures(1, &PlaceholderArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, PlaceholderArray);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		for (unsigned int i = 0; i < ASSET_DECODE_THREADS; i++) {
+			Workers.emplace_back(&AssetRegistry::workerLoop, this, i + 1);
+		}
+	}
+
+	// Delete the uploaded textures while the context is still alive.
+	void release() {
+		for (Entry& entry : Entries) {
+			if (entry.State == STATE_READY) {
+				glDeleteTextures(1, &entry.Texture);
+			}
+		}
+		glDeleteTextures(1, &Placeholder2D);
+		glDeleteTextures(1, &PlaceholderCube);
+		glDeleteTextures(1, &PlaceholderArray);
+	}
+
+	TextureHandle addTexture(const std::string& path) {
+		Entry entry;
+		entry.Paths.push_back(path);
+		entry.Kind = KIND_2D;
+		Entries.push_back(entry);
+		return (TextureHandle)Entries.size() - 1;
+	}
+
+	// Faces in the order +X, -X, +Y, -Y, +Z, -Z.
+	TextureHandle addCubemap(const std::vector<std::string>& faces) {
+		Entry entry;
+		entry.Paths = faces;
+		entry.Kind = KIND_CUBEMAP;
+		Entries.push_back(entry);
+		return (TextureHandle)Entries.size() - 1;
+	}
+
+	// One GL_TEXTURE_2D_ARRAY with a layer per file, in order. Every layer must have the size of the first.
+	TextureHandle addTextureArray(const std::vector<std::string>& layers) {
+		Entry entry;
+		entry.Paths = layers;
+		entry.Kind = KIND_ARRAY;
+		Entries.push_back(entry);
+		return (TextureHandle)Entries.size() - 1;
+	}
+
+	// The texture to bind for handle, the placeholder until it has been uploaded. The first call starts the load.
+	unsigned int texture(TextureHandle handle) {
+		Entry& entry = Entries[handle];
+		if (entry.State == STATE_READY) {
+			return entry.Texture;
+		}
+		if (entry.State == STATE_UNLOADED) {
+			entry.State = STATE_LOADING;
+			Job job;
+			job.Handle = handle;
+			job.Paths = entry.Paths;
+			// Cubemap faces are sampled without mipmaps
+			job.Mipmaps = entry.Kind != KIND_CUBEMAP;
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				Pending.push_back(std::move(job));
+			}
+			WakeCondition.notify_one();
+		}
+		return entry.Kind == KIND_CUBEMAP ? PlaceholderCube : (entry.Kind == KIND_ARRAY ? PlaceholderArray : Placeholder2D);
+	}
+
+	// Upload decoded images, once per frame on the GL thread.
+	void update(double budgetMilliseconds) {
+		auto start = std::chrono::steady_clock::now();
+		bool first = true;
+		while (true) {
+			Job job;
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				if (Decoded.empty()) {
+					return;
+				}
+				if (!first && std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMilliseconds) {
+					return;
+				}
+				job = std::move(Decoded.front());
+				Decoded.pop_front();
+			}
+			first = false;
+			this->upload(job);
+			if (this->getLoadingCount() == 0) {
+				this->reportLoadTimes();
+			}
+		}
+	}
+
+	unsigned int getCount() const { return (unsigned int)Entries.size(); }
+	unsigned int getReadyCount() const { return ReadyCount; }
+
+	// Files mapped from TextureCache/ against files decoded and converted, with the worker time spent on each
+	unsigned int getCachedCount() const { return CachedCount; }
+	unsigned int getConvertedCount() const { return ConvertedCount; }
+	double getCachedMilliseconds() const { return CachedMilliseconds; }
+	double getConvertedMilliseconds() const { return ConvertedMilliseconds; }
+
+	unsigned int getLoadingCount() const {
+		unsigned int count = 0;
+		for (const Entry& entry : Entries) {
+			count += entry.State == STATE_LOADING ? 1 : 0;
+		}
+		return count;
+	}
+
+private:
+	enum Asset_State {
+		STATE_UNLOADED,
+		STATE_LOADING,
+		STATE_READY,
+		STATE_FAILED
+	};
+
+	enum Texture_Kind {
+		KIND_2D,
+		KIND_CUBEMAP,
+		KIND_ARRAY
+	};
+
+	struct Entry {
+		std::vector<std::string> Paths;
+		Texture_Kind Kind = KIND_2D;
+		Asset_State State = STATE_UNLOADED;
+		unsigned int Texture = 0;
+	};
+
+	// Travels from the main thread to a decoder and back; owns the pixels (or the mapping) until they are uploaded.
+	struct Job {
+		TextureHandle Handle = 0;
+		std::vector<std::string> Paths;
+		bool Mipmaps = true;
+		std::vector<TextureFile> Files;
+		double Milliseconds = 0.0;
+	};
+
+	// Only touched by the GL thread
+	std::vector<Entry> Entries;
+	unsigned int Placeholder2D;
+	unsigned int PlaceholderCube;
+	unsigned int PlaceholderArray;
+	unsigned int ReadyCount;
+	unsigned int CachedCount;
+	unsigned int ConvertedCount;
+	double CachedMilliseconds;
+	double ConvertedMilliseconds;
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable WakeCondition;
+	bool Stop;
+	std::deque<Job> Pending;
+	std::deque<Job> Decoded;
+
+	void workerLoop(unsigned int index) {
+		PROFILE_THREAD("Asset Loader " + std::to_string(index));
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(Mutex);
+				WakeCondition.wait(lock, [this] { return Stop || !Pending.empty(); });
+				if (Stop) {
+					return;
+				}
+				job = std::move(Pending.front());
+				Pending.pop_front();
+			}
+
+			{
+				PROFILE_SCOPE("Decode");
+				auto start = std::chrono::steady_clock::now();
+				for (const std::string& path : job.Paths) {
+					job.Files.push_back(TextureFile::load(path, job.Mipmaps));
+				}
+				job.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			std::lock_guard<std::mutex> lock(Mutex);
+			Decoded.push_back(std::move(job));
+		}
+	}
+
+	void upload(const Job& job) {
+		PROFILE_SCOPE("Texture Upload");
+		Entry& entry = Entries[job.Handle];
+		bool cached = true;
+		for (unsigned int i = 0; i < job.Files.size(); i++) {
+			if (!job.Files[i].isValid()) {
+				logging::loggingMessage(logging::LogType::ERROR, "Failed to load texture at path: " + job.Paths[i]);
+				entry.State = STATE_FAILED;
+				return;
+			}
+			cached = cached && job.Files[i].isFromCache();
+		}
+		if (entry.Kind == KIND_ARRAY && !this->haveSameSize(job.Files)) {
+			logging::loggingMessage(logging::LogType::ERROR, "Texture array layers differ in size: " + job.Paths[0]);
+			entry.State = STATE_FAILED;
+			return;
+		}
+		if (cached) {
+			CachedCount++;
+			CachedMilliseconds += job.Milliseconds;
+		} else {
+			ConvertedCount++;
+			ConvertedMilliseconds += job.Milliseconds;
+		}
+
+		// Every level is RGBA8, so rows are always 4-byte aligned
+		glGenTextures(1, &entry.Texture);
+		if (entry.Kind == KIND_CUBEMAP) {
+			glBindTexture(GL_TEXTURE_CUBE_MAP, entry.Texture);
+			for (unsigned int i = 0; i < job.Files.size(); i++) {
+				const TextureFile& face = job.Files[i];
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, face.getWidth(0), face.getHeight(0), 0, GL_RGBA, GL_UNSIGNED_BYTE, face.getLevel(0));
+			}
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		} else if (entry.Kind == KIND_ARRAY) {
+			// Storage for every level first, then each layer is copied into its slice
+			const TextureFile& first = job.Files[0];
+			GLenum format = first.getSourceChannels() == 4 ? GL_RGBA : GL_RGB;
+			GLsizei layers = (GLsizei)job.Files.size();
+			glBindTexture(GL_TEXTURE_2D_ARRAY, entry.Texture);
+			for (unsigned int level = 0; level < first.getLevelCount(); level++) {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, first.getWidth(level), first.getHeight(level), layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+				for (GLsizei layer = 0; layer < layers; layer++) {
+					const TextureFile& file = job.Files[layer];
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, file.getWidth(level), file.getHeight(level), 1, GL_RGBA, GL_UNSIGNED_BYTE, file.getLevel(level));
+				}
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.getLevelCount() - 1);
+
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		} else {
+			// The mip chain was built at conversion, each level goes up as it is stored
+			const TextureFile& file = job.Files[0];
+			GLenum format = file.getSourceChannels() == 1 ? GL_RED : (file.getSourceChannels() == 4 ? GL_RGBA : GL_RGB);
+			glBindTexture(GL_TEXTURE_2D, entry.Texture);
+			for (unsigned int level = 0; level < file.getLevelCount(); level++) {
+				glTexImage2D(GL_TEXTURE_2D, level, format, file.getWidth(level), file.getHeight(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, file.getLevel(level));
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file.getLevelCount() - 1);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_MIRRORED_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_MIRRORED_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+		entry.State = STATE_READY;
+		ReadyCount++;
+	}
+
+	// Same level 0 size means the same mip chain, the levels were built by halving.
+	bool haveSameSize(const std::vector<TextureFile>& files) const {
+		for (const TextureFile& file : files) {
+			if (file.getWidth(0) != files[0].getWidth(0) || file.getHeight(0) != files[0].getHeight(0) || file.getLevelCount() != files[0].getLevelCount()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void reportLoadTimes() const {
+		char text[160];
+		std::snprintf(text, sizeof(text), "Textures loaded: %u from the .btex cache in %.1f ms, %u decoded and converted in %.1f ms (loader thread time).",
+			CachedCount, CachedMilliseconds, ConvertedCount, ConvertedMilliseconds);
+		logging::loggingMessage(logging::LogType::INFO, text);
+	}
+};
+
+#endif // !ASSETS_H
@@ -0,0 +1,118 @@
+#ifndef BILLBOARD_H
+#define BILLBOARD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// How Shaders/billboard.vs turns a sprite towards the camera, passed as the billboardMode uniform.
+enum Billboard_Mode {
+	BILLBOARD_FIXED,	// Always in the XY plane, the Billboard toggle switched off
+	BILLBOARD_Y_LOCKED,	// Turns around the world Y axis only, for things standing on the ground
+	BILLBOARD_FULL		// Parallel to the screen
+};
+
+// One sprite, laid out as the per-instance attributes 3 to 6 of Shaders/billboard.vs.
+// Position is the bottom center, the quad spans Width across and Height upwards from it.
+// Animated batches step through frameCount layers from Layer, starting Phase frames in and advancing
+// Speed times frameRate frames per second; both uniforms are set per draw.
+struct BillboardInstance {
+	glm::vec3 Position;
+	float Width;
+	float Height;
+	float Layer;
+	float Phase;
+	float Speed;
+};
+
+// Sprites sharing a texture array, drawn with one instanced call.
+// The corners come from a unit quad VBO, the vertex shader places them around each instance with the camera basis,
+// so nothing is rewritten when the camera moves. Static sets upload once, moving ones refill the same buffer.
+class BillboardBatch {
+public:
+	BillboardBatch() : VAO(0), InstanceVBO(0), Count(0), Capacity(0) {}
+
+	BillboardBatch(const BillboardBatch&) = delete;
+	BillboardBatch& operator=(const BillboardBatch&) = delete;
+
+	// quadVBO holds the two triangles of the unit quad as position, normal, texture coords (8 floats per vertex).
+	void init(unsigned int quadVBO) {
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &InstanceVBO);
+		glBindVertexArray(VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+
+			glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(BillboardInstance), (void*)offsetof(BillboardInstance, Position));
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(BillboardInstance), (void*)offsetof(BillboardInstance, Width));
+			glEnableVertexAttribArray(5);
+			glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(BillboardInstance), (void*)offsetof(BillboardInstance, Layer));
+			glEnableVertexAttribArray(6);
+			glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, sizeof(BillboardInstance), (void*)offsetof(BillboardInstance, Phase));
+			glVertexAttribDivisor(3, 1);
+			glVertexAttribDivisor(4, 1);
+			glVertexAttribDivisor(5, 1);
+			glVertexAttribDivisor(6, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void release() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &InstanceVBO);
+		VAO = 0;
+		InstanceVBO = 0;
+		Count = 0;
+		Capacity = 0;
+	}
+
+	// Replace every instance. GL_STATIC_DRAW for sets written once, GL_STREAM_DRAW for sets refilled every frame;
+	// the buffer is only re-specified when it has to grow, otherwise the data is orphaned in place.
+	void upload(const BillboardInstance* instances, unsigned int count, GLenum usage) {
+		glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO);
+		if (count > Capacity) {
+			glBufferData(GL_ARRAY_BUFFER, count * sizeof(BillboardInstance), instances, usage);
+			Capacity = count;
+		} else if (count > 0) {
+			glBufferData(GL_ARRAY_BUFFER, Capacity * sizeof(BillboardInstance), nullptr, usage);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(BillboardInstance), instances);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		Count = count;
+	}
+
+	void upload(const std::vector<BillboardInstance>& instances, GLenum usage) {
+		this->upload(instances.data(), (unsigned int)instances.size(), usage);
+	}
+
+	// The shader and the texture array are bound by the caller.
+	void draw() const {
+		if (Count == 0) {
+			return;
+		}
+		glBindVertexArray(VAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, Count);
+		glBindVertexArray(0);
+	}
+
+	unsigned int getCount() const { return Count; }
+	unsigned int getVAO() const { return VAO; }
+
+private:
+	unsigned int VAO;
+	unsigned int InstanceVBO;
+	unsigned int Count;
+	unsigned int Capacity;
+};
+
+#endif // !BILLBOARD_H
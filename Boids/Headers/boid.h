@@ -22,6 +22,7 @@ public:
 		this->Position = position;
 		this->Velocity = velocity;
 		this->Acceleration = glm::vec3(0.0f);
+		this->PerceptionRadius = PERCEPTION_RADIUS_COHESION;
 	}
 
 	void ApplyForce(glm::vec3 force) {
@@ -51,7 +52,7 @@ public:
 		*/
 	}
 
-	glm::vec3 Cohesion(std::vector<Boid> boids, float atten) {
+	glm::vec3 Cohesion(const std::vector<Boid>& boids, float atten) {
 		// Cohesion
 		unsigned int neighbors = 0;
 		glm::vec3 sum_position = glm::vec3(0.0f);
@@ -75,7 +76,7 @@ public:
 		return force;
 	}
 
-	glm::vec3 Alignment(std::vector<Boid> boids, float atten) {
+	glm::vec3 Alignment(const std::vector<Boid>& boids, float atten) {
 		// Alignment
 		unsigned int neighbors = 0;
 		glm::vec3 sum_velocity = glm::vec3(0.0f);
@@ -99,7 +100,7 @@ public:
 		return force;
 	}
 
-	glm::vec3 Separation(std::vector<Boid> boids, float atten) {
+	glm::vec3 Separation(const std::vector<Boid>& boids, float atten) {
 		// Separation
 		unsigned int neighbors = 0;
 		glm::vec3 sum_pushback_force = glm::vec3(0.0f);
@@ -141,7 +142,9 @@ public:
 		return force;
 	}
 
-	void flock(std::vector<Boid> boids, float s_atten, float a_atten, float c_atten) {
+	// Returns the number of neighbors inside the perception radius. With maxNeighbors above 0 the boid stops looking
+	// once it has found that many, in the order of the vector.
+	unsigned int flock(const std::vector<Boid>& boids, float s_atten, float a_atten, float c_atten, unsigned int maxNeighbors = 0) {
 		unsigned int neighbors = 0;
 		this->Acceleration *= 0;
 
@@ -164,6 +167,9 @@ public:
 				avg_position += boids[i].Position;
 
 				neighbors++;
+				if (neighbors == maxNeighbors) {
+					break;
+				}
 			}
 		}
 
@@ -190,6 +196,8 @@ public:
 		glm::vec3 cohesion = avg_position * c_atten;
 		
 		this->Acceleration = separation + alignment + cohesion;
+
+		return neighbors;
 	}
 
 	// Getter
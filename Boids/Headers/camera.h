@@ -19,6 +19,12 @@ const float SPEED = 10.0f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
 
+// Left, right, bottom, top, near, far as (normal, distance) with the normals pointing inwards,
+// a point p is inside when dot(normal, p) + distance >= 0 for all six.
+struct Frustum {
+	glm::vec4 Planes[6];
+};
+
 class Camera {
 public:
 	glm::vec3 Position;
@@ -53,6 +59,25 @@ public:
 		return calcLookAtMatrix(Position, Position + Front, WorldUp);
 	}
 
+	// World space frustum of this camera seen through projection (Gribb & Hartmann plane extraction).
+	Frustum GetFrustum(const glm::mat4& projection) {
+		glm::mat4 clip = projection * GetViewMatrix();
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++) {
+			rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+		}
+
+		Frustum frustum;
+		for (int i = 0; i < 3; i++) {
+			frustum.Planes[i * 2] = rows[3] + rows[i];
+			frustum.Planes[i * 2 + 1] = rows[3] - rows[i];
+		}
+		for (glm::vec4& plane : frustum.Planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime) {
 		float velocity = MovementSpeed * deltaTime;
 		if (direction == FORWARD) {
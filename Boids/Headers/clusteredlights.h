@@ -0,0 +1,283 @@
+#ifndef CLUSTEREDLIGHTS_H
+#define CLUSTEREDLIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "../Headers/light.h"
+#include "../Headers/threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Froxel grid over the view: screen tiles in x and y, slices spaced logarithmically in view depth.
+// Must match how Shaders/lighting.fs finds its cluster from the LightsBlock parameters.
+const unsigned int CLUSTER_X = 16;
+const unsigned int CLUSTER_Y = 9;
+const unsigned int CLUSTER_Z = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+// Point and spot lights binned per frame, lights past this are ignored.
+const unsigned int MAX_CLUSTER_LIGHTS = 1024;
+// Light indices over all clusters; a cluster that would overflow it keeps the lights that fit.
+const unsigned int CLUSTER_INDEX_CAPACITY = CLUSTER_COUNT * 32;
+// A light reaches as far as its attenuated brightest channel stays above this, the shader fades it out there.
+const float CLUSTER_LIGHT_THRESHOLD = 1.0f / 64.0f;
+// vec4s per light in the light buffer, see Shaders/lighting.fs fetchLight()
+const unsigned int CLUSTER_LIGHT_TEXELS = 6;
+
+// Clustered forward lighting: every frame the lights are binned into the froxels their range touches,
+// and each fragment only loops over the list of its own froxel. Three buffer textures carry it to the shaders:
+// the lights themselves, an (offset, count) pair per cluster, and the light indices the pairs point into.
+// Binning runs on the pool, one depth slice per task, so no two tasks write the same cluster.
+class LightClusters {
+public:
+	LightClusters() : LightCount(0), IndexCount(0), Dropped(0), BusyClusters(0), MaxPerCluster(0), SliceScale(0.0f), SliceBias(0.0f) {
+		for (unsigned int i = 0; i < BUFFER_COUNT; i++) {
+			Buffers[i] = 0;
+			Textures[i] = 0;
+		}
+	}
+
+	LightClusters(const LightClusters&) = delete;
+	LightClusters& operator=(const LightClusters&) = delete;
+
+	// Buffers sized for the worst case up front, a frame never reallocates them.
+	void init() {
+		LightData.resize(MAX_CLUSTER_LIGHTS * CLUSTER_LIGHT_TEXELS);
+		Ranges.resize(MAX_CLUSTER_LIGHTS);
+		Counts.resize(CLUSTER_COUNT);
+		Next.resize(CLUSTER_COUNT);
+		Grid.resize(CLUSTER_COUNT * 2);
+		Indices.resize(CLUSTER_INDEX_CAPACITY);
+
+		const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+		const size_t sizes[BUFFER_COUNT] = { LightData.size() * sizeof(glm::vec4), Grid.size() * sizeof(uint32_t), Indices.size() * sizeof(uint16_t) };
+		glGenBuffers(BUFFER_COUNT, Buffers);
+		glGenTextures(BUFFER_COUNT, Textures);
+		for (unsigned int i = 0; i < BUFFER_COUNT; i++) {
+			glBindBuffer(GL_TEXTURE_BUFFER, Buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, sizes[i], nullptr, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, Textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], Buffers[i]);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void release() {
+		glDeleteTextures(BUFFER_COUNT, Textures);
+		glDeleteBuffers(BUFFER_COUNT, Buffers);
+		for (unsigned int i = 0; i < BUFFER_COUNT; i++) {
+			Buffers[i] = 0;
+			Textures[i] = 0;
+		}
+	}
+
+	// Bin the enabled point and spot lights for this view. Directional lights belong in the LightsBlock instead.
+	void build(const std::vector<Light>& lights, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, ThreadPool& pool) {
+		LightCount = std::min((unsigned int)lights.size(), MAX_CLUSTER_LIGHTS);
+		Dropped = (unsigned int)lights.size() - LightCount;
+
+		// slice = log(depth) * SliceScale + SliceBias, so near maps to 0 and far to CLUSTER_Z
+		float logRange = std::log(farPlane / nearPlane);
+		SliceScale = CLUSTER_Z / logRange;
+		SliceBias = -(float)CLUSTER_Z * std::log(nearPlane) / logRange;
+
+		pool.parallelFor(LightCount, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int i = begin; i < end; i++) {
+				float range = lightRange(lights[i]);
+				this->packLight(i, lights[i], range);
+				Ranges[i] = this->clusterRange(lights[i].Position, range, view, projection, nearPlane, farPlane);
+			}
+		});
+
+		// Count, offset, fill: a task owns every cluster of its slice, the offsets come from one serial pass in between
+		pool.parallelFor(CLUSTER_Z, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int slice = begin; slice < end; slice++) {
+				this->binSlice(slice, false);
+			}
+		});
+
+		IndexCount = 0;
+		BusyClusters = 0;
+		MaxPerCluster = 0;
+		for (unsigned int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+			unsigned int count = std::min(Counts[cluster], CLUSTER_INDEX_CAPACITY - IndexCount);
+			Grid[cluster * 2] = IndexCount;
+			Grid[cluster * 2 + 1] = count;
+			Next[cluster] = IndexCount;
+			IndexCount += count;
+			BusyClusters += count > 0 ? 1 : 0;
+			MaxPerCluster = std::max(MaxPerCluster, Counts[cluster]);
+		}
+
+		pool.parallelFor(CLUSTER_Z, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int slice = begin; slice < end; slice++) {
+				this->binSlice(slice, true);
+			}
+		});
+	}
+
+	// Send what build() produced and bind the three buffer textures to firstUnit and the two units after it.
+	void upload(unsigned int firstUnit) {
+		const void* data[BUFFER_COUNT] = { LightData.data(), Grid.data(), Indices.data() };
+		const size_t sizes[BUFFER_COUNT] = { LightCount * CLUSTER_LIGHT_TEXELS * sizeof(glm::vec4), Grid.size() * sizeof(uint32_t), IndexCount * sizeof(uint16_t) };
+		const size_t capacities[BUFFER_COUNT] = { LightData.size() * sizeof(glm::vec4), Grid.size() * sizeof(uint32_t), Indices.size() * sizeof(uint16_t) };
+		for (unsigned int i = 0; i < BUFFER_COUNT; i++) {
+			glBindBuffer(GL_TEXTURE_BUFFER, Buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, capacities[i], nullptr, GL_STREAM_DRAW);
+			if (sizes[i] > 0) {
+				glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+			}
+			glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+			glBindTexture(GL_TEXTURE_BUFFER, Textures[i]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Distance where the attenuation takes the brightest channel under CLUSTER_LIGHT_THRESHOLD
+	static float lightRange(const Light& light) {
+		glm::vec3 peak = glm::max(light.Ambient, glm::max(light.Diffuse, light.Specular));
+		float target = std::max(peak.x, std::max(peak.y, peak.z)) / CLUSTER_LIGHT_THRESHOLD;
+		if (target <= light.Constant) {
+			return 0.0f;
+		}
+		if (light.Quadratic > 0.0f) {
+			float discriminant = light.Linear * light.Linear - 4.0f * light.Quadratic * (light.Constant - target);
+			return (-light.Linear + std::sqrt(discriminant)) / (2.0f * light.Quadratic);
+		}
+		if (light.Linear > 0.0f) {
+			return (target - light.Constant) / light.Linear;
+		}
+		return INFINITE_RANGE;
+	}
+
+	float getSliceScale() const { return SliceScale; }
+	float getSliceBias() const { return SliceBias; }
+
+	// Outcome of the last build(), for the UI
+	unsigned int getLightCount() const { return LightCount; }
+	unsigned int getDropped() const { return Dropped; }
+	unsigned int getIndexCount() const { return IndexCount; }
+	unsigned int getBusyClusters() const { return BusyClusters; }
+	unsigned int getMaxPerCluster() const { return MaxPerCluster; }
+
+private:
+	enum Cluster_Buffer {
+		BUFFER_LIGHTS,
+		BUFFER_GRID,
+		BUFFER_INDICES,
+		BUFFER_COUNT
+	};
+
+	static constexpr float INFINITE_RANGE = 1.0e30f;
+
+	// Clusters a light touches, inclusive; an empty range (First > Last) when it is out of view
+	struct ClusterRange {
+		unsigned short FirstX, LastX, FirstY, LastY, FirstZ, LastZ;
+	};
+
+	unsigned int Buffers[BUFFER_COUNT];
+	unsigned int Textures[BUFFER_COUNT];
+	std::vector<glm::vec4> LightData;
+	std::vector<ClusterRange> Ranges;
+	std::vector<unsigned int> Counts;
+	std::vector<unsigned int> Next;
+	std::vector<uint32_t> Grid;
+	std::vector<uint16_t> Indices;
+	unsigned int LightCount;
+	unsigned int IndexCount;
+	unsigned int Dropped;
+	unsigned int BusyClusters;
+	unsigned int MaxPerCluster;
+	float SliceScale;
+	float SliceBias;
+
+	void packLight(unsigned int index, const Light& light, float range) {
+		glm::vec4* texels = &LightData[index * CLUSTER_LIGHT_TEXELS];
+		texels[0] = glm::vec4(light.Position, range);
+		texels[1] = glm::vec4(light.Direction, (float)light.Caster);
+		texels[2] = glm::vec4(light.Ambient, light.Constant);
+		texels[3] = glm::vec4(light.Diffuse, light.Linear);
+		texels[4] = glm::vec4(light.Specular, light.Quadratic);
+		texels[5] = glm::vec4(glm::cos(glm::radians(light.Cutoff)), glm::cos(glm::radians(light.OuterCutoff)), light.Exponent, 0.0f);
+	}
+
+	unsigned int sliceOf(float depth) const {
+		float slice = std::log(depth) * SliceScale + SliceBias;
+		return std::min(CLUSTER_Z - 1, (unsigned int)std::max(slice, 0.0f));
+	}
+
+	// The light's sphere as a box of clusters. Depth comes from the sphere's view-space extent,
+	// x and y from the screen bounds of its view-space box, or the whole screen when it reaches the near plane.
+	ClusterRange clusterRange(const glm::vec3& position, float range, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane) const {
+		ClusterRange empty = { 1, 0, 1, 0, 1, 0 };
+		glm::vec3 center = glm::vec3(view * glm::vec4(position, 1.0f));
+		float closest = -center.z - range;
+		float furthest = -center.z + range;
+		if (furthest < nearPlane || closest > farPlane) {
+			return empty;
+		}
+
+		glm::vec2 low(-1.0f);
+		glm::vec2 high(1.0f);
+		if (closest > nearPlane) {
+			low = glm::vec2(1.0f);
+			high = glm::vec2(-1.0f);
+			for (unsigned int corner = 0; corner < 8; corner++) {
+				glm::vec3 offset((corner & 1) ? range : -range, (corner & 2) ? range : -range, (corner & 4) ? range : -range);
+				glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+				glm::vec2 ndc = glm::vec2(clip) / clip.w;
+				low = glm::min(low, ndc);
+				high = glm::max(high, ndc);
+			}
+			if (high.x < -1.0f || high.y < -1.0f || low.x > 1.0f || low.y > 1.0f) {
+				return empty;
+			}
+		}
+
+		ClusterRange result;
+		result.FirstX = (unsigned short)this->tileOf(low.x, CLUSTER_X);
+		result.LastX = (unsigned short)this->tileOf(high.x, CLUSTER_X);
+		result.FirstY = (unsigned short)this->tileOf(low.y, CLUSTER_Y);
+		result.LastY = (unsigned short)this->tileOf(high.y, CLUSTER_Y);
+		result.FirstZ = (unsigned short)this->sliceOf(std::max(closest, nearPlane));
+		result.LastZ = (unsigned short)this->sliceOf(std::min(furthest, farPlane));
+		return result;
+	}
+
+	static unsigned int tileOf(float ndc, unsigned int tiles) {
+		float tile = (ndc * 0.5f + 0.5f) * tiles;
+		return std::min(tiles - 1, (unsigned int)std::max(tile, 0.0f));
+	}
+
+	// Count the lights of every cluster in the slice, or with fill set write their indices from Next.
+	void binSlice(unsigned int slice, bool fill) {
+		unsigned int first = slice * CLUSTER_X * CLUSTER_Y;
+		if (!fill) {
+			std::fill(Counts.begin() + first, Counts.begin() + first + CLUSTER_X * CLUSTER_Y, 0u);
+		}
+		for (unsigned int light = 0; light < LightCount; light++) {
+			const ClusterRange& range = Ranges[light];
+			if (slice < range.FirstZ || slice > range.LastZ) {
+				continue;
+			}
+			for (unsigned int y = range.FirstY; y <= range.LastY; y++) {
+				for (unsigned int x = range.FirstX; x <= range.LastX; x++) {
+					unsigned int cluster = first + y * CLUSTER_X + x;
+					if (!fill) {
+						Counts[cluster]++;
+					} else if (Next[cluster] < Grid[cluster * 2] + Grid[cluster * 2 + 1]) {
+						Indices[Next[cluster]++] = (uint16_t)light;
+					}
+				}
+			}
+		}
+	}
+};
+
+#endif // !CLUSTEREDLIGHTS_H
@@ -1,11 +1,36 @@
 #pragma once
 #define _USE_MATH_DEFINES
 
+#include <cmath>
+#include <iostream>
 #include <vector>
 
 const unsigned int MIN_LONGITUDE = 3;
 const unsigned int MIN_LATITUDE = 1;
 
+// One level of detail: its resolution and where its triangles sit in the shared index array.
+struct CylinderLod {
+	unsigned int Longitude;
+	unsigned int Latitude;
+	unsigned int IndexOffset;
+	unsigned int IndexCount;
+};
+
+// The coarsest of lodCount LODs an object pixels long on screen is big enough for, LOD l + 1 starts below thresholds[l] * scale.
+// Thresholds above the current LOD are raised by hysteresis and the ones at or below it lowered,
+// so an object has to cross a threshold by that much before it changes.
+inline unsigned int selectLod(unsigned int current, float pixels, const float* thresholds, unsigned int lodCount, float scale, float hysteresis) {
+	unsigned int lod = 0;
+	while (lod < lodCount - 1) {
+		float threshold = thresholds[lod] * scale * (lod < current ? 1.0f + hysteresis : 1.0f - hysteresis);
+		if (pixels >= threshold) {
+			break;
+		}
+		lod++;
+	}
+	return lod;
+}
+
 class Cylinder
 {
 public:
@@ -45,7 +70,7 @@ public:
 		}
 
 		this->Latitude = latitude;
-		if (longitude < MIN_LONGITUDE) {
+		if (latitude < MIN_LATITUDE) {
 			this->Latitude = MIN_LATITUDE;
 		}
 
@@ -53,9 +78,38 @@ public:
 
 		this->generateVertices();
 
+		// The full mesh is LOD 0, coarser levels are appended with addLod()
+		std::vector<CylinderLod>(1, CylinderLod{ this->Longitude, this->Latitude, 0, (unsigned int)this->Indices.size() }).swap(this->Lods);
+
 		// this->showInfo();
 	}
 
+	// Append the same shape at a lower resolution after the current data, so every LOD shares one vertex and one index buffer.
+	// The indices already point at the appended vertices. Changing the shape with set() drops the chain.
+	void addLod(unsigned int longitude, unsigned int latitude) {
+		Cylinder lod(this->BaseRadius, this->TopRadius, this->Height, longitude, latitude);
+		unsigned int baseVertex = this->getVertexCount();
+		unsigned int indexOffset = (unsigned int)this->Indices.size();
+
+		this->Vertices.insert(this->Vertices.end(), lod.Vertices.begin(), lod.Vertices.end());
+		this->Position.insert(this->Position.end(), lod.Position.begin(), lod.Position.end());
+		this->Normals.insert(this->Normals.end(), lod.Normals.begin(), lod.Normals.end());
+		this->TexCoords.insert(this->TexCoords.end(), lod.TexCoords.begin(), lod.TexCoords.end());
+		for (unsigned int index : lod.Indices) {
+			this->Indices.push_back(baseVertex + index);
+		}
+
+		this->Lods.push_back(CylinderLod{ lod.Longitude, lod.Latitude, indexOffset, (unsigned int)lod.Indices.size() });
+	}
+
+	unsigned int getLodCount() const {
+		return (unsigned int)this->Lods.size();
+	}
+
+	const CylinderLod& getLod(unsigned int level) const {
+		return this->Lods[level];
+	}
+
 	void setBaseRadius(float radius) {
 		if (this->BaseRadius != radius) {
 			this->set(radius, this->TopRadius, this->Height, this->Longitude, this->Latitude);
@@ -179,6 +233,7 @@ private:
 	std::vector<float> Normals;
 	std::vector<float> TexCoords;
 	std::vector<unsigned int> Indices;
+	std::vector<CylinderLod> Lods;
 
 	void clearVectors() {
 		std::vector<float>().swap(this->Vertices);
@@ -0,0 +1,155 @@
+#ifndef DEPTHSORT_H
+#define DEPTHSORT_H
+
+#include <glm/glm.hpp>
+
+#include "../Headers/billboard.h"
+#include "../Headers/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// View depth is quantized over [0, far] into keys of DEPTH_SORT_KEY_BITS, sorted as two digits of DEPTH_SORT_DIGIT_BITS.
+// 22 bits tell sprites apart down to 1/16000 of a unit at the default far plane, in two passes instead of four.
+const unsigned int DEPTH_SORT_DIGIT_BITS = 11;
+const unsigned int DEPTH_SORT_KEY_BITS = 2 * DEPTH_SORT_DIGIT_BITS;
+const unsigned int DEPTH_SORT_BUCKETS = 1u << DEPTH_SORT_DIGIT_BITS;
+const uint32_t DEPTH_SORT_MAX_KEY = (1u << DEPTH_SORT_KEY_BITS) - 1;
+// Blocks per pool thread, and the fewest sprites worth a block of their own
+const unsigned int DEPTH_SORT_BLOCKS_PER_THREAD = 2;
+const unsigned int DEPTH_SORT_MIN_BLOCK = 4096;
+
+// Orders billboard instances back to front for the blended pass with a least significant digit radix sort.
+// Every pass splits the instances into the same blocks: each block counts its digits, one serial pass turns the counts
+// into where every block writes each digit, and the blocks scatter side by side. Blocks keep their order, so the sort
+// is stable and the result is the same whatever the thread count. The last pass moves the instances themselves.
+// The scratch arrays keep their size, a steady frame allocates nothing.
+class DepthSorter {
+public:
+	DepthSorter() : Count(0), Blocks(0), BlockSize(0), Milliseconds(0.0f), MedianDepth(0.0f) {}
+
+	DepthSorter(const DepthSorter&) = delete;
+	DepthSorter& operator=(const DepthSorter&) = delete;
+
+	// Write instances to sorted, farthest from eye along forward first. Depth is taken at the middle of each quad.
+	void sort(const BillboardInstance* instances, unsigned int count, const glm::vec3& eye, const glm::vec3& forward, float farPlane, ThreadPool& pool, BillboardInstance* sorted) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Count = count;
+		if (count == 0) {
+			Milliseconds = 0.0f;
+			return;
+		}
+		unsigned int maxBlocks = pool.getThreadCount() * DEPTH_SORT_BLOCKS_PER_THREAD;
+		Blocks = std::min(maxBlocks, (count + DEPTH_SORT_MIN_BLOCK - 1) / DEPTH_SORT_MIN_BLOCK);
+		BlockSize = (count + Blocks - 1) / Blocks;
+		if (Keys.size() < count) {
+			Keys.resize(count);
+			PassKeys.resize(count);
+			Indices.resize(count);
+		}
+		if (Offsets.size() < Blocks * DEPTH_SORT_BUCKETS) {
+			Offsets.resize(Blocks * DEPTH_SORT_BUCKETS);
+		}
+
+		// Keys, inverted so the farthest comes first, counted by their low digit on the way.
+		// The loops work on local pointers and bounds, stores through a uint32_t* could alias the members otherwise.
+		uint32_t* keys = Keys.data();
+		uint32_t* passKeys = PassKeys.data();
+		uint32_t* indices = Indices.data();
+		float scale = DEPTH_SORT_MAX_KEY / farPlane;
+		pool.parallelFor(Blocks, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int block = begin; block < end; block++) {
+				uint32_t* offsets = this->clearOffsets(block);
+				unsigned int last = this->blockLast(block);
+				for (unsigned int i = this->blockFirst(block); i < last; i++) {
+					const BillboardInstance& instance = instances[i];
+					glm::vec3 center = instance.Position + glm::vec3(0.0f, instance.Height * 0.5f, 0.0f);
+					float depth = glm::clamp(glm::dot(center - eye, forward) * scale, 0.0f, (float)DEPTH_SORT_MAX_KEY);
+					uint32_t key = DEPTH_SORT_MAX_KEY - (uint32_t)depth;
+					keys[i] = key;
+					offsets[key & (DEPTH_SORT_BUCKETS - 1)]++;
+				}
+			}
+		});
+		this->prefixOffsets();
+		pool.parallelFor(Blocks, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int block = begin; block < end; block++) {
+				uint32_t* offsets = &Offsets[block * DEPTH_SORT_BUCKETS];
+				unsigned int last = this->blockLast(block);
+				for (unsigned int i = this->blockFirst(block); i < last; i++) {
+					uint32_t target = offsets[keys[i] & (DEPTH_SORT_BUCKETS - 1)]++;
+					passKeys[target] = keys[i];
+					indices[target] = i;
+				}
+			}
+		});
+
+		// High digit, the instances go straight to their final place
+		pool.parallelFor(Blocks, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int block = begin; block < end; block++) {
+				uint32_t* offsets = this->clearOffsets(block);
+				unsigned int last = this->blockLast(block);
+				for (unsigned int i = this->blockFirst(block); i < last; i++) {
+					offsets[passKeys[i] >> DEPTH_SORT_DIGIT_BITS]++;
+				}
+			}
+		});
+		this->prefixOffsets();
+		pool.parallelFor(Blocks, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int block = begin; block < end; block++) {
+				uint32_t* offsets = &Offsets[block * DEPTH_SORT_BUCKETS];
+				unsigned int last = this->blockLast(block);
+				for (unsigned int i = this->blockFirst(block); i < last; i++) {
+					sorted[offsets[passKeys[i] >> DEPTH_SORT_DIGIT_BITS]++] = instances[indices[i]];
+				}
+			}
+		});
+
+		const BillboardInstance& median = sorted[count / 2];
+		MedianDepth = glm::dot(median.Position + glm::vec3(0.0f, median.Height * 0.5f, 0.0f) - eye, forward);
+		Milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	unsigned int getCount() const { return Count; }
+	unsigned int getBlocks() const { return Blocks; }
+	float getMilliseconds() const { return Milliseconds; }
+	// Orders the whole batch against the other blended draws, which can only come before or after all of it
+	float getMedianDepth() const { return MedianDepth; }
+
+private:
+	std::vector<uint32_t> Keys;
+	std::vector<uint32_t> PassKeys;
+	std::vector<uint32_t> Indices;
+	// Digit counts per block, turned in place into the position each block writes the digit at next
+	std::vector<uint32_t> Offsets;
+	unsigned int Count;
+	unsigned int Blocks;
+	unsigned int BlockSize;
+	float Milliseconds;
+	float MedianDepth;
+
+	unsigned int blockFirst(unsigned int block) const { return std::min(Count, block * BlockSize); }
+	unsigned int blockLast(unsigned int block) const { return std::min(Count, (block + 1) * BlockSize); }
+
+	uint32_t* clearOffsets(unsigned int block) {
+		uint32_t* offsets = &Offsets[block * DEPTH_SORT_BUCKETS];
+		std::fill(offsets, offsets + DEPTH_SORT_BUCKETS, 0u);
+		return offsets;
+	}
+
+	// Digits in order, inside a digit the blocks in order
+	void prefixOffsets() {
+		uint32_t offset = 0;
+		for (unsigned int digit = 0; digit < DEPTH_SORT_BUCKETS; digit++) {
+			for (unsigned int block = 0; block < Blocks; block++) {
+				uint32_t count = Offsets[block * DEPTH_SORT_BUCKETS + digit];
+				Offsets[block * DEPTH_SORT_BUCKETS + digit] = offset;
+				offset += count;
+			}
+		}
+	}
+};
+
+#endif // !DEPTHSORT_H
@@ -0,0 +1,290 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <glad/glad.h>
+
+#include "../Headers/logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+// Frame budget the controller holds, 60 Hz
+const float RESOLUTION_TARGET_MS = 1000.0f / 60.0f;
+// Share of the budget the scene may take on the GPU, the rest is left for the UI, the upscale and noise
+const float RESOLUTION_HEADROOM = 0.85f;
+// The scale only goes back up once the scene is this far under its share, so it doesn't hunt around the edge
+const float RESOLUTION_RAISE_BELOW = 0.75f;
+const float RESOLUTION_MIN_SCALE = 0.5f;
+const float RESOLUTION_MAX_SCALE = 1.0f;
+// Scales are multiples of this, small changes would only reshuffle a few pixel rows
+const float RESOLUTION_STEP = 1.0f / 32.0f;
+// Largest change per adjustment, down and up
+const float RESOLUTION_MAX_DROP = 0.8f;
+const float RESOLUTION_MAX_RAISE = 1.05f;
+// Frames to wait after a change; timer results come a few frames late and the average needs to catch up
+const unsigned int RESOLUTION_COOLDOWN = 8;
+// Weight of the newest frame in the averaged timings
+const float RESOLUTION_SMOOTHING = 0.2f;
+// Timings are cut off at this many budgets before averaging; a stray timer result (some drivers return garbage for
+// the first query) would otherwise hold the average up for many frames
+const float RESOLUTION_SAMPLE_LIMIT = 4.0f;
+
+// GPU time queries in flight, reading one back before it is done would stall the frame
+const unsigned int GPU_TIMER_QUERIES = 4;
+
+// GL_TIME_ELAPSED around a span of the frame, read back a few frames later.
+// Elapsed-time queries can't nest, so only one span per frame is timed this way.
+class GpuTimer {
+public:
+	GpuTimer() : Head(0), Tail(0), Active(false) {
+		for (unsigned int i = 0; i < GPU_TIMER_QUERIES; i++) {
+			Queries[i] = 0;
+			Pending[i] = false;
+		}
+	}
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	void init() {
+		glGenQueries(GPU_TIMER_QUERIES, Queries);
+	}
+
+	void release() {
+		glDeleteQueries(GPU_TIMER_QUERIES, Queries);
+		for (unsigned int i = 0; i < GPU_TIMER_QUERIES; i++) {
+			Queries[i] = 0;
+			Pending[i] = false;
+		}
+	}
+
+	// A frame whose query slot is still in flight goes untimed rather than waiting on it.
+	void begin() {
+		Active = !Pending[Head];
+		if (Active) {
+			glBeginQuery(GL_TIME_ELAPSED, Queries[Head]);
+		}
+	}
+
+	void end() {
+		if (!Active) {
+			return;
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		Pending[Head] = true;
+		Head = (Head + 1) % GPU_TIMER_QUERIES;
+		Active = false;
+	}
+
+	// Collect every finished query, false when none finished since the last call. milliseconds gets the newest.
+	bool poll(float& milliseconds) {
+		bool found = false;
+		while (Pending[Tail]) {
+			GLint available = 0;
+			glGetQueryObjectiv(Queries[Tail], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(Queries[Tail], GL_QUERY_RESULT, &nanoseconds);
+			milliseconds = (float)(nanoseconds / 1.0e6);
+			Pending[Tail] = false;
+			Tail = (Tail + 1) % GPU_TIMER_QUERIES;
+			found = true;
+		}
+		return found;
+	}
+
+private:
+	unsigned int Queries[GPU_TIMER_QUERIES];
+	bool Pending[GPU_TIMER_QUERIES];
+	unsigned int Head;
+	unsigned int Tail;
+	bool Active;
+};
+
+// Picks the render scale that keeps the scene inside the frame budget.
+// The GPU time of the scene drives it: its cost goes roughly with the pixel count, i.e. the square of the scale.
+// Without a GPU timing, the CPU time of the frame stands in for it.
+class ResolutionController {
+public:
+	bool Enable;
+	float TargetMilliseconds;
+	float MinScale;
+	float MaxScale;
+
+	ResolutionController() : Enable(true), TargetMilliseconds(RESOLUTION_TARGET_MS), MinScale(RESOLUTION_MIN_SCALE), MaxScale(RESOLUTION_MAX_SCALE),
+		Scale(RESOLUTION_MAX_SCALE), GpuMilliseconds(0.0f), CpuMilliseconds(0.0f), Cooldown(0), Changes(0) {}
+
+	// gpuMilliseconds is negative when no timer result came in this frame.
+	void update(float gpuMilliseconds, float cpuMilliseconds) {
+		if (gpuMilliseconds >= 0.0f) {
+			GpuMilliseconds = this->smooth(GpuMilliseconds, gpuMilliseconds);
+		}
+		CpuMilliseconds = this->smooth(CpuMilliseconds, cpuMilliseconds);
+		if (!Enable) {
+			return;
+		}
+		if (Cooldown > 0) {
+			Cooldown--;
+			return;
+		}
+
+		float measured = GpuMilliseconds > 0.0f ? GpuMilliseconds : CpuMilliseconds;
+		float goal = TargetMilliseconds * RESOLUTION_HEADROOM;
+		if (measured <= 0.0f) {
+			return;
+		}
+		float next = Scale;
+		if (measured > goal) {
+			// Round down, so even a small overshoot gives up a step
+			next = std::floor(Scale * std::max(std::sqrt(goal / measured), RESOLUTION_MAX_DROP) / RESOLUTION_STEP) * RESOLUTION_STEP;
+		} else if (measured < goal * RESOLUTION_RAISE_BELOW) {
+			next = std::ceil(Scale * std::min(std::sqrt(goal / measured), RESOLUTION_MAX_RAISE) / RESOLUTION_STEP) * RESOLUTION_STEP;
+		}
+		this->setScale(next);
+	}
+
+	// Clamped to [MinScale, MaxScale]; also how a fixed scale is chosen while Enable is off.
+	void setScale(float scale) {
+		scale = std::min(std::max(scale, MinScale), MaxScale);
+		if (scale != Scale) {
+			Scale = scale;
+			Cooldown = RESOLUTION_COOLDOWN;
+			Changes++;
+		}
+	}
+
+	float getScale() const { return Scale; }
+	float getGpuMilliseconds() const { return GpuMilliseconds; }
+	float getCpuMilliseconds() const { return CpuMilliseconds; }
+	unsigned int getChanges() const { return Changes; }
+	// Past the budget on the CPU alone, a lower resolution won't bring the frame rate back
+	bool isCpuBound() const { return CpuMilliseconds > TargetMilliseconds; }
+
+private:
+	float Scale;
+	float GpuMilliseconds;
+	float CpuMilliseconds;
+	unsigned int Cooldown;
+	unsigned int Changes;
+
+	float smooth(float average, float sample) const {
+		sample = std::min(sample, TargetMilliseconds * RESOLUTION_SAMPLE_LIMIT);
+		return average > 0.0f ? average + (sample - average) * RESOLUTION_SMOOTHING : sample;
+	}
+};
+
+// Offscreen color and depth the scene is drawn into, sized for the full output and used from the corner up to the
+// current render size, so a change of scale never reallocates. present() upscales it onto the output framebuffer.
+// With MSAA it is resolved at render size first, a multisampled blit can't also scale.
+class SceneTarget {
+public:
+	SceneTarget() : Framebuffer(0), ColorBuffer(0), DepthBuffer(0), ResolveFramebuffer(0), ResolveBuffer(0), Width(0), Height(0), Samples(0) {}
+
+	SceneTarget(const SceneTarget&) = delete;
+	SceneTarget& operator=(const SceneTarget&) = delete;
+
+	// Reallocate when the output size or the sample count changed. Samples above GL_MAX_SAMPLES are clamped, 0 or 1 is no MSAA.
+	bool resize(unsigned int width, unsigned int height, unsigned int samples) {
+		samples = std::min(samples > 1 ? samples : 0, maxSamples());
+		if (Framebuffer != 0 && width == Width && height == Height && samples == Samples) {
+			return true;
+		}
+		this->release();
+		Width = width;
+		Height = height;
+		Samples = samples;
+
+		glGenFramebuffers(1, &Framebuffer);
+		glGenRenderbuffers(1, &ColorBuffer);
+		glGenRenderbuffers(1, &DepthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, ColorBuffer);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, Samples, GL_RGBA8, Width, Height);
+		glBindRenderbuffer(GL_RENDERBUFFER, DepthBuffer);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, Samples, GL_DEPTH_COMPONENT24, Width, Height);
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ColorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, DepthBuffer);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+		if (Samples > 0) {
+			glGenFramebuffers(1, &ResolveFramebuffer);
+			glGenRenderbuffers(1, &ResolveBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, ResolveBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height);
+			glBindFramebuffer(GL_FRAMEBUFFER, ResolveFramebuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ResolveBuffer);
+			complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (!complete) {
+			logging::loggingMessage(logging::LogType::ERROR, "Scene framebuffer " + std::to_string(Width) + "x" + std::to_string(Height) + " with " + std::to_string(Samples) + " samples is incomplete.");
+			this->release();
+			return false;
+		}
+		return true;
+	}
+
+	void bind() const {
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+	}
+
+	// Stretch the renderWidth x renderHeight corner over the whole output and leave the output bound.
+	void present(unsigned int output, unsigned int renderWidth, unsigned int renderHeight) const {
+		unsigned int source = Framebuffer;
+		if (Samples > 0) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ResolveFramebuffer);
+			glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			source = ResolveFramebuffer;
+		}
+		bool scaled = renderWidth != Width || renderHeight != Height;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, output);
+		glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, output);
+	}
+
+	void release() {
+		if (Framebuffer == 0) {
+			return;
+		}
+		glDeleteFramebuffers(1, &Framebuffer);
+		glDeleteRenderbuffers(1, &ColorBuffer);
+		glDeleteRenderbuffers(1, &DepthBuffer);
+		if (ResolveFramebuffer != 0) {
+			glDeleteFramebuffers(1, &ResolveFramebuffer);
+			glDeleteRenderbuffers(1, &ResolveBuffer);
+		}
+		Framebuffer = 0;
+		ColorBuffer = 0;
+		DepthBuffer = 0;
+		ResolveFramebuffer = 0;
+		ResolveBuffer = 0;
+	}
+
+	unsigned int getSamples() const { return Samples; }
+
+	static unsigned int maxSamples() {
+		GLint samples = 0;
+		glGetIntegerv(GL_MAX_SAMPLES, &samples);
+		return (unsigned int)std::max(samples, 0);
+	}
+
+private:
+	unsigned int Framebuffer;
+	unsigned int ColorBuffer;
+	unsigned int DepthBuffer;
+	unsigned int ResolveFramebuffer;
+	unsigned int ResolveBuffer;
+	unsigned int Width;
+	unsigned int Height;
+	unsigned int Samples;
+};
+
+#endif // !DYNAMICRESOLUTION_H
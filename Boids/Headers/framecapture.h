@@ -0,0 +1,290 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <glad/glad.h>
+
+#include "../Headers/logging.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pixel pack buffers the frames rotate through. CAPTURE_LATENCY of them are waiting on the GPU, the rest
+// are mapped for the writer, so it can fall this far behind before frames get dropped.
+const unsigned int CAPTURE_RING = 4;
+// Frames between reading into a buffer and mapping it, by then the copy has long finished
+const unsigned int CAPTURE_LATENCY = 2;
+// Nominal rate written to the Y4M header, the real one is whatever the renderer managed
+const unsigned int CAPTURE_FRAME_RATE = 60;
+// How long stop() waits on a readback still in flight
+const GLuint64 CAPTURE_WAIT_NS = 1000000000;
+
+enum Capture_Format {
+	CAPTURE_Y4M,	// YUV4MPEG2, 4:4:4 BT.601, plays in mpv and converts with ffmpeg
+	CAPTURE_RAW		// RGBA rows top to bottom, ffmpeg -f rawvideo -pixel_format rgba -video_size WxH
+};
+
+// Writes the frames shown by the renderer to a video stream without stalling the GL thread.
+// capture() only queues a glReadPixels into a pack buffer, the buffer is mapped CAPTURE_LATENCY frames
+// later, and a writer thread converts and writes straight from the mapping. The GL thread unmaps it
+// once the writer is done. When the writer falls behind, frames are dropped rather than waited for.
+// stop() has to run while the context is still current.
+class FrameCapture {
+public:
+	FrameCapture() : Active(false), Stop(false), Format(CAPTURE_Y4M), Width(0), Height(0), Head(0), Tail(0), Frame(0), Captured(0), Dropped(0) {
+		for (Slot& slot : Slots) {
+			slot.Buffer = 0;
+			slot.Fence = nullptr;
+			slot.Data = nullptr;
+			slot.State = SLOT_FREE;
+			slot.Frame = 0;
+		}
+	}
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	// The format follows the extension, .y4m or anything else for raw RGBA.
+	bool start(const std::string& path, unsigned int width, unsigned int height) {
+		if (Active) {
+			this->stop();
+		}
+		Format = (path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0) ? CAPTURE_Y4M : CAPTURE_RAW;
+		File.open(path, std::ios::binary);
+		if (!File.is_open()) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to open capture file: " + path);
+			return false;
+		}
+		if (Format == CAPTURE_Y4M) {
+			File << "YUV4MPEG2 W" << width << " H" << height << " F" << CAPTURE_FRAME_RATE << ":1 Ip A1:1 C444\n";
+		}
+
+		Path = path;
+		Width = width;
+		Height = height;
+		Head = 0;
+		Tail = 0;
+		Frame = 0;
+		Captured = 0;
+		Dropped = 0;
+		Stop = false;
+		Planes.resize(Format == CAPTURE_Y4M ? (size_t)width * height * 3 : 0);
+
+		for (Slot& slot : Slots) {
+			glGenBuffers(1, &slot.Buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, this->frameBytes(), nullptr, GL_STREAM_READ);
+			slot.State = SLOT_FREE;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		Writer = std::thread(&FrameCapture::writerLoop, this);
+		Active = true;
+		logging::loggingMessage(logging::LogType::INFO, "Capturing " + std::to_string(width) + "x" + std::to_string(height) + " to " + path);
+		return true;
+	}
+
+	// Call after the scene is drawn, with the read framebuffer holding it. A change of size ends the capture.
+	void capture(unsigned int width, unsigned int height) {
+		if (!Active) {
+			return;
+		}
+		if (width != Width || height != Height) {
+			logging::loggingMessage(logging::LogType::WARNING, "Framebuffer size changed, capture stopped.");
+			this->stop();
+			return;
+		}
+
+		this->unmapWritten();
+		while (this->stateOf(Tail) == SLOT_READING && Frame - Slots[Tail].Frame >= CAPTURE_LATENCY) {
+			this->map(Tail);
+			Tail = (Tail + 1) % CAPTURE_RING;
+		}
+
+		Slot& slot = Slots[Head];
+		if (this->stateOf(Head) != SLOT_FREE) {
+			Dropped++;
+		} else {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+			glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			slot.Frame = Frame;
+			this->setState(slot, SLOT_READING);
+			Head = (Head + 1) % CAPTURE_RING;
+			Captured++;
+		}
+		Frame++;
+	}
+
+	// Write out every frame already read back, then release the buffers and close the file.
+	void stop() {
+		if (!Active) {
+			return;
+		}
+		while (this->stateOf(Tail) == SLOT_READING) {
+			this->map(Tail);
+			Tail = (Tail + 1) % CAPTURE_RING;
+		}
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stop = true;
+		}
+		Condition.notify_all();
+		Writer.join();
+
+		this->unmapWritten();
+		for (Slot& slot : Slots) {
+			glDeleteBuffers(1, &slot.Buffer);
+			slot.Buffer = 0;
+			slot.State = SLOT_FREE;
+		}
+		File.close();
+		Active = false;
+		logging::loggingMessage(logging::LogType::INFO, "Captured " + std::to_string(Captured) + " frames to " + Path + ", " + std::to_string(Dropped) + " dropped.");
+	}
+
+	bool isActive() const { return Active; }
+	unsigned int getCaptured() const { return Captured; }
+	unsigned int getDropped() const { return Dropped; }
+	const std::string& getPath() const { return Path; }
+
+private:
+	enum Slot_State {
+		SLOT_FREE,
+		SLOT_READING,	// glReadPixels queued, Fence signals when it's done
+		SLOT_MAPPED,	// Data points at the frame, owned by the writer
+		SLOT_WRITTEN	// The writer is done, the GL thread unmaps it
+	};
+
+	struct Slot {
+		unsigned int Buffer;
+		GLsync Fence;
+		const unsigned char* Data;
+		Slot_State State;
+		unsigned int Frame;
+	};
+
+	bool Active;
+	bool Stop;
+	Capture_Format Format;
+	std::string Path;
+	std::ofstream File;
+	unsigned int Width;
+	unsigned int Height;
+	Slot Slots[CAPTURE_RING];
+	// Next slot to read into, and the oldest one still reading; the writer follows behind in the same order
+	unsigned int Head;
+	unsigned int Tail;
+	unsigned int Frame;
+	unsigned int Captured;
+	unsigned int Dropped;
+	// Converted frame, only touched by the writer
+	std::vector<unsigned char> Planes;
+	std::thread Writer;
+	std::mutex Mutex;
+	std::condition_variable Condition;
+
+	size_t frameBytes() const { return (size_t)Width * Height * 4; }
+
+	Slot_State stateOf(unsigned int index) {
+		std::lock_guard<std::mutex> lock(Mutex);
+		return Slots[index].State;
+	}
+
+	void setState(Slot& slot, Slot_State state) {
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			slot.State = state;
+		}
+		Condition.notify_all();
+	}
+
+	// Hand the slot to the writer. A failed map still passes it on, with no data, so the order is kept.
+	void map(unsigned int index) {
+		Slot& slot = Slots[index];
+		glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, CAPTURE_WAIT_NS);
+		glDeleteSync(slot.Fence);
+		slot.Fence = nullptr;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+		slot.Data = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->frameBytes(), GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (slot.Data == nullptr) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to map capture buffer, frame skipped.");
+		}
+		this->setState(slot, SLOT_MAPPED);
+	}
+
+	void unmapWritten() {
+		for (unsigned int i = 0; i < CAPTURE_RING; i++) {
+			Slot& slot = Slots[i];
+			if (this->stateOf(i) != SLOT_WRITTEN) {
+				continue;
+			}
+			if (slot.Data != nullptr) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				slot.Data = nullptr;
+			}
+			this->setState(slot, SLOT_FREE);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	void writerLoop() {
+		unsigned int index = 0;
+		while (true) {
+			Slot& slot = Slots[index];
+			{
+				// Everything mapped before stop() is still written
+				std::unique_lock<std::mutex> lock(Mutex);
+				Condition.wait(lock, [this, &slot] { return slot.State == SLOT_MAPPED || Stop; });
+				if (slot.State != SLOT_MAPPED) {
+					return;
+				}
+			}
+			if (slot.Data != nullptr) {
+				this->writeFrame(slot.Data);
+			}
+			this->setState(slot, SLOT_WRITTEN);
+			index = (index + 1) % CAPTURE_RING;
+		}
+	}
+
+	// GL rows run bottom to top, the streams top to bottom
+	void writeFrame(const unsigned char* pixels) {
+		size_t rowBytes = (size_t)Width * 4;
+		if (Format == CAPTURE_RAW) {
+			for (unsigned int y = 0; y < Height; y++) {
+				File.write((const char*)pixels + (Height - 1 - y) * rowBytes, rowBytes);
+			}
+			return;
+		}
+
+		// Limited range BT.601 in 8.8 fixed point
+		size_t planeSize = (size_t)Width * Height;
+		unsigned char* yPlane = Planes.data();
+		unsigned char* uPlane = yPlane + planeSize;
+		unsigned char* vPlane = uPlane + planeSize;
+		for (unsigned int y = 0; y < Height; y++) {
+			const unsigned char* row = pixels + (Height - 1 - y) * rowBytes;
+			size_t out = (size_t)y * Width;
+			for (unsigned int x = 0; x < Width; x++, out++) {
+				int r = row[x * 4];
+				int g = row[x * 4 + 1];
+				int b = row[x * 4 + 2];
+				yPlane[out] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				uPlane[out] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				vPlane[out] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		}
+		File << "FRAME\n";
+		File.write((const char*)Planes.data(), planeSize * 3);
+	}
+};
+
+#endif // !FRAMECAPTURE_H
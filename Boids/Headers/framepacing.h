@@ -0,0 +1,244 @@
+#ifndef FRAMEPACING_H
+#define FRAMEPACING_H
+
+#include <glad/glad.h>
+
+#include "../Headers/logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+// Length of the sleeps the limiter takes before it spins; short enough to stop close to the deadline,
+// long enough that the scheduler actually gives the core away
+const float LIMITER_SLEEP_MS = 1.0f;
+// Sleep overshoot assumed before any sleep was measured
+const float LIMITER_INITIAL_ESTIMATE_MS = 5.0f;
+// Sleeps measured before the estimate is rebuilt, so a quieter system can bring it back down
+const unsigned int LIMITER_ESTIMATE_RESET = 1000;
+// A frame this many periods late starts the schedule over instead of rushing the next ones to catch up
+const float LIMITER_MAX_BEHIND = 2.0f;
+
+// Input-to-swap samples per report
+const unsigned int LATENCY_WINDOW = 240;
+// Swaps in flight that are waited on at most, a GPU further behind has its oldest swap dropped from the measurement
+const unsigned int LATENCY_FENCES = 8;
+
+// Swap intervals, VSYNC_ADAPTIVE only waits when the frame is on time and tears when it is late
+// (needs EXT_swap_control_tear, plain vsync otherwise)
+enum Vsync_Mode {
+	VSYNC_OFF,
+	VSYNC_ON,
+	VSYNC_ADAPTIVE,
+	VSYNC_MODE_COUNT
+};
+
+const char* const VSYNC_MODE_NAMES[VSYNC_MODE_COUNT] = {
+	"Off",
+	"On",
+	"Adaptive",
+};
+
+const int VSYNC_SWAP_INTERVALS[VSYNC_MODE_COUNT] = { 0, 1, -1 };
+
+// Holds the loop to a fixed rate by waiting until the next frame is due. The OS sleep is only precise to its timer
+// resolution (around 1 ms on Linux, up to 15.6 ms on Windows), so the wait sleeps in short steps while more time is
+// left than a sleep has been seen to take, and spins the rest.
+class FrameLimiter {
+public:
+	// 0 turns the limiter off
+	float TargetFps;
+
+	FrameLimiter() : TargetFps(0.0f), Started(false), Sleeps(0), Mean(LIMITER_INITIAL_ESTIMATE_MS), Squares(0.0f),
+		Estimate(LIMITER_INITIAL_ESTIMATE_MS), WaitMilliseconds(0.0f), LateMilliseconds(0.0f) {}
+
+	// Wait until the next frame is due, call it once per frame at the top of the loop
+	void wait() {
+		Clock::time_point now = Clock::now();
+		if (TargetFps <= 0.0f) {
+			Started = false;
+			WaitMilliseconds = 0.0f;
+			LateMilliseconds = 0.0f;
+			return;
+		}
+		Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / TargetFps));
+		if (!Started || now - Deadline > period * LIMITER_MAX_BEHIND) {
+			Started = true;
+			Deadline = now;
+		}
+		Deadline += period;
+		if (now >= Deadline) {
+			WaitMilliseconds = 0.0f;
+			LateMilliseconds = milliseconds(now - Deadline);
+			return;
+		}
+
+		while (milliseconds(Deadline - Clock::now()) > Estimate) {
+			Clock::time_point before = Clock::now();
+			std::this_thread::sleep_for(std::chrono::duration<float, std::milli>(LIMITER_SLEEP_MS));
+			this->addSleep(milliseconds(Clock::now() - before));
+		}
+		while (Clock::now() < Deadline) {
+			std::this_thread::yield();
+		}
+		Clock::time_point end = Clock::now();
+		WaitMilliseconds = milliseconds(end - now);
+		LateMilliseconds = milliseconds(end - Deadline);
+	}
+
+	// How long a sleep is expected to take at most, the spin covers the last part of the wait
+	float getSleepEstimate() const { return Estimate; }
+	// The last wait, and how far past its deadline it woke up
+	float getWaitMilliseconds() const { return WaitMilliseconds; }
+	float getLateMilliseconds() const { return LateMilliseconds; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	bool Started;
+	Clock::time_point Deadline;
+	unsigned int Sleeps;
+	float Mean;
+	float Squares;
+	float Estimate;
+	float WaitMilliseconds;
+	float LateMilliseconds;
+
+	static float milliseconds(Clock::duration duration) {
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+
+	// Running mean and deviation of the measured sleeps (Welford), the estimate is one deviation over the mean
+	void addSleep(float sleptMilliseconds) {
+		if (Sleeps >= LIMITER_ESTIMATE_RESET) {
+			Sleeps = 0;
+			Mean = Estimate;
+			Squares = 0.0f;
+		}
+		Sleeps++;
+		float delta = sleptMilliseconds - Mean;
+		Mean += delta / Sleeps;
+		Squares += delta * (sleptMilliseconds - Mean);
+		// Rounding can leave Squares a hair under zero, the NaN would stop the sleeps for good
+		Estimate = Mean + std::sqrt(std::max(0.0f, Squares) / Sleeps);
+	}
+};
+
+// Time from the input that steered the camera being read to the GPU finishing the frame drawn with it, as percentiles
+// over windows of LATENCY_WINDOW frames. Each full window is logged while the measurement runs.
+// The loop isn't held up to measure it, that would stop the CPU from queueing frames ahead and hide the latency that
+// queueing adds: addSwap() puts a fence after the swap, and poll() checks the fences without waiting. A sample is taken
+// at the first poll that finds its fence signaled, so it is late by at most the time between two polls.
+class LatencyMeter {
+public:
+	bool Enable;
+
+	LatencyMeter() : Enable(false), Count(0), Reports(0), P50(0.0f), P90(0.0f), P99(0.0f), Max(0.0f),
+		FenceHead(0), FenceCount(0), DroppedSwaps(0) {}
+
+	LatencyMeter(const LatencyMeter&) = delete;
+	LatencyMeter& operator=(const LatencyMeter&) = delete;
+
+	// Fence the frame just swapped, drawn with the input read at inputTime. Needs the context current.
+	void addSwap(std::chrono::steady_clock::time_point inputTime) {
+		if (!Enable) {
+			return;
+		}
+		if (FenceCount == LATENCY_FENCES) {
+			glDeleteSync(Fences[FenceHead].Sync);
+			FenceHead = (FenceHead + 1) % LATENCY_FENCES;
+			FenceCount--;
+			DroppedSwaps++;
+		}
+		PendingSwap& swap = Fences[(FenceHead + FenceCount) % LATENCY_FENCES];
+		swap.Sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		swap.InputTime = inputTime;
+		FenceCount++;
+	}
+
+	// Sample every swap whose fence has signaled since the last poll, oldest first. Call it a few times per frame,
+	// the more often the closer the samples are to when the GPU finished.
+	void poll() {
+		if (!Enable) {
+			this->release();
+			return;
+		}
+		while (FenceCount > 0) {
+			PendingSwap& swap = Fences[FenceHead];
+			GLint status = GL_UNSIGNALED;
+			glGetSynciv(swap.Sync, GL_SYNC_STATUS, 1, nullptr, &status);
+			if (status != GL_SIGNALED) {
+				return;
+			}
+			this->addSample(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - swap.InputTime).count());
+			glDeleteSync(swap.Sync);
+			FenceHead = (FenceHead + 1) % LATENCY_FENCES;
+			FenceCount--;
+		}
+	}
+
+	// Drop the swaps still in flight, while the context is current
+	void release() {
+		for (; FenceCount > 0; FenceCount--) {
+			glDeleteSync(Fences[FenceHead].Sync);
+			FenceHead = (FenceHead + 1) % LATENCY_FENCES;
+		}
+	}
+
+	void addSample(float milliseconds) {
+		if (!Enable) {
+			Count = 0;
+			return;
+		}
+		Window[Count++] = milliseconds;
+		if (Count < LATENCY_WINDOW) {
+			return;
+		}
+		Count = 0;
+		std::sort(Window, Window + LATENCY_WINDOW);
+		P50 = this->percentile(0.50f);
+		P90 = this->percentile(0.90f);
+		P99 = this->percentile(0.99f);
+		Max = Window[LATENCY_WINDOW - 1];
+		Reports++;
+
+		char text[128];
+		std::snprintf(text, sizeof(text), "Input to swap over %u frames: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms",
+			LATENCY_WINDOW, P50, P90, P99, Max);
+		logging::loggingMessage(logging::LogType::INFO, text);
+	}
+
+	float getP50() const { return P50; }
+	float getP90() const { return P90; }
+	float getP99() const { return P99; }
+	float getMax() const { return Max; }
+	unsigned int getReports() const { return Reports; }
+	// Samples in the window that is still filling
+	unsigned int getPending() const { return Count; }
+	// Swaps not finished yet, and the ones dropped because too many were
+	unsigned int getInFlight() const { return FenceCount; }
+	unsigned int getDroppedSwaps() const { return DroppedSwaps; }
+
+private:
+	struct PendingSwap {
+		GLsync Sync;
+		std::chrono::steady_clock::time_point InputTime;
+	};
+
+	float Window[LATENCY_WINDOW];
+	unsigned int Count;
+	unsigned int Reports;
+	float P50, P90, P99, Max;
+	PendingSwap Fences[LATENCY_FENCES];
+	unsigned int FenceHead;
+	unsigned int FenceCount;
+	unsigned int DroppedSwaps;
+
+	float percentile(float p) const {
+		return Window[(unsigned int)(p * (LATENCY_WINDOW - 1) + 0.5f)];
+	}
+};
+
+#endif // !FRAMEPACING_H
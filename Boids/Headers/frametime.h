@@ -0,0 +1,302 @@
+#ifndef FRAMETIME_H
+#define FRAMETIME_H
+
+#include "../Headers/logging.h"
+#include "../Headers/profiler.h"
+#include "../Headers/perfcounters.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+const unsigned int FRAME_HISTORY = 600;
+const unsigned int HISTOGRAM_BINS = 50;
+const float HISTOGRAM_BIN_MS = 2.0f;
+
+const unsigned int FLIGHT_FRAMES = 120;
+const float FLIGHT_THRESHOLD_MS = 30.0f;
+// Frames to wait after a dump before another spike may trigger one.
+const unsigned int FLIGHT_COOLDOWN = 120;
+// Frames ignored after startup (the first deltaTime covers asset loading).
+const unsigned int FLIGHT_WARMUP = 30;
+
+enum Sim_Phase {
+	SIM_FORCES,
+	SIM_INTEGRATE,
+	SIM_GRID,
+	SIM_PACK,
+	SIM_PHASE_COUNT
+};
+
+const char* const SIM_PHASE_NAMES[SIM_PHASE_COUNT] = {
+	"Forces",
+	"Integrate",
+	"Grid Build",
+	"Matrix Pack",
+};
+
+// Counters the simulation fills in every step; kept next to the timings so a hitch can be matched to the flock state.
+struct SimCounters {
+	unsigned int Boids;
+	unsigned int Neighbors;
+	uint64_t PairTests;
+	PerfSample Hardware[SIM_PHASE_COUNT];
+};
+
+// Rolling window of frame times with percentiles and a histogram for the UI.
+class FrameTimeTracker {
+public:
+	FrameTimeTracker() : Head(0), Count(0), StatsInterval(1), SinceStats(0), P50(0.0f), P95(0.0f), P99(0.0f), Max(0.0f) {
+		History.resize(FRAME_HISTORY, 0.0f);
+		Sorted.reserve(FRAME_HISTORY);
+		Histogram.resize(HISTOGRAM_BINS, 0.0f);
+	}
+
+	void addFrame(float milliseconds) {
+		History[Head] = milliseconds;
+		Head = (Head + 1) % FRAME_HISTORY;
+		if (Count < FRAME_HISTORY) {
+			Count++;
+		}
+		if (++SinceStats >= StatsInterval) {
+			SinceStats = 0;
+			this->computeStats();
+		}
+	}
+
+	// Recompute the percentiles and the histogram only every interval frames, the history still takes every frame
+	void setStatsInterval(unsigned int interval) { StatsInterval = std::max(1u, interval); }
+
+	float getP50() const { return P50; }
+	float getP95() const { return P95; }
+	float getP99() const { return P99; }
+	float getMax() const { return Max; }
+	unsigned int getCount() const { return Count; }
+
+	// Ring buffer for ImGui::PlotLines, oldest sample at getHistoryOffset().
+	const float* getHistory() const { return History.data(); }
+	unsigned int getHistoryOffset() const { return (Count < FRAME_HISTORY) ? 0 : Head; }
+	const float* getHistogram() const { return Histogram.data(); }
+
+private:
+	std::vector<float> History;
+	std::vector<float> Sorted;
+	std::vector<float> Histogram;
+	unsigned int Head;
+	unsigned int Count;
+	unsigned int StatsInterval;
+	unsigned int SinceStats;
+	float P50, P95, P99, Max;
+
+	void computeStats() {
+		Sorted.assign(History.begin(), History.begin() + Count);
+		std::sort(Sorted.begin(), Sorted.end());
+		P50 = this->percentile(0.50f);
+		P95 = this->percentile(0.95f);
+		P99 = this->percentile(0.99f);
+		Max = Sorted.back();
+
+		std::fill(Histogram.begin(), Histogram.end(), 0.0f);
+		for (unsigned int i = 0; i < Count; i++) {
+			unsigned int bin = (unsigned int)(Sorted[i] / HISTOGRAM_BIN_MS);
+			Histogram[std::min(bin, HISTOGRAM_BINS - 1)] += 1.0f;
+		}
+	}
+
+	float percentile(float p) const {
+		unsigned int index = (unsigned int)(p * (Count - 1) + 0.5f);
+		return Sorted[index];
+	}
+};
+
+// Keeps the last FLIGHT_FRAMES frames of per-phase timings and sim counters,
+// and writes them to a file as soon as a frame goes over the threshold.
+class FlightRecorder {
+public:
+	bool Enable;
+	float ThresholdMilliseconds;
+
+	FlightRecorder() : Enable(true), ThresholdMilliseconds(FLIGHT_THRESHOLD_MS), FrameIndex(0), Head(0), Count(0), LastDumpFrame(0), DumpCount(0) {
+		Records.resize(FLIGHT_FRAMES);
+	}
+
+	// Record the frame that just finished; returns true if it triggered a dump.
+	bool addFrame(float milliseconds, const SimCounters& counters) {
+		FrameRecord& record = Records[Head];
+		record.Frame = FrameIndex;
+		record.Milliseconds = milliseconds;
+		record.Counters = counters;
+#ifndef BOIDS_NO_PROFILE
+		const profiler::Profiler& prof = profiler::instance();
+		record.PhaseCount = prof.getPhaseCount();
+		std::copy(prof.getPhases(), prof.getPhases() + record.PhaseCount, record.Phases);
+#endif
+		Head = (Head + 1) % FLIGHT_FRAMES;
+		if (Count < FLIGHT_FRAMES) {
+			Count++;
+		}
+		FrameIndex++;
+
+		bool spike = Enable && milliseconds > ThresholdMilliseconds && FrameIndex > FLIGHT_WARMUP;
+		bool cooledDown = DumpCount == 0 || FrameIndex - LastDumpFrame > FLIGHT_COOLDOWN;
+		if (spike && cooledDown) {
+			LastDumpFrame = FrameIndex;
+			this->dump("flight_" + std::to_string(FrameIndex - 1) + ".json", milliseconds);
+			return true;
+		}
+		return false;
+	}
+
+	unsigned int getDumpCount() const { return DumpCount; }
+	const std::string& getLastDumpPath() const { return LastDumpPath; }
+
+private:
+	struct FrameRecord {
+		uint64_t Frame;
+		float Milliseconds;
+		SimCounters Counters;
+#ifndef BOIDS_NO_PROFILE
+		profiler::Phase Phases[profiler::MAX_PHASES];
+		unsigned int PhaseCount;
+#endif
+	};
+
+	std::vector<FrameRecord> Records;
+	uint64_t FrameIndex;
+	unsigned int Head;
+	unsigned int Count;
+	uint64_t LastDumpFrame;
+	unsigned int DumpCount;
+	std::string LastDumpPath;
+
+	void dump(const std::string& path, float milliseconds) {
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to open flight recorder file: " + path);
+			return;
+		}
+
+		file << "{\"threshold_ms\":" << ThresholdMilliseconds << ",\"spike_ms\":" << milliseconds << ",\"frames\":[\n";
+		unsigned int first = (Head + FLIGHT_FRAMES - Count) % FLIGHT_FRAMES;
+		for (unsigned int i = 0; i < Count; i++) {
+			const FrameRecord& record = Records[(first + i) % FLIGHT_FRAMES];
+			file << "{\"frame\":" << record.Frame << ",\"ms\":" << record.Milliseconds
+				<< ",\"boids\":" << record.Counters.Boids << ",\"neighbors\":" << record.Counters.Neighbors
+				<< ",\"pair_tests\":" << record.Counters.PairTests;
+			this->writeHardware(file, record.Counters);
+			file << ",\"phases\":[";
+#ifndef BOIDS_NO_PROFILE
+			for (unsigned int j = 0; j < record.PhaseCount; j++) {
+				const profiler::Phase& phase = record.Phases[j];
+				file << (j > 0 ? "," : "") << "{\"name\":\"" << phase.Name << "\",\"depth\":" << phase.Depth << ",\"ms\":" << phase.Milliseconds
+					<< ",\"allocs\":" << phase.Allocations << ",\"bytes\":" << phase.Bytes << "}";
+			}
+#endif
+			file << "]}" << (i + 1 < Count ? ",\n" : "\n");
+		}
+		file << "]}\n";
+
+		DumpCount++;
+		LastDumpPath = path;
+		logging::loggingMessage(logging::LogType::WARNING, "Frame took " + std::to_string(milliseconds) + " ms, flight recorder wrote " + path);
+	}
+
+	void writeHardware(std::ofstream& file, const SimCounters& counters) {
+		if (!counters.Hardware[0].Valid) {
+			return;
+		}
+		file << ",\"hardware\":{";
+		for (int i = 0; i < SIM_PHASE_COUNT; i++) {
+			file << (i > 0 ? "," : "") << "\"" << SIM_PHASE_NAMES[i] << "\":{";
+			for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+				file << (j > 0 ? "," : "") << "\"" << PERF_COUNTER_NAMES[j] << "\":" << counters.Hardware[i].Values[j];
+			}
+			file << "}";
+		}
+		file << "}";
+	}
+};
+
+// Every frame of a run limited with --frames, one CSV row each, and the percentiles over the whole run when it ends.
+// Rows go out as they come so a crashed run still leaves the frames it drew. Each row ends with the hardware counters
+// of every simulation phase (forces_cycles, ..., matrix_pack_branch_misses), left empty when the frame has none.
+class BenchmarkLog {
+public:
+	BenchmarkLog() : Frames(0) {}
+
+	// frames is the length of the run, reserved so logging doesn't allocate in the frame loop.
+	bool open(const std::string& path, unsigned int frames) {
+		File.open(path);
+		if (!File.is_open()) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to open benchmark file: " + path);
+			return false;
+		}
+		Path = path;
+		Times.reserve(frames);
+		File << "frame,ms,draw_calls,boids,visible,scale,quality";
+		for (int i = 0; i < SIM_PHASE_COUNT; i++) {
+			std::string phase = SIM_PHASE_NAMES[i];
+			std::transform(phase.begin(), phase.end(), phase.begin(), [](char c) { return c == ' ' ? '_' : (char)std::tolower(c); });
+			for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+				File << "," << phase << "_" << PERF_COUNTER_NAMES[j];
+			}
+		}
+		File << "\n";
+		return true;
+	}
+
+	bool isOpen() const { return File.is_open(); }
+
+	// scale is the render scale and quality the governor's step, so a run with --adaptive shows what they did under load.
+	// sampled says the counters were read this frame, otherwise they still hold an older frame's and are left out.
+	void addFrame(float milliseconds, unsigned int drawCalls, unsigned int boids, unsigned int visible, float scale, unsigned int quality,
+		const SimCounters& counters, bool sampled) {
+		File << Frames << "," << milliseconds << "," << drawCalls << "," << boids << "," << visible << "," << scale << "," << quality;
+		for (int i = 0; i < SIM_PHASE_COUNT; i++) {
+			const PerfSample& sample = counters.Hardware[i];
+			for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+				File << ",";
+				if (sampled && sample.Valid) {
+					File << sample.Values[j];
+				}
+			}
+		}
+		File << "\n";
+		Times.push_back(milliseconds);
+		Frames++;
+	}
+
+	void close() {
+		if (!File.is_open()) {
+			return;
+		}
+		File.close();
+		if (Times.empty()) {
+			return;
+		}
+		float total = 0.0f;
+		for (float milliseconds : Times) {
+			total += milliseconds;
+		}
+		std::sort(Times.begin(), Times.end());
+		logging::loggingMessage(logging::LogType::INFO, "Benchmark: " + std::to_string(Frames) + " frames, mean " + std::to_string(total / Frames)
+			+ " ms, p50 " + std::to_string(this->percentile(0.50f)) + " ms, p95 " + std::to_string(this->percentile(0.95f))
+			+ " ms, p99 " + std::to_string(this->percentile(0.99f)) + " ms, written to " + Path);
+	}
+
+private:
+	std::ofstream File;
+	std::string Path;
+	std::vector<float> Times;
+	unsigned int Frames;
+
+	// Times must be sorted
+	float percentile(float p) const {
+		return Times[(size_t)(p * (Times.size() - 1) + 0.5f)];
+	}
+};
+
+#endif // !FRAMETIME_H
@@ -0,0 +1,201 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Offscreen GL context for machines without a display, such as CI and the render farm.
+// The context comes from EGL, surfaceless when the driver allows it and on a 1x1 pbuffer otherwise, and the scene
+// is drawn into a framebuffer object of the requested size. With Mesa, EGL_PLATFORM=surfaceless and
+// LIBGL_ALWAYS_SOFTWARE=1 give llvmpipe on a machine without a GPU. Only wired up on Linux; elsewhere create()
+// fails with a reason instead.
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+class HeadlessContext {
+public:
+	HeadlessContext() : Framebuffer(0), ColorBuffer(0), DepthBuffer(0), Width(0), Height(0) {
+#ifdef __linux__
+		Display = EGL_NO_DISPLAY;
+		Context = EGL_NO_CONTEXT;
+		Surface = EGL_NO_SURFACE;
+#endif
+	}
+
+	~HeadlessContext() { this->release(); }
+
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+	// Create a 3.3 core context and make it current. Load GL through getProcAddress() afterwards.
+	bool create() {
+#ifdef __linux__
+		// The surfaceless platform needs no X server or DRM device; older drivers only offer the default display
+		const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay != nullptr && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+			Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		if (Display == EGL_NO_DISPLAY) {
+			Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+		EGLint major = 0;
+		EGLint minor = 0;
+		if (Display == EGL_NO_DISPLAY || !eglInitialize(Display, &major, &minor)) {
+			return this->fail("no EGL display could be initialized");
+		}
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			return this->fail("the EGL display doesn't support desktop OpenGL");
+		}
+
+		bool surfaceless = hasExtension(eglQueryString(Display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+		const EGLint configAttributes[] = {
+			EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(Display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+			return this->fail("no EGL config renders desktop OpenGL");
+		}
+
+		const EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+			EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+			EGL_NONE
+		};
+		Context = eglCreateContext(Display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (Context == EGL_NO_CONTEXT) {
+			return this->fail("creating a 3.3 core context failed");
+		}
+
+		// Nothing is ever drawn to the surface, the framebuffer object is the render target
+		if (!surfaceless) {
+			const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+			Surface = eglCreatePbufferSurface(Display, config, surfaceAttributes);
+			if (Surface == EGL_NO_SURFACE) {
+				return this->fail("creating a pbuffer surface failed");
+			}
+		}
+		if (!eglMakeCurrent(Display, Surface, Surface, Context)) {
+			return this->fail("the context could not be made current");
+		}
+		Reason = "EGL " + std::to_string(major) + "." + std::to_string(minor) + (surfaceless ? ", surfaceless" : ", pbuffer");
+		return true;
+#else
+		return this->fail("headless rendering needs EGL, which is only wired up on Linux");
+#endif
+	}
+
+	// Color and depth renderbuffers of the given size. Needs GL loaded.
+	bool createTarget(unsigned int width, unsigned int height) {
+		Width = width;
+		Height = height;
+		glGenFramebuffers(1, &Framebuffer);
+		glGenRenderbuffers(1, &ColorBuffer);
+		glGenRenderbuffers(1, &DepthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, ColorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, DepthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ColorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, DepthBuffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			return this->fail("the offscreen framebuffer is incomplete");
+		}
+		return true;
+	}
+
+	// Where the frame ends up, in place of the window's framebuffer 0
+	unsigned int getFramebuffer() const { return Framebuffer; }
+
+	void release() {
+#ifdef __linux__
+		if (Display == EGL_NO_DISPLAY) {
+			return;
+		}
+		if (Framebuffer != 0) {
+			glDeleteFramebuffers(1, &Framebuffer);
+			glDeleteRenderbuffers(1, &ColorBuffer);
+			glDeleteRenderbuffers(1, &DepthBuffer);
+		}
+		eglMakeCurrent(Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (Surface != EGL_NO_SURFACE) {
+			eglDestroySurface(Display, Surface);
+		}
+		if (Context != EGL_NO_CONTEXT) {
+			eglDestroyContext(Display, Context);
+		}
+		eglTerminate(Display);
+		Display = EGL_NO_DISPLAY;
+		Context = EGL_NO_CONTEXT;
+		Surface = EGL_NO_SURFACE;
+#endif
+		Framebuffer = 0;
+		ColorBuffer = 0;
+		DepthBuffer = 0;
+	}
+
+	// For gladLoadGLLoader() and the program cache, in place of glfwGetProcAddress
+	static void* getProcAddress(const char* name) {
+#ifdef __linux__
+		return (void*)eglGetProcAddress(name);
+#else
+		return nullptr;
+#endif
+	}
+
+	// What went wrong, or which kind of context was created
+	const std::string& getReason() const { return Reason; }
+	unsigned int getWidth() const { return Width; }
+	unsigned int getHeight() const { return Height; }
+
+private:
+#ifdef __linux__
+	EGLDisplay Display;
+	EGLContext Context;
+	EGLSurface Surface;
+#endif
+	unsigned int Framebuffer;
+	unsigned int ColorBuffer;
+	unsigned int DepthBuffer;
+	unsigned int Width;
+	unsigned int Height;
+	std::string Reason;
+
+	bool fail(const std::string& reason) {
+		Reason = reason;
+		return false;
+	}
+
+	// Extension strings are space separated, a plain strstr would also match prefixes of longer names
+	static bool hasExtension(const char* extensions, const char* name) {
+		if (extensions == nullptr) {
+			return false;
+		}
+		size_t length = std::strlen(name);
+		for (const char* found = std::strstr(extensions, name); found != nullptr; found = std::strstr(found + length, name)) {
+			bool starts = found == extensions || found[-1] == ' ';
+			bool ends = found[length] == ' ' || found[length] == '\0';
+			if (starts && ends) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif // !HEADLESS_H
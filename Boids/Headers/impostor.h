@@ -0,0 +1,160 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../Headers/shader.h"
+
+#include <cstddef>
+
+// Views of the cone baked into the atlas, by the angle between its axis and the direction to the camera (0 to 180 degrees).
+// The cone is round, so that angle and a roll in screen space are all a view needs. Must match IMPOSTOR_FRAMES in Shaders/impostor.vs.
+const unsigned int IMPOSTOR_FRAMES = 16;
+const unsigned int IMPOSTOR_RESOLUTION = 64;
+
+// A far boid, laid out as the per-instance attributes 1 and 2 of Shaders/impostor.vs.
+// Axis is the unit direction the apex points in, i.e. the direction of travel.
+struct ImpostorInstance {
+	glm::vec3 Position;
+	glm::vec3 Axis;
+};
+
+// Distant boids drawn as one camera-facing quad each, textured from a small atlas of pre-rendered cone views.
+// bake() renders the atlas once at startup. The vertex shader picks the view from the angle to the camera
+// and turns the quad so the baked axis lines up with the projected one.
+class ImpostorRenderer {
+public:
+	ImpostorRenderer() : VAO(0), InstanceVBO(0), Atlas(0), Radius(1.0f), Count(0), Capacity(0) {}
+
+	ImpostorRenderer(const ImpostorRenderer&) = delete;
+	ImpostorRenderer& operator=(const ImpostorRenderer&) = delete;
+
+	// quadVBO holds the unit quad as position, normal, texture coords (8 floats per vertex), only the position is used.
+	void init(unsigned int quadVBO) {
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &InstanceVBO);
+		glBindVertexArray(VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+
+			glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void*)offsetof(ImpostorInstance, Position));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void*)offsetof(ImpostorInstance, Axis));
+			glVertexAttribDivisor(1, 1);
+			glVertexAttribDivisor(2, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Render every view of the mesh into a GL_TEXTURE_2D_ARRAY, one layer per view.
+	// radius bounds the mesh around its origin, the mesh apex points down its local -Z like the boid cone.
+	// shader is Shaders/impostor_bake.*, drawMesh() issues the mesh draw call. The viewport and framebuffer are restored.
+	template <typename DrawMesh>
+	void bake(Shader& shader, float radius, const glm::vec4& ambient, const glm::vec4& diffuse, DrawMesh drawMesh) {
+		Radius = radius;
+
+		glGenTextures(1, &Atlas);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, Atlas);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, IMPOSTOR_RESOLUTION, IMPOSTOR_RESOLUTION, IMPOSTOR_FRAMES, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		unsigned int framebuffer, depth;
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMPOSTOR_RESOLUTION, IMPOSTOR_RESOLUTION);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+		GLint viewport[4];
+		GLfloat clearColor[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		glViewport(0, 0, IMPOSTOR_RESOLUTION, IMPOSTOR_RESOLUTION);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glDisable(GL_BLEND);
+
+		// Looking down -Z with the axis tilted towards screen up: the apex goes from facing the camera (frame 0) to facing away
+		shader.use();
+		shader.setMat4("viewProjection", glm::ortho(-radius, radius, -radius, radius, -radius, radius));
+		shader.setVec4("ambient", ambient);
+		shader.setVec4("diffuse", diffuse);
+		const float halfTurn = glm::radians(180.0f);
+		for (unsigned int frame = 0; frame < IMPOSTOR_FRAMES; frame++) {
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, Atlas, 0, frame);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			float angle = ((float)frame + 0.5f) / IMPOSTOR_FRAMES * halfTurn;
+			shader.setMat4("model", glm::rotate(glm::mat4(1.0f), halfTurn - angle, glm::vec3(1.0f, 0.0f, 0.0f)));
+			drawMesh();
+		}
+
+		glEnable(GL_BLEND);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &depth);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, Atlas);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	void release() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &InstanceVBO);
+		glDeleteTextures(1, &Atlas);
+		VAO = 0;
+		InstanceVBO = 0;
+		Atlas = 0;
+		Count = 0;
+		Capacity = 0;
+	}
+
+	// Refilled every frame, re-specified only when the set grows.
+	void upload(const ImpostorInstance* instances, unsigned int count) {
+		glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO);
+		if (count > Capacity) {
+			glBufferData(GL_ARRAY_BUFFER, count * sizeof(ImpostorInstance), instances, GL_STREAM_DRAW);
+			Capacity = count;
+		} else if (count > 0) {
+			glBufferData(GL_ARRAY_BUFFER, Capacity * sizeof(ImpostorInstance), nullptr, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(ImpostorInstance), instances);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		Count = count;
+	}
+
+	// The impostor shader is bound by the caller, with the atlas on its texture unit.
+	void draw() const {
+		if (Count == 0) {
+			return;
+		}
+		glBindVertexArray(VAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, Count);
+		glBindVertexArray(0);
+	}
+
+	unsigned int getAtlas() const { return Atlas; }
+	float getRadius() const { return Radius; }
+	unsigned int getCount() const { return Count; }
+	unsigned int getVAO() const { return VAO; }
+
+private:
+	unsigned int VAO;
+	unsigned int InstanceVBO;
+	unsigned int Atlas;
+	float Radius;
+	unsigned int Count;
+	unsigned int Capacity;
+};
+
+#endif // !IMPOSTOR_H
@@ -18,7 +18,11 @@ namespace logging {
 	std::string getTimestamp(void) {
 		time_t timer = std::time(0);
 		std::tm bt{};
+#ifdef _WIN32
 		localtime_s(&bt, &timer);
+#else
+		localtime_r(&timer, &bt);
+#endif
 
 		char buffer[64];
 		return { buffer, std::strftime(buffer, sizeof(buffer), "%F %T ", &bt) };
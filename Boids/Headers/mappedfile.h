@@ -0,0 +1,53 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+// Read-only memory mapping of a whole file (Sources/mapped_file.cpp).
+// The platform calls live in the .cpp so windows.h stays out of the headers.
+class MappedFile {
+public:
+	MappedFile() : Data(nullptr), Size(0), FileHandle(nullptr), MappingHandle(nullptr) {}
+	~MappedFile() { this->close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) : Data(nullptr), Size(0), FileHandle(nullptr), MappingHandle(nullptr) {
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other) {
+		if (this != &other) {
+			this->close();
+			Data = other.Data;
+			Size = other.Size;
+			FileHandle = other.FileHandle;
+			MappingHandle = other.MappingHandle;
+			other.Data = nullptr;
+			other.Size = 0;
+			other.FileHandle = nullptr;
+			other.MappingHandle = nullptr;
+		}
+		return *this;
+	}
+
+	// Returns false when the file is missing or empty.
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return Data != nullptr; }
+	const unsigned char* getData() const { return Data; }
+	size_t getSize() const { return Size; }
+
+private:
+	const unsigned char* Data;
+	size_t Size;
+	// HANDLEs on Windows, the descriptor (stored as intptr_t) on POSIX
+	void* FileHandle;
+	void* MappingHandle;
+};
+
+#endif // !MAPPEDFILE_H
@@ -0,0 +1,256 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+// Hardware counters around the simulation phases, read through perf_event_open on Linux.
+// A counter group only follows the thread that opened it, so every pool thread gets a group of its own: thread 0 (the
+// main thread) opens its group on construction, the workers open theirs the first time they read one. Phases split
+// across the pool sample each chunk on the thread that runs it and add the threads up (ThreadPerfSamples).
+// When the counters can't be opened (other platforms, perf_event_paranoid, containers without PMU access)
+// everything reports as unavailable instead of failing.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum Perf_Counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTER_COUNT
+};
+
+const char* const PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] = {
+	"cycles",
+	"instructions",
+	"l1d_misses",
+	"llc_misses",
+	"branch_misses",
+};
+
+struct PerfSample {
+	uint64_t Values[PERF_COUNTER_COUNT];
+	bool Valid;
+};
+
+class PerfCounters {
+public:
+	bool Enable;
+
+	PerfCounters() : Enable(false), Available(false), Sampling(true) {
+		Groups.resize(1);
+		this->open(Groups[0], true);
+		Enable = Available;
+	}
+
+	~PerfCounters() {
+#ifdef __linux__
+		for (const Group& group : Groups) {
+			for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+				if (group.Fds[i] >= 0) {
+					close(group.Fds[i]);
+				}
+			}
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// One group per pool thread, call it once before the pool runs anything that reads the counters
+	void setThreadCount(unsigned int count) {
+		Groups.resize(std::max(1u, count));
+	}
+
+	bool isAvailable() const { return Available; }
+	bool isCounterAvailable(int counter) const { return Groups[0].Slots[counter] >= 0; }
+	const std::string& getReason() const { return Reason; }
+
+	// Frames that aren't sampled skip the reads, the last sample stays on show
+	void setSampling(bool sampling) { Sampling = sampling; }
+	bool isSampling() const { return Available && Enable && Sampling; }
+
+	// Snapshot of the running totals of the calling pool thread; unavailable counters read as zero.
+	// Only ever call it from the thread the index belongs to, the first read opens the group there.
+	bool read(unsigned int thread, PerfSample& sample) {
+		std::memset(&sample, 0, sizeof(sample));
+#ifdef __linux__
+		if (!this->isSampling() || thread >= Groups.size()) {
+			return false;
+		}
+		Group& group = Groups[thread];
+		if (!group.Opened) {
+			this->open(group, false);
+		}
+		if (group.Fds[PERF_CYCLES] < 0) {
+			return false;
+		}
+		struct {
+			uint64_t Count;
+			uint64_t Values[PERF_COUNTER_COUNT];
+		} values;
+		if (::read(group.Fds[PERF_CYCLES], &values, sizeof(values)) <= 0) {
+			return false;
+		}
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			if (group.Slots[i] >= 0 && (uint64_t)group.Slots[i] < values.Count) {
+				sample.Values[i] = values.Values[group.Slots[i]];
+			}
+		}
+		sample.Valid = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+private:
+	// Counters of one thread, read together
+	struct Group {
+		int Fds[PERF_COUNTER_COUNT];
+		// Position of each counter inside the group read, -1 if it couldn't be opened.
+		int Slots[PERF_COUNTER_COUNT];
+		bool Opened;
+
+		Group() : Opened(false) {
+			for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+				Fds[i] = -1;
+				Slots[i] = -1;
+			}
+		}
+	};
+
+	bool Available;
+	bool Sampling;
+	std::string Reason;
+	std::vector<Group> Groups;
+
+	// Open the counters for the calling thread. The first group decides whether the counters are available at all.
+	void open(Group& group, bool first) {
+		group.Opened = true;
+#ifdef __linux__
+		const uint32_t types[PERF_COUNTER_COUNT] = {
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HARDWARE,
+		};
+		const uint64_t configs[PERF_COUNTER_COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES,
+		};
+
+		// Cycles leads the group, so all counters are scheduled onto the PMU together.
+		int openCount = 0;
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[i];
+			attr.config = configs[i];
+			attr.disabled = (i == PERF_CYCLES) ? 1 : 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+
+			int groupFd = (i == PERF_CYCLES) ? -1 : group.Fds[PERF_CYCLES];
+			group.Fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+			if (group.Fds[i] < 0) {
+				if (i == PERF_CYCLES) {
+					if (first) {
+						int error = errno;
+						Reason = std::string("perf_event_open failed: ") + std::strerror(error);
+						if (error == EACCES || error == EPERM) {
+							Reason += " (check /proc/sys/kernel/perf_event_paranoid)";
+						} else if (error == ENOENT || error == EOPNOTSUPP) {
+							Reason += " (no hardware PMU exposed, e.g. inside a VM)";
+						}
+					}
+					return;
+				}
+				continue;
+			}
+			group.Slots[i] = openCount++;
+		}
+
+		ioctl(group.Fds[PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(group.Fds[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		if (first) {
+			Available = true;
+		}
+#else
+		Reason = "perf_event_open is only available on Linux";
+#endif
+	}
+};
+
+// Adds the counter delta of a scope to a sample, counted on the given pool thread (the calling one).
+class ScopedPerfCounters {
+public:
+	ScopedPerfCounters(PerfCounters& counters, PerfSample& target, unsigned int thread = 0) : Counters(counters), Target(target), Thread(thread) {
+		Counters.read(Thread, Begin);
+	}
+
+	~ScopedPerfCounters() {
+		PerfSample end;
+		if (!Begin.Valid || !Counters.read(Thread, end)) {
+			return;
+		}
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			Target.Values[i] += end.Values[i] - Begin.Values[i];
+		}
+		Target.Valid = true;
+	}
+
+private:
+	PerfCounters& Counters;
+	PerfSample& Target;
+	unsigned int Thread;
+	PerfSample Begin;
+};
+
+// Counters of a phase split across the pool. Each thread adds the chunks it ran to its own sample,
+// addTo() sums the threads into the phase once the parallelFor returned.
+class ThreadPerfSamples {
+public:
+	// Clear a sample per thread, the vector only grows the first time
+	void reset(unsigned int threadCount) {
+		Samples.resize(threadCount);
+		std::memset(Samples.data(), 0, Samples.size() * sizeof(PerfSample));
+	}
+
+	PerfSample& get(unsigned int thread) { return Samples[thread]; }
+
+	void addTo(PerfSample& target) const {
+		for (const PerfSample& sample : Samples) {
+			if (!sample.Valid) {
+				continue;
+			}
+			for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+				target.Values[i] += sample.Values[i];
+			}
+			target.Valid = true;
+		}
+	}
+
+private:
+	std::vector<PerfSample> Samples;
+};
+
+#endif // !PERFCOUNTERS_H
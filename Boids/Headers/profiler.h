@@ -0,0 +1,287 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Lightweight scoped timing zones.
+// Every zone is written into a ring buffer owned by the calling thread, so recording never takes a lock.
+// The buffers can be dumped as Chrome trace JSON (chrome://tracing or ui.perfetto.dev), and the zones of
+// the thread that calls PROFILE_FRAME() are also summed into a per-phase breakdown of the previous frame,
+// together with the heap allocations made inside them (see alloctracker.h).
+// Define BOIDS_NO_PROFILE (ReleaseNoProfile configuration) to compile all of it out.
+
+#ifndef BOIDS_NO_PROFILE
+
+#include "../Headers/logging.h"
+#include "../Headers/alloctracker.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace profiler {
+	// Events kept per thread before the oldest ones are overwritten.
+	const unsigned int RING_CAPACITY = 1 << 16;
+	// Distinct zones tracked in the per-frame breakdown.
+	const unsigned int MAX_PHASES = 32;
+
+	struct Event {
+		const char* Name;
+		uint64_t Start;
+		uint64_t Duration;
+		uint32_t Depth;
+	};
+
+	struct Phase {
+		const char* Name;
+		uint32_t Depth;
+		uint32_t Calls;
+		double Milliseconds;
+		uint64_t Allocations;
+		uint64_t Bytes;
+	};
+
+	class ThreadBuffer {
+	public:
+		uint32_t ThreadId;
+		std::string ThreadName;
+		uint32_t Depth;
+		bool IsFrameThread;
+
+		ThreadBuffer(uint32_t threadId) : ThreadId(threadId), ThreadName("Thread " + std::to_string(threadId)), Depth(0), IsFrameThread(false), Head(0) {
+			Events.resize(RING_CAPACITY);
+		}
+
+		void push(const Event& event) {
+			uint64_t head = Head.load(std::memory_order_relaxed);
+			Events[head % RING_CAPACITY] = event;
+			Head.store(head + 1, std::memory_order_release);
+		}
+
+		// Copy out the events that are still in the ring, oldest first.
+		void snapshot(std::vector<Event>& out) const {
+			uint64_t head = Head.load(std::memory_order_acquire);
+			uint64_t first = (head > RING_CAPACITY) ? head - RING_CAPACITY : 0;
+			for (uint64_t i = first; i < head; i++) {
+				out.push_back(Events[i % RING_CAPACITY]);
+			}
+		}
+
+	private:
+		std::vector<Event> Events;
+		std::atomic<uint64_t> Head;
+	};
+
+	class Profiler {
+	public:
+		Profiler() : Epoch(std::chrono::steady_clock::now()), FrameStart(0), LastFrameMilliseconds(0.0), CurrentCount(0), LastCount(0) {
+			FrameAllocStart = alloctracker::getGlobalCounts();
+			LastFrameAllocs = { 0, 0, 0 };
+		}
+
+		// Nanoseconds since the profiler was created.
+		uint64_t now() const {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Epoch).count();
+		}
+
+		ThreadBuffer* threadBuffer() {
+			static thread_local ThreadBuffer* buffer = nullptr;
+			if (buffer == nullptr) {
+				std::lock_guard<std::mutex> lock(Mutex);
+				Buffers.emplace_back(new ThreadBuffer((uint32_t)Buffers.size()));
+				buffer = Buffers.back().get();
+			}
+			return buffer;
+		}
+
+		void setThreadName(const std::string& name) {
+			threadBuffer()->ThreadName = name;
+		}
+
+		// Close the breakdown of the frame that just finished and start a new one.
+		// The calling thread becomes the one whose zones feed the breakdown.
+		void beginFrame() {
+			threadBuffer()->IsFrameThread = true;
+
+			uint64_t time = now();
+			if (FrameStart != 0) {
+				LastFrameMilliseconds = (time - FrameStart) * 1e-6;
+			}
+			FrameStart = time;
+
+			alloctracker::Counts allocs = alloctracker::getGlobalCounts();
+			LastFrameAllocs.Allocations = allocs.Allocations - FrameAllocStart.Allocations;
+			LastFrameAllocs.Frees = allocs.Frees - FrameAllocStart.Frees;
+			LastFrameAllocs.Bytes = allocs.Bytes - FrameAllocStart.Bytes;
+			FrameAllocStart = allocs;
+
+			std::memcpy(LastPhases, CurrentPhases, sizeof(Phase) * CurrentCount);
+			LastCount = CurrentCount;
+			CurrentCount = 0;
+		}
+
+		// Phases are stored in the order they were first entered, so the table reads as a call tree.
+		int beginPhase(const char* name, uint32_t depth) {
+			for (unsigned int i = 0; i < CurrentCount; i++) {
+				if (CurrentPhases[i].Name == name && CurrentPhases[i].Depth == depth) {
+					return (int)i;
+				}
+			}
+			if (CurrentCount == MAX_PHASES) {
+				return -1;
+			}
+			CurrentPhases[CurrentCount] = { name, depth, 0, 0.0, 0, 0 };
+			return (int)CurrentCount++;
+		}
+
+		void endPhase(int slot, uint64_t duration, uint64_t allocations, uint64_t bytes) {
+			if (slot >= 0 && (unsigned int)slot < CurrentCount) {
+				CurrentPhases[slot].Calls++;
+				CurrentPhases[slot].Milliseconds += duration * 1e-6;
+				CurrentPhases[slot].Allocations += allocations;
+				CurrentPhases[slot].Bytes += bytes;
+			}
+		}
+
+		// Phases of the previous frame.
+		const Phase* getPhases() const { return LastPhases; }
+		unsigned int getPhaseCount() const { return LastCount; }
+		double getFrameMilliseconds() const { return LastFrameMilliseconds; }
+		// Allocations of the previous frame on all threads, including those outside any zone.
+		const alloctracker::Counts& getFrameAllocations() const { return LastFrameAllocs; }
+
+		double getPhaseMilliseconds(const char* name) const {
+			for (unsigned int i = 0; i < LastCount; i++) {
+				if (std::strcmp(LastPhases[i].Name, name) == 0) {
+					return LastPhases[i].Milliseconds;
+				}
+			}
+			return 0.0;
+		}
+
+		// Write every buffered event as Chrome trace JSON. Call between frames so workers are idle.
+		bool writeChromeTrace(const std::string& path) {
+			std::ofstream file(path);
+			if (!file.is_open()) {
+				logging::loggingMessage(logging::LogType::ERROR, "Failed to open trace file: " + path);
+				return false;
+			}
+
+			std::lock_guard<std::mutex> lock(Mutex);
+			std::vector<Event> events;
+			size_t eventCount = 0;
+			bool first = true;
+
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			for (const auto& buffer : Buffers) {
+				writeSeparator(file, first);
+				file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->ThreadId
+					<< ",\"args\":{\"name\":\"" << escape(buffer->ThreadName) << "\"}}";
+
+				events.clear();
+				buffer->snapshot(events);
+				for (const Event& event : events) {
+					writeSeparator(file, first);
+					file << "{\"name\":\"" << escape(event.Name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->ThreadId
+						<< ",\"ts\":" << event.Start / 1000 << "." << (event.Start % 1000) / 100
+						<< ",\"dur\":" << event.Duration / 1000 << "." << (event.Duration % 1000) / 100 << "}";
+				}
+				eventCount += events.size();
+			}
+			file << "\n]}\n";
+
+			logging::loggingMessage(logging::LogType::INFO, "Wrote " + std::to_string(eventCount) + " trace events to " + path);
+			return true;
+		}
+
+	private:
+		std::chrono::steady_clock::time_point Epoch;
+		std::mutex Mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+
+		uint64_t FrameStart;
+		double LastFrameMilliseconds;
+		Phase CurrentPhases[MAX_PHASES];
+		Phase LastPhases[MAX_PHASES];
+		unsigned int CurrentCount;
+		unsigned int LastCount;
+		alloctracker::Counts FrameAllocStart;
+		alloctracker::Counts LastFrameAllocs;
+
+		static void writeSeparator(std::ofstream& file, bool& first) {
+			if (!first) {
+				file << ",\n";
+			}
+			first = false;
+		}
+
+		static std::string escape(const std::string& text) {
+			std::string result;
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					result += '\\';
+				}
+				result += c;
+			}
+			return result;
+		}
+	};
+
+	inline Profiler& instance() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	class ScopedZone {
+	public:
+		explicit ScopedZone(const char* name) : Name(name) {
+			Buffer = instance().threadBuffer();
+			Depth = Buffer->Depth++;
+			Slot = Buffer->IsFrameThread ? instance().beginPhase(Name, Depth) : -1;
+			if (Slot >= 0) {
+				Allocs = alloctracker::getThreadCounts();
+			}
+			Start = instance().now();
+		}
+
+		~ScopedZone() {
+			uint64_t duration = instance().now() - Start;
+			Buffer->Depth--;
+			Buffer->push({ Name, Start, duration, Depth });
+			if (Slot >= 0) {
+				alloctracker::Counts allocs = alloctracker::getThreadCounts();
+				instance().endPhase(Slot, duration, allocs.Allocations - Allocs.Allocations, allocs.Bytes - Allocs.Bytes);
+			}
+		}
+
+	private:
+		const char* Name;
+		ThreadBuffer* Buffer;
+		uint32_t Depth;
+		int Slot;
+		uint64_t Start;
+		alloctracker::Counts Allocs;
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Zone names must be string literals (or otherwise outlive the trace dump).
+#define PROFILE_SCOPE(name) profiler::ScopedZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FRAME() profiler::instance().beginFrame()
+#define PROFILE_THREAD(name) profiler::instance().setThreadName(name)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+
+#endif // !BOIDS_NO_PROFILE
+
+#endif // !PROFILER_H
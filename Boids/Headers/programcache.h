@@ -0,0 +1,185 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <glad/glad.h>
+
+#include "../Headers/logging.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Not part of the 3.3 core profile glad is generated for (GL 4.1 or ARB_get_program_binary)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+const char* const PROGRAM_CACHE_DIRECTORY = "ShaderCache";
+
+// Linked programs saved with glGetProgramBinary, so later runs skip compiling and linking.
+// Entries are keyed by a hash of the final source text and the driver strings, a new driver or an edited
+// shader simply misses. A binary the driver rejects anyway is recompiled from source and overwritten.
+class ProgramCache {
+public:
+	static ProgramCache& instance() {
+		static ProgramCache cache;
+		return cache;
+	}
+
+	// Needs a current context. Without program binary support every program is compiled from source.
+	void init(GLADloadproc load) {
+		GetProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+		ProgramBinary = (ProgramBinaryProc)load("glProgramBinary");
+		ProgramParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+
+		GLint formats = 0;
+		if (GetProgramBinary != nullptr && ProgramBinary != nullptr && ProgramParameteri != nullptr) {
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		Available = formats > 0;
+		if (!Available) {
+			logging::loggingMessage(logging::LogType::WARNING, "Program binaries are not supported by the driver, shaders are compiled on every start.");
+			return;
+		}
+
+		const char* strings[] = {
+			(const char*)glGetString(GL_VENDOR),
+			(const char*)glGetString(GL_RENDERER),
+			(const char*)glGetString(GL_VERSION),
+		};
+		for (const char* text : strings) {
+			DriverString += text != nullptr ? text : "";
+			DriverString += '\n';
+		}
+
+#ifdef _WIN32
+		_mkdir(PROGRAM_CACHE_DIRECTORY);
+#else
+		mkdir(PROGRAM_CACHE_DIRECTORY, 0755);
+#endif
+	}
+
+	bool isAvailable() const { return Available; }
+	unsigned int getHits() const { return Hits; }
+	unsigned int getMisses() const { return Misses; }
+
+	// FNV-1a over every stage and the driver strings. Stages are separated so moving text between them changes the key.
+	uint64_t makeKey(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode) const {
+		uint64_t hash = 14695981039346656037ull;
+		const std::string* parts[] = { &vertexCode, &fragmentCode, &geometryCode, &DriverString };
+		for (const std::string* part : parts) {
+			for (unsigned char c : *part) {
+				hash = (hash ^ c) * 1099511628211ull;
+			}
+			hash = (hash ^ 0xff) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// Must be called before glLinkProgram, some drivers only keep the binary around when asked to.
+	void prepare(GLuint program) const {
+		if (Available) {
+			ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	// Returns true when program was linked from the cached binary.
+	bool load(GLuint program, uint64_t key) {
+		if (!Available) {
+			return false;
+		}
+
+		std::ifstream file(this->makePath(key), std::ios::binary);
+		FileHeader header;
+		if (!file || !file.read((char*)&header, sizeof(header)) || header.Magic != CACHE_MAGIC || header.Length <= 0) {
+			Misses++;
+			return false;
+		}
+		std::vector<char> binary(header.Length);
+		if (!file.read(binary.data(), header.Length)) {
+			Misses++;
+			return false;
+		}
+
+		ProgramBinary(program, header.Format, binary.data(), header.Length);
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			Misses++;
+			return false;
+		}
+		Hits++;
+		return true;
+	}
+
+	void store(GLuint program, uint64_t key) const {
+		if (!Available) {
+			return;
+		}
+
+		GLint success = 0;
+		GLint length = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (!success || length <= 0) {
+			return;
+		}
+
+		FileHeader header;
+		header.Magic = CACHE_MAGIC;
+		std::vector<char> binary(length);
+		GetProgramBinary(program, length, &header.Length, &header.Format, binary.data());
+
+		std::ofstream file(this->makePath(key), std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write(binary.data(), header.Length);
+		if (!file) {
+			logging::loggingMessage(logging::LogType::WARNING, "Failed to write " + this->makePath(key));
+		}
+	}
+
+private:
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	static const uint32_t CACHE_MAGIC = 0x31505242; // "BRP1"
+
+	struct FileHeader {
+		uint32_t Magic;
+		GLenum Format;
+		GLsizei Length;
+	};
+
+	GetProgramBinaryProc GetProgramBinary = nullptr;
+	ProgramBinaryProc ProgramBinary = nullptr;
+	ProgramParameteriProc ProgramParameteri = nullptr;
+	bool Available = false;
+	std::string DriverString;
+	unsigned int Hits = 0;
+	unsigned int Misses = 0;
+
+	ProgramCache() {}
+
+	std::string makePath(uint64_t key) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return std::string(PROGRAM_CACHE_DIRECTORY) + "/" + name;
+	}
+};
+
+#endif // !PROGRAMCACHE_H
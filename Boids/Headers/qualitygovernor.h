@@ -0,0 +1,162 @@
+#ifndef QUALITYGOVERNOR_H
+#define QUALITYGOVERNOR_H
+
+#include "../Headers/logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// Frame budget the governor holds, 60 Hz
+const float GOVERNOR_BUDGET_MS = 1000.0f / 60.0f;
+// Frames per evaluation; after a change the next verdict only sees frames drawn with the new settings
+const unsigned int GOVERNOR_WINDOW = 60;
+// Percentile of the window held to the budget
+const float GOVERNOR_PERCENTILE = 0.9f;
+// A step is only given back when the percentile is this far under budget for GOVERNOR_RAISE_WINDOWS windows in a row,
+// so a setting that just fits isn't toggled every second
+const float GOVERNOR_RAISE_BELOW = 0.7f;
+const unsigned int GOVERNOR_RAISE_WINDOWS = 3;
+// Changes kept for the UI
+const unsigned int GOVERNOR_HISTORY = 8;
+
+// Settings the governor turns down, each with levels from 0 (full quality) up. What a level means is up to the caller.
+enum Quality_Knob {
+	QUALITY_METRICS,	// How often frame statistics and hardware counters are sampled
+	QUALITY_LOD,		// Screen size the mesh LOD thresholds are scaled by
+	QUALITY_IMPOSTORS,	// How close impostors start
+	QUALITY_NEIGHBORS,	// Neighbors a boid steers by
+	QUALITY_SIM_RATE,	// Frames between flocking force updates
+	QUALITY_KNOB_COUNT
+};
+
+const char* const QUALITY_KNOB_NAMES[QUALITY_KNOB_COUNT] = {
+	"Metrics",
+	"Mesh LOD",
+	"Impostors",
+	"Neighbors",
+	"Sim rate",
+};
+
+struct QualityStep {
+	Quality_Knob Knob;
+	unsigned int Level;
+};
+
+// Walked down from the top under load and back up when there is room again: the least visible savings come first,
+// the ones that change how the flock moves come last.
+const QualityStep QUALITY_LADDER[] = {
+	{ QUALITY_METRICS, 1 },
+	{ QUALITY_LOD, 1 },
+	{ QUALITY_IMPOSTORS, 1 },
+	{ QUALITY_METRICS, 2 },
+	{ QUALITY_NEIGHBORS, 1 },
+	{ QUALITY_LOD, 2 },
+	{ QUALITY_IMPOSTORS, 2 },
+	{ QUALITY_NEIGHBORS, 2 },
+	{ QUALITY_SIM_RATE, 1 },
+	{ QUALITY_NEIGHBORS, 3 },
+	{ QUALITY_SIM_RATE, 2 },
+};
+const unsigned int QUALITY_STEPS = sizeof(QUALITY_LADDER) / sizeof(QUALITY_LADDER[0]);
+
+// Watches a rolling percentile of the frame time and walks QUALITY_LADDER one step per window to keep it inside
+// the budget. It only moves the step; the caller reads the knob levels back with getLevel() when addFrame() says
+// the step changed. Every change is logged with the timing that caused it.
+class QualityGovernor {
+public:
+	bool Enable;
+	float BudgetMilliseconds;
+
+	QualityGovernor() : Enable(true), BudgetMilliseconds(GOVERNOR_BUDGET_MS), Step(0), Count(0), CalmWindows(0), Percentile(0.0f), Changes(0) {}
+
+	// Returns true when the step changed.
+	bool addFrame(float milliseconds) {
+		Window[Count++] = milliseconds;
+		if (Count < GOVERNOR_WINDOW) {
+			return false;
+		}
+		Count = 0;
+		std::sort(Window, Window + GOVERNOR_WINDOW);
+		Percentile = Window[(unsigned int)(GOVERNOR_PERCENTILE * (GOVERNOR_WINDOW - 1) + 0.5f)];
+		if (!Enable) {
+			return false;
+		}
+
+		if (Percentile > BudgetMilliseconds) {
+			CalmWindows = 0;
+			return Step < QUALITY_STEPS && this->moveTo(Step + 1, this->describe("over"));
+		}
+		if (Percentile < BudgetMilliseconds * GOVERNOR_RAISE_BELOW && Step > 0) {
+			if (++CalmWindows >= GOVERNOR_RAISE_WINDOWS) {
+				CalmWindows = 0;
+				return this->moveTo(Step - 1, this->describe("under"));
+			}
+			return false;
+		}
+		CalmWindows = 0;
+		return false;
+	}
+
+	// Set the step by hand, logged like the governor's own changes. Returns true when it changed.
+	bool setStep(unsigned int step) {
+		return this->moveTo(std::min(step, QUALITY_STEPS), "set by hand");
+	}
+
+	// The deepest level the steps taken so far put this knob at
+	unsigned int getLevel(Quality_Knob knob) const {
+		unsigned int level = 0;
+		for (unsigned int i = 0; i < Step; i++) {
+			if (QUALITY_LADDER[i].Knob == knob) {
+				level = std::max(level, QUALITY_LADDER[i].Level);
+			}
+		}
+		return level;
+	}
+
+	unsigned int getStep() const { return Step; }
+	float getPercentile() const { return Percentile; }
+	unsigned int getChanges() const { return Changes; }
+
+	// The last GOVERNOR_HISTORY changes, oldest first
+	unsigned int getHistoryCount() const { return std::min(Changes, GOVERNOR_HISTORY); }
+	const std::string& getHistory(unsigned int index) const {
+		unsigned int first = Changes > GOVERNOR_HISTORY ? Changes % GOVERNOR_HISTORY : 0;
+		return History[(first + index) % GOVERNOR_HISTORY];
+	}
+
+private:
+	unsigned int Step;
+	float Window[GOVERNOR_WINDOW];
+	unsigned int Count;
+	unsigned int CalmWindows;
+	float Percentile;
+	unsigned int Changes;
+	std::string History[GOVERNOR_HISTORY];
+
+	// The reason goes into the log next to the knob levels the new step ends up with.
+	bool moveTo(unsigned int step, const std::string& reason) {
+		if (step == Step) {
+			return false;
+		}
+		std::string message = std::string("Quality ") + (step > Step ? "down" : "up") + " to step " + std::to_string(step) + " of " + std::to_string(QUALITY_STEPS) + " (" + reason + "):";
+		Step = step;
+		Count = 0;
+		CalmWindows = 0;
+		for (unsigned int knob = 0; knob < QUALITY_KNOB_COUNT; knob++) {
+			message += std::string(knob == 0 ? " " : ", ") + QUALITY_KNOB_NAMES[knob] + " " + std::to_string(this->getLevel((Quality_Knob)knob));
+		}
+		History[Changes % GOVERNOR_HISTORY] = message;
+		Changes++;
+		logging::loggingMessage(logging::LogType::INFO, message);
+		return true;
+	}
+
+	std::string describe(const char* verdict) const {
+		char text[96];
+		std::snprintf(text, sizeof(text), "p%.0f %.2f ms, %s the %.2f ms budget", GOVERNOR_PERCENTILE * 100.0f, Percentile, verdict, BudgetMilliseconds);
+		return text;
+	}
+};
+
+#endif // !QUALITYGOVERNOR_H
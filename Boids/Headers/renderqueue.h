@@ -0,0 +1,382 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "../Headers/shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Texture units a command can bind: diffuse, specular and emission of the lighting shader, and the sky
+const unsigned int RENDER_TEXTURE_UNITS = 4;
+const unsigned int RENDER_MAX_UNIFORMS = 16;
+
+// Passes run in this order. The sky only fills what the opaque pass left at the far plane,
+// blended geometry goes over both and is drawn back to front.
+enum Render_Pass {
+	RENDER_PASS_OPAQUE,
+	RENDER_PASS_SKY,
+	RENDER_PASS_BLENDED
+};
+
+// The GL binds the queue goes through, each issued only when it differs from what is already bound.
+// Anything drawn outside the queue (ImGui, asset uploads) may change the same state, so it starts every frame unknown.
+class GLStateCache {
+public:
+	GLStateCache() { this->invalidate(); this->resetStats(); }
+
+	void invalidate() {
+		Program = UNKNOWN;
+		VertexArray = UNKNOWN;
+		DepthFunc = UNKNOWN;
+		ActiveUnit = UNKNOWN;
+		for (unsigned int unit = 0; unit < RENDER_TEXTURE_UNITS; unit++) {
+			for (unsigned int slot = 0; slot < TARGET_COUNT; slot++) {
+				Textures[unit][slot] = UNKNOWN;
+			}
+		}
+	}
+
+	void resetStats() {
+		Changes = 0;
+		Skipped = 0;
+	}
+
+	void useProgram(unsigned int program) {
+		if (this->differs(Program, program)) {
+			glUseProgram(program);
+		}
+	}
+
+	void bindVertexArray(unsigned int vertexArray) {
+		if (this->differs(VertexArray, vertexArray)) {
+			glBindVertexArray(vertexArray);
+		}
+	}
+
+	void depthFunc(GLenum func) {
+		if (this->differs(DepthFunc, func)) {
+			glDepthFunc(func);
+		}
+	}
+
+	void bindTexture(unsigned int unit, GLenum target, unsigned int texture) {
+		if (!this->differs(Textures[unit][targetSlot(target)], texture)) {
+			return;
+		}
+		if (ActiveUnit != unit) {
+			ActiveUnit = unit;
+			glActiveTexture(GL_TEXTURE0 + unit);
+		}
+		glBindTexture(target, texture);
+	}
+
+	// Binds issued and binds skipped since resetStats()
+	unsigned int getChanges() const { return Changes; }
+	unsigned int getSkipped() const { return Skipped; }
+
+private:
+	static const unsigned int UNKNOWN = 0xFFFFFFFFu;
+	static const unsigned int TARGET_COUNT = 3;
+
+	unsigned int Program;
+	unsigned int VertexArray;
+	unsigned int DepthFunc;
+	unsigned int ActiveUnit;
+	unsigned int Textures[RENDER_TEXTURE_UNITS][TARGET_COUNT];
+	unsigned int Changes;
+	unsigned int Skipped;
+
+	bool differs(unsigned int& current, unsigned int value) {
+		if (current == value) {
+			Skipped++;
+			return false;
+		}
+		current = value;
+		Changes++;
+		return true;
+	}
+
+	static unsigned int targetSlot(GLenum target) {
+		switch (target) {
+		case GL_TEXTURE_2D_ARRAY:
+			return 1;
+		case GL_TEXTURE_CUBE_MAP:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+};
+
+struct RenderUniform {
+	int Index;
+	GLenum Type;
+	float Value[16];
+};
+
+// One draw with everything it needs bound. Uniforms are set through the program's resolved handles and its own
+// value cache, setting one twice keeps the last value. Prepare runs with the VAO bound, for what the fields can't express.
+struct RenderCommand {
+	Render_Pass Pass;
+	// View distance, orders the opaque pass front to back and the blended pass back to front
+	float Depth;
+	Shader* Program;
+	unsigned int VAO;
+	GLenum TextureTargets[RENDER_TEXTURE_UNITS];
+	unsigned int Textures[RENDER_TEXTURE_UNITS];
+	GLenum DepthFunc;
+
+	GLenum Primitive;
+	bool Indexed;
+	unsigned int Count;
+	// First vertex, or the byte offset into the element buffer when indexed
+	unsigned int First;
+	// 0 for a plain draw
+	unsigned int Instances;
+	void (*Prepare)(const RenderCommand& command);
+	unsigned int PrepareArg;
+
+	RenderUniform Uniforms[RENDER_MAX_UNIFORMS];
+	unsigned int UniformCount;
+
+	RenderCommand(Render_Pass pass, Shader& program, float depth)
+		: Pass(pass), Depth(depth), Program(&program), VAO(0), DepthFunc(GL_LESS), Primitive(GL_TRIANGLES), Indexed(false),
+		Count(0), First(0), Instances(0), Prepare(nullptr), PrepareArg(0), UniformCount(0) {
+		for (unsigned int unit = 0; unit < RENDER_TEXTURE_UNITS; unit++) {
+			TextureTargets[unit] = GL_TEXTURE_2D;
+			Textures[unit] = 0;
+		}
+	}
+
+	void setTexture(unsigned int unit, GLenum target, unsigned int texture) {
+		TextureTargets[unit] = target;
+		Textures[unit] = texture;
+	}
+
+	void drawArrays(unsigned int vao, unsigned int first, unsigned int count, unsigned int instances = 0) {
+		VAO = vao;
+		Indexed = false;
+		First = first;
+		Count = count;
+		Instances = instances;
+	}
+
+	void drawElements(unsigned int vao, unsigned int offset, unsigned int count, unsigned int instances = 0) {
+		VAO = vao;
+		Indexed = true;
+		First = offset;
+		Count = count;
+		Instances = instances;
+	}
+
+	// Handles the program doesn't have are dropped, as Shader::set() would ignore them
+	void set(UniformHandle<int> handle, int value) { this->setUniform(handle.Index, GL_INT, &value, sizeof(value)); }
+	void set(UniformHandle<float> handle, float value) { this->setUniform(handle.Index, GL_FLOAT, &value, sizeof(value)); }
+	void set(UniformHandle<glm::vec4> handle, const glm::vec4& value) { this->setUniform(handle.Index, GL_FLOAT_VEC4, &value, sizeof(value)); }
+	void set(UniformHandle<glm::mat4> handle, const glm::mat4& value) { this->setUniform(handle.Index, GL_FLOAT_MAT4, &value, sizeof(value)); }
+
+private:
+	void setUniform(int index, GLenum type, const void* value, size_t size) {
+		if (index < 0) {
+			return;
+		}
+		unsigned int slot = 0;
+		while (slot < UniformCount && Uniforms[slot].Index != index) {
+			slot++;
+		}
+		if (slot == UniformCount) {
+			if (UniformCount == RENDER_MAX_UNIFORMS) {
+				return;
+			}
+			UniformCount++;
+		}
+		Uniforms[slot].Index = index;
+		Uniforms[slot].Type = type;
+		std::memcpy(Uniforms[slot].Value, value, size);
+	}
+};
+
+// Draws of one frame, sorted by a 64-bit key before they are issued so commands sharing a program, material,
+// textures and VAO run back to back. Opaque and sky keys are, from the top bit down:
+//   pass (2) | program (10) | material (8) | textures (12) | VAO (8) | depth (24)
+// Blended keys move the inverted depth right after the pass, so it decides the order before anything else.
+// Commands are recorded into one list per thread, so pool workers can record side by side without locking;
+// only execute() touches GL. The lists keep their capacity, a steady frame allocates nothing.
+class RenderQueue {
+public:
+	RenderQueue() : FarPlane(1.0f), DrawCalls(0) {}
+
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+
+	// threadCount is the number of thread indices record() will see, ThreadPool::getThreadCount().
+	void begin(float farPlane, unsigned int threadCount = 1) {
+		while (Lists.size() < threadCount) {
+			Lists.emplace_back(new CommandList());
+		}
+		for (std::unique_ptr<CommandList>& list : Lists) {
+			list->Commands.clear();
+			list->Keys.clear();
+		}
+		FarPlane = farPlane;
+	}
+
+	// Safe from any thread, as long as no two threads record with the same index at once.
+	void record(unsigned int thread, const RenderCommand& command) {
+		CommandList& list = *Lists[thread];
+		list.Keys.push_back(this->makeKey(command));
+		list.Commands.push_back(command);
+	}
+
+	// From the GL thread, outside the recording jobs
+	void submit(const RenderCommand& command) {
+		this->record(0, command);
+	}
+
+	void execute(GLStateCache& state) {
+		// Thread index in the top byte of the order entry, the command's place in that thread's list below it
+		Order.clear();
+		for (unsigned int thread = 0; thread < Lists.size(); thread++) {
+			const std::vector<uint64_t>& keys = Lists[thread]->Keys;
+			for (unsigned int i = 0; i < keys.size(); i++) {
+				Order.push_back(std::make_pair(keys[i], thread << 24 | i));
+			}
+		}
+		std::sort(Order.begin(), Order.end());
+		state.invalidate();
+		state.resetStats();
+		Shader::uniformUploads() = 0;
+		DrawCalls = 0;
+
+		for (const std::pair<uint64_t, unsigned int>& entry : Order) {
+			const RenderCommand& command = Lists[entry.second >> 24]->Commands[entry.second & 0xFFFFFF];
+			state.useProgram(command.Program->ID);
+			state.depthFunc(command.DepthFunc);
+			for (unsigned int unit = 0; unit < RENDER_TEXTURE_UNITS; unit++) {
+				if (command.Textures[unit] != 0) {
+					state.bindTexture(unit, command.TextureTargets[unit], command.Textures[unit]);
+				}
+			}
+			for (unsigned int i = 0; i < command.UniformCount; i++) {
+				applyUniform(*command.Program, command.Uniforms[i]);
+			}
+
+			state.bindVertexArray(command.VAO);
+			if (command.Prepare != nullptr) {
+				command.Prepare(command);
+			}
+			if (command.Count == 0) {
+				continue;
+			}
+			if (command.Indexed) {
+				if (command.Instances > 0) {
+					glDrawElementsInstanced(command.Primitive, command.Count, GL_UNSIGNED_INT, (void*)(size_t)command.First, command.Instances);
+				} else {
+					glDrawElements(command.Primitive, command.Count, GL_UNSIGNED_INT, (void*)(size_t)command.First);
+				}
+			} else {
+				if (command.Instances > 0) {
+					glDrawArraysInstanced(command.Primitive, command.First, command.Count, command.Instances);
+				} else {
+					glDrawArrays(command.Primitive, command.First, command.Count);
+				}
+			}
+			DrawCalls++;
+		}
+
+		// Leave the defaults the code outside the queue expects
+		state.depthFunc(GL_LESS);
+		state.bindVertexArray(0);
+	}
+
+	unsigned int getCommandCount() const { return (unsigned int)Order.size(); }
+	unsigned int getDrawCalls() const { return DrawCalls; }
+
+private:
+	struct CommandList {
+		std::vector<RenderCommand> Commands;
+		std::vector<uint64_t> Keys;
+	};
+
+	// Separate allocations, so threads pushing to neighbouring lists don't share a cache line
+	std::vector<std::unique_ptr<CommandList>> Lists;
+	std::vector<std::pair<uint64_t, unsigned int>> Order;
+	float FarPlane;
+	unsigned int DrawCalls;
+
+	uint64_t makeKey(const RenderCommand& command) const {
+		uint64_t pass = (uint64_t)command.Pass & 0x3;
+		uint64_t program = command.Program->ID & 0x3FF;
+		uint64_t textures = hashTextures(command) & 0xFFF;
+		uint64_t material = hashMaterial(command) & 0xFF;
+		uint64_t vao = command.VAO & 0xFF;
+		uint64_t depth = (uint64_t)(glm::clamp(command.Depth / FarPlane, 0.0f, 1.0f) * 0xFFFFFF);
+		if (command.Pass == RENDER_PASS_BLENDED) {
+			return pass << 62 | (0xFFFFFF - depth) << 38 | program << 28 | textures << 16 | material << 8 | vao;
+		}
+		return pass << 62 | program << 52 | material << 44 | textures << 32 | vao << 24 | depth;
+	}
+
+	static uint32_t fnv(uint32_t hash, const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	static uint32_t fold(uint32_t hash) {
+		return hash ^ (hash >> 16);
+	}
+
+	static uint32_t hashTextures(const RenderCommand& command) {
+		return fold(fnv(2166136261u, command.Textures, sizeof(command.Textures)));
+	}
+
+	// Everything but the matrices, which differ per object rather than per material
+	static uint32_t hashMaterial(const RenderCommand& command) {
+		uint32_t hash = 2166136261u;
+		for (unsigned int i = 0; i < command.UniformCount; i++) {
+			const RenderUniform& uniform = command.Uniforms[i];
+			if (uniform.Type != GL_FLOAT_MAT4) {
+				hash = fnv(hash, uniform.Value, uniform.Type == GL_FLOAT_VEC4 ? 4 * sizeof(float) : sizeof(float));
+			}
+		}
+		return fold(hash);
+	}
+
+	static void applyUniform(Shader& program, const RenderUniform& uniform) {
+		switch (uniform.Type) {
+		case GL_INT:
+			applyUniform<int>(program, uniform);
+			break;
+		case GL_FLOAT:
+			applyUniform<float>(program, uniform);
+			break;
+		case GL_FLOAT_VEC4:
+			applyUniform<glm::vec4>(program, uniform);
+			break;
+		case GL_FLOAT_MAT4:
+			applyUniform<glm::mat4>(program, uniform);
+			break;
+		}
+	}
+
+	template <typename T>
+	static void applyUniform(Shader& program, const RenderUniform& uniform) {
+		UniformHandle<T> handle;
+		handle.Index = uniform.Index;
+		T value;
+		std::memcpy(&value, uniform.Value, sizeof(T));
+		program.set(handle, value);
+	}
+};
+
+#endif // !RENDERQUEUE_H
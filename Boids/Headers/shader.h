@@ -3,18 +3,39 @@
 
 #include <glad/glad.h>
 
-#include "..\Headers\logging.h";
+#include "../Headers/logging.h"
 
+#include <glm/glm.hpp>
+
+#include "../Headers/programcache.h"
+#include "../Headers/uniformbuffer.h"
+
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+
+// Index into a Shader's uniform table, typed by the value it takes.
+// Stays invalid when the program has no such active uniform, and setting it is then a no-op.
+template <typename T>
+struct UniformHandle {
+	int Index = -1;
+
+	bool isValid() const { return Index >= 0; }
+
+	// Keeps the value of Shader::set() out of template deduction, so it converts to T
+	typedef T ValueType;
+};
 
 class Shader {
 public:
 	unsigned int ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr) {
+	// defines is inserted into every stage right after its #version line, e.g. "#define LIGHTING\n".
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "") {
 		std::string vertexCode;
 		std::string fragmentCode;
 		std::string geometryCode;
@@ -53,6 +74,245 @@ public:
 			// Handle Failure
 			logging::loggingMessage(logging::LogType::ERROR, "[ERROR] Failed to load shader files.");
 		}
+		if (!defines.empty()) {
+			vertexCode = injectDefines(vertexCode, defines);
+			fragmentCode = injectDefines(fragmentCode, defines);
+			if (geometryPath != nullptr) {
+				geometryCode = injectDefines(geometryCode, defines);
+			}
+		}
+
+		// A cached binary skips compiling and linking altogether
+		ProgramCache& cache = ProgramCache::instance();
+		uint64_t key = cache.makeKey(vertexCode, fragmentCode, geometryCode);
+		ID = glCreateProgram();
+		if (!cache.load(ID, key)) {
+			this->compileAndLink(vertexCode, fragmentCode, geometryCode, vertexPath, fragmentPath, geometryPath);
+			cache.store(ID, key);
+		}
+		this->reflectUniforms();
+		this->bindUniformBlocks();
+		this->bindSharedSamplers();
+	};
+
+	// The uniform cache belongs to the program, a copy would drift out of sync with it
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+
+	// Util functions
+
+	void use() {
+		glUseProgram(ID);
+	}
+
+	// Resolve a uniform once, then set it through the handle in hot paths.
+	template <typename T>
+	UniformHandle<T> getUniform(const char* name) const {
+		UniformHandle<T> handle;
+		handle.Index = this->findUniform(name);
+		if (handle.isValid() && !typeMatches<T>(Uniforms[handle.Index].Type)) {
+			logging::loggingMessage(logging::LogType::WARNING, std::string("Uniform ") + name + " is set with a value of the wrong type.");
+		}
+		return handle;
+	}
+
+	// Uploads only when the value differs from the last one set. The program must be in use.
+	template <typename T>
+	void set(UniformHandle<T> handle, const typename UniformHandle<T>::ValueType& value) {
+		this->setIndex(handle.Index, value);
+	}
+
+	// Name-based setters look the uniform up in the reflected table instead of asking the driver.
+	void setBool(const char* name, bool value) {
+		this->setIndex(this->findUniform(name), value);
+	}
+
+	void setInt(const char* name, int value) {
+		this->setIndex(this->findUniform(name), value);
+	}
+
+	void setFloat(const char* name, float value) {
+		this->setIndex(this->findUniform(name), value);
+	}
+
+	void setVec3(const char* name, glm::vec3 vector) {
+		this->setIndex(this->findUniform(name), vector);
+	}
+
+	void setVec3(const char* name, float x, float y, float z) {
+		this->setIndex(this->findUniform(name), glm::vec3(x, y, z));
+	}
+
+	void setVec4(const char* name, glm::vec4 vector) {
+		this->setIndex(this->findUniform(name), vector);
+	}
+
+	void setVec4(const char* name, float x, float y, float z, float w) {
+		this->setIndex(this->findUniform(name), glm::vec4(x, y, z, w));
+	}
+
+	void setMat3(const char* name, glm::mat3 matrices) {
+		this->setIndex(this->findUniform(name), matrices);
+	}
+
+	void setMat4(const char* name, glm::mat4 matrices) {
+		this->setIndex(this->findUniform(name), matrices);
+	}
+
+	unsigned int getUniformCount() const { return (unsigned int)Uniforms.size(); }
+
+	// Values actually sent to the driver by every program, cleared by whoever reports it (the render queue, once a frame)
+	static unsigned int& uniformUploads() {
+		static unsigned int count = 0;
+		return count;
+	}
+
+private:
+	struct UniformSlot {
+		std::string Name;
+		GLint Location;
+		GLenum Type;
+		// GL type of the last value set (0 when nothing is cached), so a float and a bool with the same bytes don't match
+		GLenum CachedType;
+		unsigned char Value[sizeof(glm::mat4)];
+	};
+
+	// Sorted by name, so lookups are a binary search without building strings.
+	std::vector<UniformSlot> Uniforms;
+
+	void reflectUniforms() {
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> buffer(maxLength + 1);
+
+		for (GLint i = 0; i < count; i++) {
+			GLint size = 0;
+			GLenum type = 0;
+			GLsizei length = 0;
+			glGetActiveUniform(ID, i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+
+			// Arrays of plain types are reported once as "name[0]"; register every element and the bare name
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+				std::string base = name.substr(0, name.size() - 3);
+				this->addUniform(base, type);
+				for (GLint j = 0; j < size; j++) {
+					this->addUniform(base + "[" + std::to_string(j) + "]", type);
+				}
+			} else {
+				this->addUniform(name, type);
+			}
+		}
+
+		std::sort(Uniforms.begin(), Uniforms.end(), [](const UniformSlot& a, const UniformSlot& b) { return a.Name < b.Name; });
+	}
+
+	// Attach the shared blocks this program declares to their binding points.
+	void bindUniformBlocks() {
+		for (unsigned int i = 0; i < BLOCK_COUNT; i++) {
+			GLuint index = glGetUniformBlockIndex(ID, UNIFORM_BLOCK_NAMES[i]);
+			if (index != GL_INVALID_INDEX) {
+				glUniformBlockBinding(ID, index, i);
+			}
+		}
+	}
+
+	// Point the shared samplers this program declares at their fixed units, they never change afterwards.
+	void bindSharedSamplers() {
+		glUseProgram(ID);
+		for (unsigned int i = 0; i < SAMPLER_COUNT; i++) {
+			GLint location = glGetUniformLocation(ID, SHARED_SAMPLER_NAMES[i]);
+			if (location >= 0) {
+				glUniform1i(location, SHARED_SAMPLER_UNIT + i);
+			}
+		}
+		glUseProgram(0);
+	}
+
+	void addUniform(const std::string& name, GLenum type) {
+		GLint location = glGetUniformLocation(ID, name.c_str());
+		if (location < 0) {
+			// Members of uniform blocks have no location
+			return;
+		}
+		UniformSlot slot;
+		slot.Name = name;
+		slot.Location = location;
+		slot.Type = type;
+		slot.CachedType = 0;
+		Uniforms.push_back(slot);
+	}
+
+	int findUniform(const char* name) const {
+		int low = 0;
+		int high = (int)Uniforms.size() - 1;
+		while (low <= high) {
+			int middle = (low + high) / 2;
+			int order = std::strcmp(Uniforms[middle].Name.c_str(), name);
+			if (order == 0) {
+				return middle;
+			}
+			if (order < 0) {
+				low = middle + 1;
+			} else {
+				high = middle - 1;
+			}
+		}
+		return -1;
+	}
+
+	template <typename T>
+	void setIndex(int index, const T& value) {
+		if (index < 0) {
+			return;
+		}
+		UniformSlot& slot = Uniforms[index];
+		GLenum type = glTypeOf(value);
+		if (slot.CachedType == type && std::memcmp(slot.Value, &value, sizeof(T)) == 0) {
+			return;
+		}
+		slot.CachedType = type;
+		std::memcpy(slot.Value, &value, sizeof(T));
+		upload(slot.Location, value);
+		uniformUploads()++;
+	}
+
+	static GLenum glTypeOf(bool) { return GL_BOOL; }
+	static GLenum glTypeOf(int) { return GL_INT; }
+	static GLenum glTypeOf(float) { return GL_FLOAT; }
+	static GLenum glTypeOf(const glm::vec3&) { return GL_FLOAT_VEC3; }
+	static GLenum glTypeOf(const glm::vec4&) { return GL_FLOAT_VEC4; }
+	static GLenum glTypeOf(const glm::mat3&) { return GL_FLOAT_MAT3; }
+	static GLenum glTypeOf(const glm::mat4&) { return GL_FLOAT_MAT4; }
+
+	static void upload(GLint location, bool value) { glUniform1i(location, value); }
+	static void upload(GLint location, int value) { glUniform1i(location, value); }
+	static void upload(GLint location, float value) { glUniform1f(location, value); }
+	static void upload(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+	static void upload(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+	static void upload(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+	static void upload(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+	// Bools may be set as int or float, samplers as int (the same conversions glUniform accepts).
+	template <typename T>
+	static bool typeMatches(GLenum type) {
+		T value = T();
+		GLenum expected = glTypeOf(value);
+		if (type == expected) {
+			return true;
+		}
+		if (type == GL_BOOL) {
+			return expected == GL_INT || expected == GL_FLOAT;
+		}
+		if (expected == GL_INT) {
+			return type == GL_SAMPLER_2D || type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE || type == GL_SAMPLER_2D_ARRAY;
+		}
+		return false;
+	}
+
+	void compileAndLink(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode, const char* vertexPath, const char* fragmentPath, const char* geometryPath) {
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
 
@@ -68,7 +328,7 @@ public:
 		glCompileShader(fragment);
 		checkCompileErrors(fragment, "Fragment", fragmentPath);
 
-		unsigned int geometry;
+		unsigned int geometry = 0;
 		if (geometryPath != nullptr) {
 			const char* gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
@@ -77,12 +337,12 @@ public:
 			checkCompileErrors(geometry, "Geometry", geometryPath);
 		}
 
-		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
 		if (geometryPath != nullptr) {
 			glAttachShader(ID, geometry);
 		}
+		ProgramCache::instance().prepare(ID);
 		glLinkProgram(ID);
 		checkCompileErrors(ID, "Program", NULL);
 
@@ -91,51 +351,22 @@ public:
 		if (geometryPath != nullptr) {
 			glDeleteShader(geometry);
 		}
-	};
-
-	// Util functions
-
-	void use() {
-		glUseProgram(ID);
-	}
-
-	void setBool(const std::string& name, bool value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-	}
-
-	void setInt(const std::string& name, int value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-	}
-
-	void setFloat(const std::string& name, float value) const {
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-	}
-
-	void setVec3(const std::string& name, glm::vec3 vector) const {
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &vector[0]);
-	}
-
-	void setVec3(const std::string& name, float x, float y, float z) const {
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
-	}
-
-	void setVec4(const std::string& name, glm::vec4 vector) const {
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &vector[0]);
 	}
 
-	void setVec4(const std::string& name, float x, float y, float z, float w) const {
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
-	}
-
-	void setMat3(const std::string& name, glm::mat3 matrices) const {
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &matrices[0][0]);
-	}
-
-	void setMat4(const std::string& name, glm::mat4 matrices) const {
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &matrices[0][0]);
+	// #version has to stay the first statement; #line keeps error messages pointing at the file's own lines.
+	static std::string injectDefines(const std::string& code, const std::string& defines) {
+		size_t version = code.find("#version");
+		if (version == std::string::npos) {
+			return defines + "#line 1\n" + code;
+		}
+		size_t lineEnd = code.find('\n', version);
+		if (lineEnd == std::string::npos) {
+			return code + "\n" + defines;
+		}
+		unsigned int nextLine = (unsigned int)std::count(code.begin(), code.begin() + lineEnd, '\n') + 2;
+		return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(nextLine) + "\n" + code.substr(lineEnd + 1);
 	}
 
-private:
 	void checkCompileErrors(unsigned int shader, std::string type, const char* filePath) {
 		int success;
 		char infoLog[1024];
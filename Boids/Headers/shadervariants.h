@@ -0,0 +1,111 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include "../Headers/logging.h"
+#include "../Headers/shader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// Switches compiled into a program as #defines instead of being branched on per fragment.
+// Shaders test them with #ifdef; the names are in SHADER_FEATURE_DEFINES.
+enum Shader_Feature {
+	FEATURE_LIGHTING = 1 << 0,
+	FEATURE_BLINN_PHONG = 1 << 1,
+	FEATURE_SPOT_EXPONENT = 1 << 2,
+	FEATURE_DIFFUSE_TEXTURE = 1 << 3,
+	FEATURE_SPECULAR_TEXTURE = 1 << 4,
+	FEATURE_EMISSION = 1 << 5,
+	FEATURE_EMISSION_TEXTURE = 1 << 6,
+	FEATURE_GAMMA = 1 << 7,
+	// Not a toggle: the diffuse texture is a GL_TEXTURE_2D_ARRAY and the vertex shader passes the layer
+	FEATURE_TEXTURE_ARRAY = 1 << 8,
+};
+
+const unsigned int SHADER_FEATURE_COUNT = 9;
+
+const char* const SHADER_FEATURE_DEFINES[SHADER_FEATURE_COUNT] = {
+	"LIGHTING",
+	"BLINN_PHONG",
+	"SPOT_EXPONENT",
+	"DIFFUSE_TEXTURE",
+	"SPECULAR_TEXTURE",
+	"EMISSION",
+	"EMISSION_TEXTURE",
+	"GAMMA",
+	"TEXTURE_ARRAY",
+};
+
+// Every feature combination of one vertex/fragment pair, compiled the first time it is asked for.
+// Bindings holds the uniform handles of a variant, filled by the resolver right after it links.
+template <typename Bindings>
+class ShaderVariants {
+public:
+	typedef Bindings (*Resolver)(const Shader& shader);
+
+	struct Variant {
+		Shader Program;
+		Bindings Uniforms;
+
+		Variant(const char* vertexPath, const char* fragmentPath, const std::string& defines, Resolver resolve)
+			: Program(vertexPath, fragmentPath, nullptr, defines), Uniforms(resolve(Program)) {}
+	};
+
+	ShaderVariants(const char* vertexPath, const char* fragmentPath, Resolver resolve) : VertexPath(vertexPath), FragmentPath(fragmentPath), Resolve(resolve), CompiledCount(0) {}
+
+	ShaderVariants(const ShaderVariants&) = delete;
+	ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+	Variant& get(unsigned int features) {
+		std::unique_ptr<Variant>& variant = Variants[features & FEATURE_MASK];
+		if (!variant) {
+			this->compile(variant, features & FEATURE_MASK);
+		}
+		return *variant;
+	}
+
+	unsigned int getCompiledCount() const { return CompiledCount; }
+
+	static std::string describe(unsigned int features) {
+		std::string names;
+		for (unsigned int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+			if (features & (1u << i)) {
+				names += names.empty() ? "" : " ";
+				names += SHADER_FEATURE_DEFINES[i];
+			}
+		}
+		return names.empty() ? "none" : names;
+	}
+
+private:
+	static const unsigned int FEATURE_MASK = (1u << SHADER_FEATURE_COUNT) - 1;
+
+	std::string VertexPath;
+	std::string FragmentPath;
+	Resolver Resolve;
+	unsigned int CompiledCount;
+	std::unique_ptr<Variant> Variants[1u << SHADER_FEATURE_COUNT];
+
+	// Compiling stalls the frame it happens in, so it is logged to explain the hitch
+	void compile(std::unique_ptr<Variant>& variant, unsigned int features) {
+		std::string defines;
+		for (unsigned int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+			if (features & (1u << i)) {
+				defines += std::string("#define ") + SHADER_FEATURE_DEFINES[i] + "\n";
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		variant.reset(new Variant(VertexPath.c_str(), FragmentPath.c_str(), defines, Resolve));
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		CompiledCount++;
+
+		char timing[32];
+		std::snprintf(timing, sizeof(timing), "%.1f ms", milliseconds);
+		logging::loggingMessage(logging::LogType::INFO, "Compiled " + VertexPath + " + " + FragmentPath + " [" + describe(features) + "] in " + timing);
+	}
+};
+
+#endif // !SHADERVARIANTS_H
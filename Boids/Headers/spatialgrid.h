@@ -0,0 +1,207 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <glm/glm.hpp>
+
+#include "../Headers/camera.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SPATIALGRID_SSE
+#include <xmmintrin.h>
+#endif
+
+// Cells per axis at most, a scattered flock gets larger cells instead of a huge grid.
+const unsigned int GRID_MAX_CELLS_PER_AXIS = 32;
+
+// Uniform grid over the bounding box of a point set, rebuilt every frame with a counting sort.
+// Points are stored per cell as separate x/y/z arrays so the per-point tests run four at a time,
+// and each cell keeps the tight bounds of what it holds rather than its nominal extent.
+// The vectors only grow, so rebuilding at a steady flock size allocates nothing.
+class SpatialGrid {
+public:
+	SpatialGrid() : CellSize(1.0f), Origin(0.0f), CellsInside(0), CellsOutside(0), CellsStraddling(0), PointTests(0) {
+		Dims[0] = Dims[1] = Dims[2] = 0;
+	}
+
+	// positionOf(i) returns the position of point i.
+	template <typename PositionOf>
+	void build(unsigned int count, PositionOf positionOf, float cellSize) {
+		glm::vec3 low(0.0f);
+		glm::vec3 high(0.0f);
+		for (unsigned int i = 0; i < count; i++) {
+			glm::vec3 position = positionOf(i);
+			low = i == 0 ? position : glm::min(low, position);
+			high = i == 0 ? position : glm::max(high, position);
+		}
+
+		glm::vec3 extent = high - low;
+		CellSize = std::max(cellSize, std::max(extent.x, std::max(extent.y, extent.z)) / GRID_MAX_CELLS_PER_AXIS);
+		Origin = low;
+		for (int axis = 0; axis < 3; axis++) {
+			Dims[axis] = std::min(GRID_MAX_CELLS_PER_AXIS, (unsigned int)(extent[axis] / CellSize) + 1);
+		}
+		unsigned int cellCount = Dims[0] * Dims[1] * Dims[2];
+
+		CellStart.assign(cellCount + 1, 0);
+		CellLow.resize(cellCount);
+		CellHigh.resize(cellCount);
+		PointCell.resize(count);
+		for (unsigned int i = 0; i < count; i++) {
+			PointCell[i] = this->cellOf(positionOf(i));
+			CellStart[PointCell[i] + 1]++;
+		}
+		for (unsigned int cell = 0; cell < cellCount; cell++) {
+			CellStart[cell + 1] += CellStart[cell];
+		}
+
+		Items.resize(count);
+		X.resize(count);
+		Y.resize(count);
+		Z.resize(count);
+		Next.assign(CellStart.begin(), CellStart.end() - 1);
+		for (unsigned int i = 0; i < count; i++) {
+			unsigned int cell = PointCell[i];
+			unsigned int slot = Next[cell]++;
+			glm::vec3 position = positionOf(i);
+			Items[slot] = i;
+			X[slot] = position.x;
+			Y[slot] = position.y;
+			Z[slot] = position.z;
+			bool first = slot == CellStart[cell];
+			CellLow[cell] = first ? position : glm::min(CellLow[cell], position);
+			CellHigh[cell] = first ? position : glm::max(CellHigh[cell], position);
+		}
+	}
+
+	// Append the points whose sphere of radius reaches into the frustum.
+	// Cells wholly inside or outside are settled by their bounds, only cells crossing a plane test their points.
+	template <typename Output>
+	void cull(const Frustum& frustum, float radius, Output& visible) {
+		CellsInside = 0;
+		CellsOutside = 0;
+		CellsStraddling = 0;
+		PointTests = 0;
+
+		unsigned int cellCount = (unsigned int)CellStart.size() - 1;
+		for (unsigned int cell = 0; cell < cellCount; cell++) {
+			unsigned int begin = CellStart[cell];
+			unsigned int end = CellStart[cell + 1];
+			if (begin == end) {
+				continue;
+			}
+
+			Cell_Test test = this->testBox(frustum, CellLow[cell], CellHigh[cell], radius);
+			if (test == CELL_OUTSIDE) {
+				CellsOutside++;
+			} else if (test == CELL_INSIDE) {
+				CellsInside++;
+				visible.insert(visible.end(), Items.begin() + begin, Items.begin() + end);
+			} else {
+				CellsStraddling++;
+				PointTests += end - begin;
+				this->cullPoints(frustum, radius, begin, end, visible);
+			}
+		}
+	}
+
+	unsigned int getCellCount() const { return Dims[0] * Dims[1] * Dims[2]; }
+	float getCellSize() const { return CellSize; }
+
+	// Outcome of the last cull(), for the UI
+	unsigned int getCellsInside() const { return CellsInside; }
+	unsigned int getCellsOutside() const { return CellsOutside; }
+	unsigned int getCellsStraddling() const { return CellsStraddling; }
+	unsigned int getPointTests() const { return PointTests; }
+
+private:
+	enum Cell_Test {
+		CELL_OUTSIDE,
+		CELL_INSIDE,
+		CELL_STRADDLING
+	};
+
+	float CellSize;
+	glm::vec3 Origin;
+	unsigned int Dims[3];
+	// Points of cell c are Items[CellStart[c]] to Items[CellStart[c + 1] - 1], X/Y/Z hold their positions in the same order
+	std::vector<unsigned int> CellStart;
+	std::vector<unsigned int> Next;
+	std::vector<unsigned int> PointCell;
+	std::vector<unsigned int> Items;
+	std::vector<float> X;
+	std::vector<float> Y;
+	std::vector<float> Z;
+	std::vector<glm::vec3> CellLow;
+	std::vector<glm::vec3> CellHigh;
+
+	unsigned int CellsInside;
+	unsigned int CellsOutside;
+	unsigned int CellsStraddling;
+	unsigned int PointTests;
+
+	unsigned int cellOf(const glm::vec3& position) const {
+		unsigned int index[3];
+		for (int axis = 0; axis < 3; axis++) {
+			index[axis] = std::min(Dims[axis] - 1, (unsigned int)((position[axis] - Origin[axis]) / CellSize));
+		}
+		return (index[2] * Dims[1] + index[1]) * Dims[0] + index[0];
+	}
+
+	// The corner furthest along a plane's normal decides whether anything can be inside, the nearest one whether everything is.
+	Cell_Test testBox(const Frustum& frustum, const glm::vec3& low, const glm::vec3& high, float radius) const {
+		Cell_Test result = CELL_INSIDE;
+		for (const glm::vec4& plane : frustum.Planes) {
+			glm::vec3 normal(plane);
+			glm::vec3 outer(normal.x >= 0.0f ? high.x : low.x, normal.y >= 0.0f ? high.y : low.y, normal.z >= 0.0f ? high.z : low.z);
+			glm::vec3 inner(normal.x >= 0.0f ? low.x : high.x, normal.y >= 0.0f ? low.y : high.y, normal.z >= 0.0f ? low.z : high.z);
+			if (glm::dot(normal, outer) + plane.w < -radius) {
+				return CELL_OUTSIDE;
+			}
+			if (glm::dot(normal, inner) + plane.w < -radius) {
+				result = CELL_STRADDLING;
+			}
+		}
+		return result;
+	}
+
+	template <typename Output>
+	void cullPoints(const Frustum& frustum, float radius, unsigned int begin, unsigned int end, Output& visible) const {
+		unsigned int i = begin;
+#ifdef SPATIALGRID_SSE
+		// Four points against one plane per step, a lane stays set while its sphere is on the inner side of every plane
+		const __m128 limit = _mm_set1_ps(-radius);
+		for (; i + 4 <= end; i += 4) {
+			__m128 x = _mm_loadu_ps(&X[i]);
+			__m128 y = _mm_loadu_ps(&Y[i]);
+			__m128 z = _mm_loadu_ps(&Z[i]);
+			__m128 inside = _mm_cmpeq_ps(x, x);
+			for (const glm::vec4& plane : frustum.Planes) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, limit));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (unsigned int lane = 0; lane < 4; lane++) {
+				if (mask & (1 << lane)) {
+					visible.push_back(Items[i + lane]);
+				}
+			}
+		}
+#endif
+		for (; i < end; i++) {
+			bool inside = true;
+			for (const glm::vec4& plane : frustum.Planes) {
+				inside = inside && plane.x * X[i] + plane.y * Y[i] + plane.z * Z[i] + plane.w >= -radius;
+			}
+			if (inside) {
+				visible.push_back(Items[i]);
+			}
+		}
+	}
+};
+
+#endif // !SPATIALGRID_H
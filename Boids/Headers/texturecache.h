@@ -0,0 +1,221 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include "../Headers/mappedfile.h"
+#include "../Headers/stb_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Converted textures are written here on first use and mapped on every later start.
+const char* const TEXTURE_CACHE_DIRECTORY = "TextureCache";
+
+const uint32_t BTEX_MAGIC = 0x58455442; // "BTEX"
+const uint32_t BTEX_VERSION = 1;
+const uint32_t BTEX_FLAG_MIPMAPS = 1;
+const unsigned int BTEX_MAX_LEVELS = 16;
+
+struct BtexLevel {
+	uint32_t Offset;
+	uint32_t Width;
+	uint32_t Height;
+};
+
+// A .btex file is this header followed by every level as tightly packed RGBA8, largest first.
+// SourceHash is the FNV-1a hash of the original file, an edited image no longer matches its conversion.
+struct BtexHeader {
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t SourceHash;
+	uint32_t SourceChannels;
+	uint32_t Flags;
+	uint32_t LevelCount;
+	uint32_t Pad0;
+	BtexLevel Levels[BTEX_MAX_LEVELS];
+};
+
+// Decoded image with its mip chain, mapped from the .btex cache or converted from the source file.
+// Both cases expose the same layout, so the upload doesn't care where it came from.
+class TextureFile {
+public:
+	TextureFile() : Header(nullptr), Base(nullptr), Cached(false) {}
+
+	bool isValid() const { return Header != nullptr; }
+	bool isFromCache() const { return Cached; }
+	unsigned int getSourceChannels() const { return Header->SourceChannels; }
+	unsigned int getLevelCount() const { return Header->LevelCount; }
+	unsigned int getWidth(unsigned int level) const { return Header->Levels[level].Width; }
+	unsigned int getHeight(unsigned int level) const { return Header->Levels[level].Height; }
+	const unsigned char* getLevel(unsigned int level) const { return Base + Header->Levels[level].Offset; }
+
+	// Safe to call from any thread, every source path has its own cache file.
+	static TextureFile load(const std::string& path, bool mipmaps) {
+		TextureFile texture;
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			return texture;
+		}
+		std::vector<unsigned char> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		uint64_t hash = hashBytes(source);
+		uint32_t flags = mipmaps ? BTEX_FLAG_MIPMAPS : 0;
+		std::string cachePath = makeCachePath(path);
+
+		if (texture.Mapping.open(cachePath)) {
+			const BtexHeader* header = reinterpret_cast<const BtexHeader*>(texture.Mapping.getData());
+			if (isCurrent(header, texture.Mapping.getSize(), hash, flags)) {
+				texture.Header = header;
+				texture.Base = texture.Mapping.getData();
+				texture.Cached = true;
+				return texture;
+			}
+			// Stale, it is about to be overwritten
+			texture.Mapping.close();
+		}
+
+		if (!texture.convert(source, hash, flags)) {
+			return texture;
+		}
+		texture.write(cachePath);
+		return texture;
+	}
+
+private:
+	MappedFile Mapping;
+	std::vector<unsigned char> Converted;
+	const BtexHeader* Header;
+	const unsigned char* Base;
+	bool Cached;
+
+	static uint64_t hashBytes(const std::vector<unsigned char>& bytes) {
+		uint64_t hash = 14695981039346656037ull;
+		for (unsigned char c : bytes) {
+			hash = (hash ^ c) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static std::string makeCachePath(const std::string& path) {
+		std::string name = path;
+		std::replace(name.begin(), name.end(), '\\', '_');
+		std::replace(name.begin(), name.end(), '/', '_');
+		std::replace(name.begin(), name.end(), ':', '_');
+		return std::string(TEXTURE_CACHE_DIRECTORY) + "/" + name + ".btex";
+	}
+
+	static bool isCurrent(const BtexHeader* header, size_t size, uint64_t hash, uint32_t flags) {
+		if (size < sizeof(BtexHeader) || header->Magic != BTEX_MAGIC || header->Version != BTEX_VERSION
+			|| header->SourceHash != hash || header->Flags != flags || header->LevelCount == 0 || header->LevelCount > BTEX_MAX_LEVELS) {
+			return false;
+		}
+		const BtexLevel& last = header->Levels[header->LevelCount - 1];
+		return (size_t)last.Offset + (size_t)last.Width * last.Height * 4 <= size;
+	}
+
+	// Expand to RGBA8 and box-filter the mip chain down to 1x1.
+	// Single-channel images keep their value in red, as GL_RED sampled before.
+	bool convert(const std::vector<unsigned char>& source, uint64_t hash, uint32_t flags) {
+		int width, height, channels;
+		unsigned char* pixels = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channels, 0);
+		if (pixels == nullptr) {
+			return false;
+		}
+
+		BtexHeader header = {};
+		header.Magic = BTEX_MAGIC;
+		header.Version = BTEX_VERSION;
+		header.SourceHash = hash;
+		header.SourceChannels = channels;
+		header.Flags = flags;
+
+		size_t total = sizeof(BtexHeader);
+		unsigned int levelWidth = width;
+		unsigned int levelHeight = height;
+		while (header.LevelCount < BTEX_MAX_LEVELS) {
+			BtexLevel& level = header.Levels[header.LevelCount++];
+			level.Offset = (uint32_t)total;
+			level.Width = levelWidth;
+			level.Height = levelHeight;
+			total += (size_t)levelWidth * levelHeight * 4;
+			if (!(flags & BTEX_FLAG_MIPMAPS) || (levelWidth == 1 && levelHeight == 1)) {
+				break;
+			}
+			levelWidth = std::max(1u, levelWidth / 2);
+			levelHeight = std::max(1u, levelHeight / 2);
+		}
+
+		Converted.resize(total);
+		unsigned char* base = Converted.data();
+		unsigned char* top = base + header.Levels[0].Offset;
+		for (int i = 0; i < width * height; i++) {
+			const unsigned char* in = pixels + (size_t)i * channels;
+			unsigned char* out = top + (size_t)i * 4;
+			out[0] = in[0];
+			out[1] = channels >= 3 ? in[1] : (channels == 2 ? in[0] : 0);
+			out[2] = channels >= 3 ? in[2] : (channels == 2 ? in[0] : 0);
+			out[3] = channels == 4 ? in[3] : (channels == 2 ? in[1] : 255);
+		}
+		stbi_image_free(pixels);
+
+		for (unsigned int i = 1; i < header.LevelCount; i++) {
+			downsample(base + header.Levels[i - 1].Offset, header.Levels[i - 1].Width, header.Levels[i - 1].Height,
+				base + header.Levels[i].Offset, header.Levels[i].Width, header.Levels[i].Height);
+		}
+
+		std::memcpy(base, &header, sizeof(header));
+		Header = reinterpret_cast<const BtexHeader*>(base);
+		Base = base;
+		return true;
+	}
+
+	static void downsample(const unsigned char* source, unsigned int sourceWidth, unsigned int sourceHeight, unsigned char* target, unsigned int width, unsigned int height) {
+		for (unsigned int y = 0; y < height; y++) {
+			unsigned int y0 = std::min(y * 2, sourceHeight - 1);
+			unsigned int y1 = std::min(y * 2 + 1, sourceHeight - 1);
+			for (unsigned int x = 0; x < width; x++) {
+				unsigned int x0 = std::min(x * 2, sourceWidth - 1);
+				unsigned int x1 = std::min(x * 2 + 1, sourceWidth - 1);
+				const unsigned char* a = source + ((size_t)y0 * sourceWidth + x0) * 4;
+				const unsigned char* b = source + ((size_t)y0 * sourceWidth + x1) * 4;
+				const unsigned char* c = source + ((size_t)y1 * sourceWidth + x0) * 4;
+				const unsigned char* d = source + ((size_t)y1 * sourceWidth + x1) * 4;
+				unsigned char* out = target + ((size_t)y * width + x) * 4;
+				for (unsigned int k = 0; k < 4; k++) {
+					out[k] = (unsigned char)((a[k] + b[k] + c[k] + d[k] + 2) / 4);
+				}
+			}
+		}
+	}
+
+	// Written under a temporary name first, so an interrupted run never leaves a truncated cache file.
+	void write(const std::string& cachePath) const {
+#ifdef _WIN32
+		_mkdir(TEXTURE_CACHE_DIRECTORY);
+#else
+		mkdir(TEXTURE_CACHE_DIRECTORY, 0755);
+#endif
+		std::string temporary = cachePath + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(Converted.data()), Converted.size());
+			if (!file) {
+				return;
+			}
+		}
+		std::remove(cachePath.c_str());
+		std::rename(temporary.c_str(), cachePath.c_str());
+	}
+};
+
+#endif // !TEXTURECACHE_H
@@ -0,0 +1,139 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "../Headers/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Chunks handed out per thread in parallelFor, more than one so uneven chunks balance out.
+const unsigned int POOL_CHUNKS_PER_THREAD = 4;
+
+// Fixed set of worker threads running data-parallel loops for the main thread.
+// Thread index 0 is always the calling thread, the workers are 1..getThreadCount()-1.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int workerCount = defaultWorkerCount()) : Stop(false), Generation(0), Busy(0) {
+		for (unsigned int i = 0; i < workerCount; i++) {
+			Workers.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stop = true;
+		}
+		WakeCondition.notify_all();
+		for (std::thread& worker : Workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int getThreadCount() const { return (unsigned int)Workers.size() + 1; }
+
+	// Run fn(begin, end, threadIndex) over [0, count) split into chunks, and return once every chunk is done.
+	// The task is passed by address, so nothing is allocated per call.
+	template <typename F>
+	void parallelFor(unsigned int count, F fn) {
+		if (Workers.empty() || count < 2) {
+			fn(0, count, 0);
+			return;
+		}
+
+		Job job;
+		job.Task = &invoke<F>;
+		job.Context = &fn;
+		job.Count = count;
+		job.ChunkSize = std::max(1u, (count + getThreadCount() * POOL_CHUNKS_PER_THREAD - 1) / (getThreadCount() * POOL_CHUNKS_PER_THREAD));
+		{
+			// A worker still finishing the previous job would otherwise claim chunks of this one
+			std::unique_lock<std::mutex> lock(Mutex);
+			DoneCondition.wait(lock, [this] { return Busy == 0; });
+			Current = job;
+			NextChunk.store(0, std::memory_order_relaxed);
+			Generation++;
+		}
+		WakeCondition.notify_all();
+
+		this->runChunks(job, 0);
+
+		// Every chunk has been claimed, the ones not run here belong to busy workers
+		std::unique_lock<std::mutex> lock(Mutex);
+		DoneCondition.wait(lock, [this] { return Busy == 0; });
+	}
+
+	static unsigned int defaultWorkerCount() {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		return hardware > 1 ? hardware - 1 : 0;
+	}
+
+private:
+	struct Job {
+		void (*Task)(void*, unsigned int, unsigned int, unsigned int);
+		void* Context;
+		unsigned int Count;
+		unsigned int ChunkSize;
+	};
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable WakeCondition;
+	std::condition_variable DoneCondition;
+	bool Stop;
+	uint64_t Generation;
+	unsigned int Busy;
+	Job Current;
+	std::atomic<unsigned int> NextChunk;
+
+	template <typename F>
+	static void invoke(void* context, unsigned int begin, unsigned int end, unsigned int threadIndex) {
+		(*static_cast<F*>(context))(begin, end, threadIndex);
+	}
+
+	void runChunks(const Job& job, unsigned int threadIndex) {
+		while (true) {
+			unsigned int begin = NextChunk.fetch_add(1, std::memory_order_relaxed) * job.ChunkSize;
+			if (begin >= job.Count) {
+				break;
+			}
+			job.Task(job.Context, begin, std::min(begin + job.ChunkSize, job.Count), threadIndex);
+		}
+	}
+
+	void workerLoop(unsigned int threadIndex) {
+		PROFILE_THREAD("Worker " + std::to_string(threadIndex));
+		uint64_t seen = 0;
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(Mutex);
+				WakeCondition.wait(lock, [&] { return Stop || Generation != seen; });
+				if (Stop) {
+					return;
+				}
+				seen = Generation;
+				job = Current;
+				Busy++;
+			}
+
+			this->runChunks(job, threadIndex);
+
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				Busy--;
+			}
+			DoneCondition.notify_all();
+		}
+	}
+};
+
+#endif // !THREADPOOL_H
@@ -0,0 +1,137 @@
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Uniform blocks shared by every program, bound to fixed binding points (GLSL 3.30 has no layout(binding)).
+// The names must match the block declarations in Shaders/*.vs, Shaders/lighting.fs and Shaders/skybox.fs.
+enum Uniform_Block {
+	BLOCK_FRAME,
+	BLOCK_LIGHTS,
+	BLOCK_FOG,
+	BLOCK_COUNT
+};
+
+const char* const UNIFORM_BLOCK_NAMES[BLOCK_COUNT] = {
+	"FrameBlock",
+	"LightsBlock",
+	"FogBlock",
+};
+
+// Buffer textures every lit program reads, bound once per frame to fixed units after the ones the render queue
+// manages (RENDER_TEXTURE_UNITS in Headers/renderqueue.h). The names must match the samplers in Shaders/lighting.fs.
+enum Shared_Sampler {
+	SAMPLER_CLUSTER_LIGHTS,
+	SAMPLER_CLUSTER_GRID,
+	SAMPLER_CLUSTER_INDICES,
+	SAMPLER_COUNT
+};
+
+const char* const SHARED_SAMPLER_NAMES[SAMPLER_COUNT] = {
+	"clusterLights",
+	"clusterGrid",
+	"clusterIndices",
+};
+
+const unsigned int SHARED_SAMPLER_UNIT = 4;
+
+// std140 mirrors of the GLSL blocks. A float following a vec3 takes its fourth component.
+struct FrameStd140 {
+	glm::mat4 View;
+	glm::mat4 Projection;
+	glm::vec3 ViewPos;
+	float Pad0;
+};
+
+struct LightStd140 {
+	glm::vec3 Position;
+	float Pad0;
+	glm::vec3 Direction;
+	float Pad1;
+	glm::vec3 Ambient;
+	float Pad2;
+	glm::vec3 Diffuse;
+	float Pad3;
+	glm::vec3 Specular;
+	float Constant;
+	float Linear;
+	float Quadratic;
+	float Cutoff;
+	float OuterCutoff;
+	float Exponent;
+	int Enable;
+	int Caster;
+	float Pad4;
+};
+
+// The directional light, and how to find a fragment's cluster; point and spot lights come from Headers/clusteredlights.h
+struct LightsStd140 {
+	LightStd140 Sun;
+	glm::ivec4 ClusterSize;		// tiles in x, y, slices in z, lights binned
+	glm::vec4 ClusterDepth;		// near plane, slice scale, slice bias
+	glm::vec4 ClusterScreen;	// 1 / viewport width, 1 / viewport height
+};
+
+struct FogStd140 {
+	int Mode;
+	int DepthType;
+	float Density;
+	float Start;
+	float End;
+	int Enable;
+	float Pad0[2];
+	glm::vec4 Color;
+};
+
+static_assert(sizeof(FrameStd140) == 144, "FrameStd140 must match the std140 layout of FrameBlock");
+static_assert(sizeof(LightStd140) == 112, "LightStd140 must match the std140 layout of struct Light");
+static_assert(sizeof(LightsStd140) == 160, "LightsStd140 must match the std140 layout of LightsBlock");
+static_assert(sizeof(FogStd140) == 48, "FogStd140 must match the std140 layout of struct Fog");
+
+// CPU copy of a uniform block and its buffer. Data is only sent when the block was marked dirty.
+template <typename T>
+class UniformBuffer {
+public:
+	unsigned int ID;
+	T Data;
+
+	UniformBuffer() : ID(0), Data(), Dirty(true), UploadCount(0) {}
+
+	void init(Uniform_Block binding) {
+		glGenBuffers(1, &ID);
+		glBindBuffer(GL_UNIFORM_BUFFER, ID);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+		Dirty = true;
+	}
+
+	void release() {
+		glDeleteBuffers(1, &ID);
+		ID = 0;
+	}
+
+	void markDirty() { Dirty = true; }
+	bool isDirty() const { return Dirty; }
+	unsigned int getUploadCount() const { return UploadCount; }
+
+	// Returns true if the block was uploaded.
+	bool upload() {
+		if (!Dirty) {
+			return false;
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, ID);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &Data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		Dirty = false;
+		UploadCount++;
+		return true;
+	}
+
+private:
+	bool Dirty;
+	unsigned int UploadCount;
+};
+
+#endif // !UNIFORMBUFFER_H
@@ -0,0 +1,64 @@
+#version 330 core
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTextureCoords;
+// Per instance, see BillboardInstance in Headers/billboard.h
+layout(location = 3) in vec3 instancePosition;
+layout(location = 4) in vec2 instanceSize;
+layout(location = 5) in float instanceLayer;
+// Phase (in frames) and speed of an animated sprite
+layout(location = 6) in vec2 instanceAnimation;
+
+out VS_OUT {
+	vec3 FragPos;
+	vec3 Normal;
+	vec2 TexCoords;
+#ifdef TEXTURE_ARRAY
+	flat float Layer;
+#endif
+} vs_out;
+
+uniform mat4 model;
+// Billboard_Mode in Headers/billboard.h: 0 fixed, 1 Y axis locked, 2 facing the screen
+uniform int billboardMode;
+// Layers per animation, 1 for still sprites; frameRate is in frames per second at speed 1
+uniform int frameCount;
+uniform float frameRate;
+uniform float time;
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+void main() {
+	mat4 viewModel = view * model;
+
+	// The rows of the view rotation are the camera axes in world space
+	vec3 axisX = vec3(viewModel[0][0], viewModel[1][0], viewModel[2][0]);
+	vec3 axisY = vec3(viewModel[0][1], viewModel[1][1], viewModel[2][1]);
+	vec3 axisZ = vec3(viewModel[0][2], viewModel[1][2], viewModel[2][2]);
+	if (billboardMode != 2) {
+		if (billboardMode == 0) {
+			axisZ = vec3(0.0, 0.0, -1.0);
+		}
+		axisX = vec3(axisZ.z, 0.0, -axisZ.x);
+		axisY = vec3(0.0, 1.0, 0.0);
+	}
+
+	// The unit quad spans [0, 1] in x and y, x is centered on the instance and y grows up from it
+	vec3 corner = instancePosition + (aPosition.x - 0.5) * instanceSize.x * axisX + aPosition.y * instanceSize.y * axisY;
+
+	vs_out.FragPos = vec3(model * vec4(corner, 1.0));
+	vs_out.Normal = mat3(transpose(inverse(model))) * aNormal;
+	vs_out.TexCoords = aTextureCoords;
+#ifdef TEXTURE_ARRAY
+	float frame = 0.0;
+	if (frameCount > 1) {
+		frame = mod(floor(instanceAnimation.x + time * instanceAnimation.y * frameRate), float(frameCount));
+	}
+	vs_out.Layer = instanceLayer + frame;
+#endif
+
+	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0);
+}
\ No newline at end of file
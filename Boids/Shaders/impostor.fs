@@ -0,0 +1,79 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Fog {
+	int mode;
+	int depthType;
+	float density;
+	float f_start;
+	float f_end;
+	bool enable;
+	vec4 color;
+};
+
+// Shared blocks written once per frame, laid out std140 to match Headers/uniformbuffer.h
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+layout (std140) uniform FogBlock {
+	Fog fog;
+};
+
+in vec2 TexCoords;
+in vec3 FragPos;
+flat in float Frame;
+
+// Only LIGHTING and GAMMA of the ShaderVariants features apply, the shading is baked into the atlas
+uniform float GammaValue;
+uniform sampler2DArray atlas;
+
+void main() {
+	vec4 texel = texture(atlas, vec3(TexCoords, Frame));
+	if (texel.a < 0.5) {
+		discard;
+	}
+
+#ifndef LIGHTING
+	FragColor = vec4(texel.rgb, 1.0);
+#else
+	// Foggy Effect
+	vec4 PreColor = vec4(texel.rgb, 1.0);
+	vec4 FinalColor = vec4(0.0);
+	float distance = 0.0;
+	float fogFactor = 0.0;
+
+	if (fog.depthType == 0) {
+		// Plane Based
+		distance = abs((viewPos - FragPos).z);
+	} else {
+		// Range Based
+		distance = length(viewPos - FragPos);
+	}
+
+	if (fog.enable) {
+		if (fog.mode == 0) {
+			// Foggy Effect Linear
+			fogFactor = clamp((fog.f_end - distance) / (fog.f_end - fog.f_start), 0.0, 1.0);
+		} else if (fog.mode == 1) {
+			// Foggy Effect EXP
+			fogFactor = clamp(1.0 / exp(fog.density * distance), 0.0, 1.0);
+		} else if (fog.mode == 2) {
+			// Foggy Effect EXP2
+			fogFactor = clamp(1.0 / exp(fog.density * distance * distance), 0.0, 1.0);
+		}
+		FinalColor = mix(fog.color, PreColor, fogFactor);
+	} else {
+		// Close Foggy Effect
+		FinalColor = PreColor;
+	}
+
+#ifdef GAMMA
+	FinalColor = vec4(pow(FinalColor.xyz, vec3(GammaValue)), FinalColor.w);
+#endif
+
+	FragColor = FinalColor;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#version 330 core
+layout(location = 0) in vec3 aPosition;
+// Per instance, see ImpostorInstance in Headers/impostor.h
+layout(location = 1) in vec3 instancePosition;
+layout(location = 2) in vec3 instanceAxis;
+
+out vec2 TexCoords;
+out vec3 FragPos;
+flat out float Frame;
+
+// IMPOSTOR_FRAMES in Headers/impostor.h
+#define IMPOSTOR_FRAMES 16.0
+#define PI 3.14159265
+
+// Half the side of the quad, the radius the atlas was baked with
+uniform float radius;
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+void main() {
+	// The baked view is picked by the angle between the axis and the direction to the camera
+	vec3 toCamera = normalize(viewPos - instancePosition);
+	float cosAngle = clamp(dot(instanceAxis, toCamera), -1.0, 1.0);
+	Frame = clamp(floor(acos(cosAngle) / PI * IMPOSTOR_FRAMES), 0.0, IMPOSTOR_FRAMES - 1.0);
+
+	// The quad faces the camera and is rolled so the axis points up it, as it did when baked.
+	// Looking straight along the axis there is no roll to match, any up vector will do
+	vec3 up = instanceAxis - toCamera * cosAngle;
+	if (dot(up, up) < 1e-6) {
+		up = vec3(view[0][1], view[1][1], view[2][1]);
+	}
+	up = normalize(up);
+	vec3 right = normalize(cross(up, toCamera));
+
+	FragPos = instancePosition + (aPosition.x - 0.5) * 2.0 * radius * right + (aPosition.y - 0.5) * 2.0 * radius * up;
+	TexCoords = aPosition.xy;
+	gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal;
+
+uniform vec4 ambient;
+uniform vec4 diffuse;
+
+void main() {
+	// A fixed light over the viewer's shoulder, the same for every view so the frames blend into each other
+	vec3 lightDir = normalize(vec3(0.3, 0.6, 1.0));
+	float diff = max(dot(normalize(Normal), lightDir), 0.0);
+	FragColor = vec4(ambient.rgb + diff * diffuse.rgb, 1.0);
+}
\ No newline at end of file
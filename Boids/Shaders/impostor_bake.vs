@@ -0,0 +1,14 @@
+#version 330 core
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+
+out vec3 Normal;
+
+// Set by ImpostorRenderer::bake() in Headers/impostor.h, one rotation per view
+uniform mat4 model;
+uniform mat4 viewProjection;
+
+void main() {
+	Normal = mat3(model) * aNormal;
+	gl_Position = viewProjection * model * vec4(aPosition, 1.0);
+}
\ No newline at end of file
@@ -5,29 +5,22 @@ layout (location = 2) in vec2 aTextureCoords;
 layout (location = 3) in mat4 instanceMatrix;
 
 out VS_OUT {
-	vec3 NaviePos;
 	vec3 FragPos;
 	vec3 Normal;
 	vec2 TexCoords;
 } vs_out;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform bool isCubeMap;
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
 
 void main() {
-	vs_out.NaviePos = aPosition;
 	vs_out.FragPos =  vec3(instanceMatrix * vec4(aPosition, 1.0));
 	vs_out.Normal = mat3(transpose(inverse(instanceMatrix))) * aNormal;
 	vs_out.TexCoords = aTextureCoords;
 
-	if (isCubeMap) {
-		// øsѪŲ
-		mat4 view_new = mat4(mat3(view));
-		vec4 pos = projection * view_new * vec4(vs_out.FragPos, 1.0);
-		gl_Position = pos.xyww;
-	} else {
-		gl_Position = projection * view * vec4(vs_out.FragPos, 1.0);
-	}
+	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0);
 }
\ No newline at end of file
@@ -8,14 +8,13 @@ struct Material {
 	vec4 emission;
 	float shininess;
 
+#ifdef TEXTURE_ARRAY
+	sampler2DArray diffuse_texture;
+#else
 	sampler2D diffuse_texture;
+#endif
 	sampler2D specular_texture;
 	sampler2D emission_texture;
-
-	bool enableColorTexture;
-    bool enableSpecularTexture;
-	bool enableEmission;
-    bool enableEmissionTexture;
 };
 
 struct Light {
@@ -48,32 +47,83 @@ struct Fog {
 	vec4 color;
 };
 
-// 0 Direction Light; 1 ~ 4 Point Light; 5 Spot Light;
-#define NUM_LIGHTS 6
+// Shared blocks written once per frame, laid out std140 to match Headers/uniformbuffer.h
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+// The directional light, and the froxel grid the point and spot lights are binned into (Headers/clusteredlights.h)
+layout (std140) uniform LightsBlock {
+	Light sun;
+	ivec4 clusterSize;
+	vec4 clusterDepth;
+	vec4 clusterScreen;
+};
+
+layout (std140) uniform FogBlock {
+	Fog fog;
+};
 
 in VS_OUT {
-	vec3 NaviePos;
 	vec3 FragPos;
 	vec3 Normal;
 	vec2 TexCoords;
+#ifdef TEXTURE_ARRAY
+	flat float Layer;
+#endif
 } fs_in;
 
-uniform vec3 viewPos;
-uniform bool useBlinnPhong;
-uniform bool useSpotExponent;
-uniform bool useLighting;
-uniform bool useDiffuseTexture;
-uniform bool useSpecularTexture;
-uniform bool useEmission;
-uniform bool useGamma;
+// Feature switches are #defined per variant by ShaderVariants (Headers/shadervariants.h):
+// LIGHTING, BLINN_PHONG, SPOT_EXPONENT, DIFFUSE_TEXTURE, SPECULAR_TEXTURE, EMISSION, EMISSION_TEXTURE, GAMMA,
+// TEXTURE_ARRAY (the diffuse texture is an array indexed by the Layer the vertex shader passes, Shaders/billboard.vs)
 uniform float GammaValue;
 
-uniform bool isCubeMap;
-uniform samplerCube skybox;
-
 uniform Material material;
-uniform Light lights[NUM_LIGHTS];
-uniform Fog fog;
+
+// Point and spot lights of the frame, CLUSTER_LIGHT_TEXELS vec4s each, an (offset, count) pair per cluster
+// and the light indices those pairs point into. Bound to fixed units by Shader::bindSharedSamplers().
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+
+// Unpack a light as Headers/clusteredlights.h packLight() lays it out; range is where it fades out
+Light fetchLight(int index, out float range) {
+	int base = index * 6;
+	vec4 positionRange = texelFetch(clusterLights, base);
+	vec4 directionCaster = texelFetch(clusterLights, base + 1);
+	vec4 ambientConstant = texelFetch(clusterLights, base + 2);
+	vec4 diffuseLinear = texelFetch(clusterLights, base + 3);
+	vec4 specularQuadratic = texelFetch(clusterLights, base + 4);
+	vec4 cone = texelFetch(clusterLights, base + 5);
+
+	Light light;
+	light.position = positionRange.xyz;
+	light.direction = directionCaster.xyz;
+	light.ambient = ambientConstant.rgb;
+	light.diffuse = diffuseLinear.rgb;
+	light.specular = specularQuadratic.rgb;
+	light.constant = ambientConstant.w;
+	light.linear = diffuseLinear.w;
+	light.quadratic = specularQuadratic.w;
+	light.cutoff = cone.x;
+	light.outerCutoff = cone.y;
+	light.exponent = cone.z;
+	light.enable = true;
+	light.caster = int(directionCaster.w);
+	range = positionRange.w;
+	return light;
+}
+
+// Screen tile from the fragment position, depth slice from its view depth on the same log scale the CPU bins with
+int clusterIndex() {
+	ivec2 tile = ivec2(gl_FragCoord.xy * clusterScreen.xy * vec2(clusterSize.xy));
+	float depth = max(-(view * vec4(fs_in.FragPos, 1.0)).z, clusterDepth.x);
+	int slice = int(log(depth) * clusterDepth.y + clusterDepth.z);
+	ivec3 cell = clamp(ivec3(tile, slice), ivec3(0), clusterSize.xyz - 1);
+	return (cell.z * clusterSize.y + cell.y) * clusterSize.x + cell.x;
+}
 
 vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4 texel_diffuse, vec4 texel_specular) {
 
@@ -91,60 +141,40 @@ vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4
 
 	float diff = max(dot(normal, lightDir), 0.0);
 
-	float spec = 0.0;
-	if (useBlinnPhong) {
-		vec3 halfway = normalize(lightDir + viewDir);
-		spec = pow(max(dot(normal, halfway), 0.0), material.shininess);
-	} else {
-		vec3 reflectDir = reflect(-lightDir, normal);
-		spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	}
+#ifdef BLINN_PHONG
+	vec3 halfway = normalize(lightDir + viewDir);
+	float spec = pow(max(dot(normal, halfway), 0.0), material.shininess);
+#else
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#endif
 
 	ambient = light.ambient * texel_ambient.rgb;
 	diffuse = light.diffuse * diff * texel_diffuse.rgb;
 	specular = light.specular * spec * texel_specular.rgb;
 
-	if (light.caster == 0) {
-		// Direction Light
-		if (isCubeMap) {
-			ambient = light.diffuse * texel_ambient.rgb;
-			diffuse = light.diffuse * texel_diffuse.rgb;
-			specular *= 0.0f;
-		}
-	} else {
+	if (light.caster != 0) {
 		// Point Light or Spot Light
-		if (isCubeMap) {
-			ambient *= 0.0f;
-			diffuse *= 0.0f;
-			specular *= 0.0f;
-		} else {
-			float distance = length(light.position - fs_in.FragPos);
-			float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-
-			ambient *= attenuation;
-			diffuse *= attenuation;
-			specular *= attenuation;
-
-			if (light.caster == 2) {
-				// Spot Light
-				float intensity = 0.0f;
-				if (useSpotExponent) {
-					float theta = dot(lightDir, normalize(-light.direction));
-					if (theta >= light.cutoff) {
-						intensity = clamp(pow(theta, light.exponent), 0.0, 1.0);
-					} else {
-						intensity = 0.0f;
-					}
-				} else {
-					float theta = dot(lightDir, normalize(-light.direction));
-					float epsilon = light.cutoff - light.outerCutoff;
-					intensity = clamp((theta - light.outerCutoff) / epsilon, 0.0, 1.0);
-				}
-
-				ambient *= intensity;
-				diffuse *= intensity;
-				specular *= intensity;
-			}
+		float distance = length(light.position - fs_in.FragPos);
+		float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+		ambient *= attenuation;
+		diffuse *= attenuation;
+		specular *= attenuation;
+
+		if (light.caster == 2) {
+			// Spot Light
+			float theta = dot(lightDir, normalize(-light.direction));
+#ifdef SPOT_EXPONENT
+			float intensity = theta >= light.cutoff ? clamp(pow(theta, light.exponent), 0.0, 1.0) : 0.0;
+#else
+			float epsilon = light.cutoff - light.outerCutoff;
+			float intensity = clamp((theta - light.outerCutoff) / epsilon, 0.0, 1.0);
+#endif
+
+			ambient *= intensity;
+			diffuse *= intensity;
+			specular *= intensity;
 		}
 	}
 
@@ -155,106 +185,102 @@ void main() {
 	vec3 norm = normalize(fs_in.Normal);
 	vec3 viewDir = normalize(viewPos - fs_in.FragPos);
 
-	vec4 texel_ambient = vec4(0.0);
-	vec4 texel_diffuse = vec4(0.0);
-	vec4 texel_specular = vec4(0.0);
-	if (isCubeMap) {
-		// ĥ cubemap
-		texel_ambient = texture(skybox, normalize(fs_in.NaviePos));
-		texel_diffuse = texture(skybox, normalize(fs_in.NaviePos));
-		texel_specular = texture(skybox, normalize(fs_in.NaviePos));
-	} else if (useDiffuseTexture && material.enableColorTexture) {
-		// pG}ܧ B Ӫ馳KϮ => Ϥ
-		texel_ambient = texture(material.diffuse_texture, fs_in.TexCoords);
-		texel_diffuse = texture(material.diffuse_texture, fs_in.TexCoords);
-		if (useSpecularTexture && material.enableSpecularTexture) {
-			texel_specular = texture(material.specular_texture, fs_in.TexCoords);
-		} else {
-			texel_specular = texture(material.diffuse_texture, fs_in.TexCoords);
-		}
-	} else {
-		// ¦
-		texel_ambient = material.ambient;
-		texel_diffuse = material.diffuse;
-		if (useSpecularTexture && material.enableSpecularTexture) {
-			texel_specular = texture(material.specular_texture, fs_in.TexCoords);
-		} else {
-			texel_specular = material.specular;
-		}
-	}
+#ifdef DIFFUSE_TEXTURE
+	// pG}ܧ B Ӫ馳KϮ => Ϥ
+#ifdef TEXTURE_ARRAY
+	vec4 texel_ambient = texture(material.diffuse_texture, vec3(fs_in.TexCoords, fs_in.Layer));
+#else
+	vec4 texel_ambient = texture(material.diffuse_texture, fs_in.TexCoords);
+#endif
+	vec4 texel_diffuse = texel_ambient;
+#else
+	// ¦
+	vec4 texel_ambient = material.ambient;
+	vec4 texel_diffuse = material.diffuse;
+#endif
+#if defined(SPECULAR_TEXTURE)
+	vec4 texel_specular = texture(material.specular_texture, fs_in.TexCoords);
+#elif defined(DIFFUSE_TEXTURE)
+	vec4 texel_specular = texel_diffuse;
+#else
+	vec4 texel_specular = material.specular;
+#endif
 
 	// O_}ҥ
-	if (!useLighting) {
-		// hz
-		if (texel_diffuse.a < 0.1) {
-			discard;
-		}
+#ifndef LIGHTING
+	// hz
+	if (texel_diffuse.a < 0.1) {
+		discard;
+	}
 
-		FragColor = texel_diffuse;
-	} else {
-		// p
-		vec3 illumination = vec3(0.0);
-
-		for (int i = 0; i < NUM_LIGHTS; i++) {
-			if (!lights[i].enable) {
-				continue;
-			}
-			illumination += CalcLight(lights[i], norm, viewDir, texel_ambient, texel_diffuse, texel_specular);
-		}
+	FragColor = texel_diffuse;
+#else
+	// p
+	vec3 illumination = vec3(0.0);
 
-		// }Ҧ۵o
-		if (useEmission && material.enableEmission) {
-			// }Ҧ۵oﶵ B Ӫ馳}Ҧ۵o
-			if (material.enableEmissionTexture) {
-				// ϥΦ۵o
-				illumination += texture(material.emission_texture, fs_in.TexCoords).rgb;
-			} else {
-				// ϥΦ۵oC
-				illumination += texel_diffuse.rgb * 1.5;
-			}
-		}
+	if (sun.enable) {
+		illumination += CalcLight(sun, norm, viewDir, texel_ambient, texel_diffuse, texel_specular);
+	}
 
-		// hz
-		if (texel_diffuse.a < 0.1) {
-			discard;
-		}
+	// Only the lights binned into this fragment's cluster, each faded out smoothly at the end of its range
+	uvec2 cluster = texelFetch(clusterGrid, clusterIndex()).xy;
+	for (uint i = 0u; i < cluster.y; i++) {
+		float range;
+		Light light = fetchLight(int(texelFetch(clusterIndices, int(cluster.x + i)).r), range);
+		float falloff = clamp(1.0 - pow(length(light.position - fs_in.FragPos) / range, 4.0), 0.0, 1.0);
+		illumination += falloff * falloff * CalcLight(light, norm, viewDir, texel_ambient, texel_diffuse, texel_specular);
+	}
 
-		// Foggy Effect
-		vec4 PreColor = vec4(clamp(illumination, 0.0, 1.0), texel_diffuse.a);
-		vec4 FinalColor = vec4(0.0);
-		float distance = 0.0;
-		float fogFactor = 0.0;
-
-		if (fog.depthType == 0) {
-			// Plane Based
-			distance = abs((viewPos - fs_in.FragPos).z);
-		} else {
-			// Range Based
-			distance = length(viewPos - fs_in.FragPos);
-		}
+	// }Ҧ۵o
+#if defined(EMISSION) && defined(EMISSION_TEXTURE)
+	// ϥΦ۵o
+	illumination += texture(material.emission_texture, fs_in.TexCoords).rgb;
+#elif defined(EMISSION)
+	// ϥΦ۵oC
+	illumination += texel_diffuse.rgb * 1.5;
+#endif
+
+	// hz
+	if (texel_diffuse.a < 0.1) {
+		discard;
+	}
 
-		if (fog.enable) {
-			if (fog.mode == 0) {
-			// Foggy Effect Linear
-			fogFactor = clamp((fog.f_end - distance) / (fog.f_end - fog.f_start), 0.0, 1.0);
-			} else if (fog.mode == 1) {
-				// Foggy Effect EXP
-				fogFactor = clamp(1.0 / exp(fog.density * distance), 0.0, 1.0);
-			} else if (fog.mode == 2) {
-				// Foggy Effect EXP2
-				fogFactor = clamp(1.0 / exp(fog.density * distance * distance), 0.0, 1.0);
-			}
-			FinalColor = mix(fog.color, PreColor, fogFactor);
-		} else {
-			// Close Foggy Effect
-			FinalColor = PreColor;
-		}
+	// Foggy Effect
+	vec4 PreColor = vec4(clamp(illumination, 0.0, 1.0), texel_diffuse.a);
+	vec4 FinalColor = vec4(0.0);
+	float distance = 0.0;
+	float fogFactor = 0.0;
 
-		// {ե
-		if (useGamma) {
-			FinalColor = vec4(pow(FinalColor.xyz, vec3(GammaValue)), FinalColor.w);
-		}
+	if (fog.depthType == 0) {
+		// Plane Based
+		distance = abs((viewPos - fs_in.FragPos).z);
+	} else {
+		// Range Based
+		distance = length(viewPos - fs_in.FragPos);
+	}
 
-		FragColor = FinalColor;
+	if (fog.enable) {
+		if (fog.mode == 0) {
+		// Foggy Effect Linear
+		fogFactor = clamp((fog.f_end - distance) / (fog.f_end - fog.f_start), 0.0, 1.0);
+		} else if (fog.mode == 1) {
+			// Foggy Effect EXP
+			fogFactor = clamp(1.0 / exp(fog.density * distance), 0.0, 1.0);
+		} else if (fog.mode == 2) {
+			// Foggy Effect EXP2
+			fogFactor = clamp(1.0 / exp(fog.density * distance * distance), 0.0, 1.0);
+		}
+		FinalColor = mix(fog.color, PreColor, fogFactor);
+	} else {
+		// Close Foggy Effect
+		FinalColor = PreColor;
 	}
+
+	// {ե
+#ifdef GAMMA
+	FinalColor = vec4(pow(FinalColor.xyz, vec3(GammaValue)), FinalColor.w);
+#endif
+
+	FragColor = FinalColor;
+#endif
 }
\ No newline at end of file
@@ -8,8 +8,11 @@ out VS_OUT {
 } vs_out;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
 
 void main() {
 	mat4 normalMatrix = mat4(transpose(inverse(view * model)));
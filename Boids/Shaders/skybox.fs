@@ -0,0 +1,111 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Light {
+	vec3 position;
+	vec3 direction;
+	
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	float cutoff;
+	float outerCutoff;
+	float exponent;
+
+	bool enable;
+	int caster;
+};
+
+struct Fog {
+	int mode;
+	int depthType;
+	float density;
+	float f_start;
+	float f_end;
+	bool enable;
+	vec4 color;
+};
+
+// Shared blocks written once per frame, laid out std140 to match Headers/uniformbuffer.h
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+// The directional light, and the froxel grid the point and spot lights are binned into (Headers/clusteredlights.h)
+layout (std140) uniform LightsBlock {
+	Light sun;
+	ivec4 clusterSize;
+	vec4 clusterDepth;
+	vec4 clusterScreen;
+};
+
+layout (std140) uniform FogBlock {
+	Fog fog;
+};
+
+in vec3 TexDir;
+in vec3 FragPos;
+
+// Only LIGHTING and GAMMA of the ShaderVariants features apply to the sky
+uniform float GammaValue;
+uniform samplerCube skybox;
+
+void main() {
+	// ĥ cubemap
+	vec4 texel = texture(skybox, normalize(TexDir));
+
+#ifndef LIGHTING
+	FragColor = texel;
+#else
+	// The directional light tints the sky through its diffuse color (as ambient and diffuse), without shading
+	vec3 illumination = vec3(0.0);
+	if (sun.enable) {
+		illumination += 2.0 * sun.diffuse * texel.rgb;
+	}
+
+	// Foggy Effect
+	vec4 PreColor = vec4(clamp(illumination, 0.0, 1.0), texel.a);
+	vec4 FinalColor = vec4(0.0);
+	float distance = 0.0;
+	float fogFactor = 0.0;
+
+	if (fog.depthType == 0) {
+		// Plane Based
+		distance = abs((viewPos - FragPos).z);
+	} else {
+		// Range Based
+		distance = length(viewPos - FragPos);
+	}
+
+	if (fog.enable) {
+		if (fog.mode == 0) {
+		// Foggy Effect Linear
+		fogFactor = clamp((fog.f_end - distance) / (fog.f_end - fog.f_start), 0.0, 1.0);
+		} else if (fog.mode == 1) {
+			// Foggy Effect EXP
+			fogFactor = clamp(1.0 / exp(fog.density * distance), 0.0, 1.0);
+		} else if (fog.mode == 2) {
+			// Foggy Effect EXP2
+			fogFactor = clamp(1.0 / exp(fog.density * distance * distance), 0.0, 1.0);
+		}
+		FinalColor = mix(fog.color, PreColor, fogFactor);
+	} else {
+		// Close Foggy Effect
+		FinalColor = PreColor;
+	}
+
+	// {ե
+#ifdef GAMMA
+	FinalColor = vec4(pow(FinalColor.xyz, vec3(GammaValue)), FinalColor.w);
+#endif
+
+	FragColor = FinalColor;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 330 core
+layout(location = 0) in vec3 aPosition;
+
+out vec3 TexDir;
+out vec3 FragPos;
+
+uniform mat4 model;
+layout (std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+void main() {
+	TexDir = aPosition;
+	FragPos = vec3(model * vec4(aPosition, 1.0));
+
+	// øsѪŲ
+	// Without the translation the box stays around the camera, and z = w puts it on the far plane
+	vec4 pos = projection * mat4(mat3(view)) * vec4(FragPos, 1.0);
+	gl_Position = pos.xyww;
+}
\ No newline at end of file
@@ -0,0 +1,281 @@
+#ifndef BOIDS_NO_PROFILE
+
+#include "../Headers/alloctracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <dbghelp.h>
+#pragma comment(lib, "dbghelp.lib")
+#else
+#include <execinfo.h>
+#endif
+
+// The hook frames are skipped by count, so they must not be inlined into each other.
+#ifdef _MSC_VER
+#define ALLOC_NOINLINE __declspec(noinline)
+#else
+#define ALLOC_NOINLINE __attribute__((noinline))
+#endif
+
+namespace alloctracker {
+	namespace {
+		std::atomic<uint64_t> GlobalAllocations(0);
+		std::atomic<uint64_t> GlobalFrees(0);
+		std::atomic<uint64_t> GlobalBytes(0);
+		thread_local Counts ThreadCounts = { 0, 0, 0 };
+
+		// Set while a stack is being captured, so allocations made by the unwinder aren't sampled recursively.
+		thread_local bool InSample = false;
+		std::atomic<unsigned int> SamplePeriod(0);
+		std::atomic<uint64_t> SampleTicket(0);
+
+		// Open-addressing table keyed by the hash of the captured frames.
+		CallSite CallSites[MAX_CALL_SITES];
+		std::atomic_flag CallSiteLock = ATOMIC_FLAG_INIT;
+
+		// Frames belonging to the hook itself (captureStack, sampleCallSite, recordAllocation, operator new).
+		const unsigned int SKIP_FRAMES = 4;
+
+		ALLOC_NOINLINE unsigned int captureStack(void** frames) {
+#ifdef _WIN32
+			return CaptureStackBackTrace(SKIP_FRAMES, MAX_STACK_DEPTH, frames, NULL);
+#else
+			void* raw[MAX_STACK_DEPTH + SKIP_FRAMES];
+			int depth = backtrace(raw, MAX_STACK_DEPTH + SKIP_FRAMES);
+			if (depth <= (int)SKIP_FRAMES) {
+				return 0;
+			}
+			std::memcpy(frames, raw + SKIP_FRAMES, (depth - SKIP_FRAMES) * sizeof(void*));
+			return depth - SKIP_FRAMES;
+#endif
+		}
+
+		ALLOC_NOINLINE void sampleCallSite(size_t size) {
+			void* frames[MAX_STACK_DEPTH];
+			unsigned int depth = captureStack(frames);
+			if (depth == 0) {
+				return;
+			}
+
+			uint64_t hash = 14695981039346656037ull;
+			for (unsigned int i = 0; i < depth; i++) {
+				hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+			}
+
+			while (CallSiteLock.test_and_set(std::memory_order_acquire)) {
+			}
+			for (unsigned int probe = 0; probe < MAX_CALL_SITES; probe++) {
+				CallSite& site = CallSites[(hash + probe) % MAX_CALL_SITES];
+				if (site.Depth == 0) {
+					std::memcpy(site.Frames, frames, depth * sizeof(void*));
+					site.Depth = depth;
+				} else if (site.Depth != depth || std::memcmp(site.Frames, frames, depth * sizeof(void*)) != 0) {
+					continue;
+				}
+				site.Allocations++;
+				site.Bytes += size;
+				break;
+			}
+			CallSiteLock.clear(std::memory_order_release);
+		}
+	}
+
+	ALLOC_NOINLINE void recordAllocation(size_t size) {
+		ThreadCounts.Allocations++;
+		ThreadCounts.Bytes += size;
+		GlobalAllocations.fetch_add(1, std::memory_order_relaxed);
+		GlobalBytes.fetch_add(size, std::memory_order_relaxed);
+
+		unsigned int period = SamplePeriod.load(std::memory_order_relaxed);
+		if (period != 0 && !InSample && SampleTicket.fetch_add(1, std::memory_order_relaxed) % period == 0) {
+			InSample = true;
+			sampleCallSite(size);
+			InSample = false;
+		}
+	}
+
+	void recordFree() {
+		ThreadCounts.Frees++;
+		GlobalFrees.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Counts getGlobalCounts() {
+		Counts counts;
+		counts.Allocations = GlobalAllocations.load(std::memory_order_relaxed);
+		counts.Frees = GlobalFrees.load(std::memory_order_relaxed);
+		counts.Bytes = GlobalBytes.load(std::memory_order_relaxed);
+		return counts;
+	}
+
+	Counts getThreadCounts() {
+		return ThreadCounts;
+	}
+
+	void setSamplePeriod(unsigned int period) {
+		SamplePeriod.store(period, std::memory_order_relaxed);
+	}
+
+	unsigned int getSamplePeriod() {
+		return SamplePeriod.load(std::memory_order_relaxed);
+	}
+
+	unsigned int getTopCallSites(CallSite* out, unsigned int maxCount) {
+		unsigned int count = 0;
+		while (CallSiteLock.test_and_set(std::memory_order_acquire)) {
+		}
+		for (unsigned int i = 0; i < MAX_CALL_SITES; i++) {
+			if (CallSites[i].Depth == 0) {
+				continue;
+			}
+			// Insertion into the sorted output, dropping the lightest once it is full
+			unsigned int position = count;
+			while (position > 0 && out[position - 1].Allocations < CallSites[i].Allocations) {
+				if (position < maxCount) {
+					out[position] = out[position - 1];
+				}
+				position--;
+			}
+			if (position < maxCount) {
+				out[position] = CallSites[i];
+				count = std::min(count + 1, maxCount);
+			}
+		}
+		CallSiteLock.clear(std::memory_order_release);
+		return count;
+	}
+
+	void clearCallSites() {
+		while (CallSiteLock.test_and_set(std::memory_order_acquire)) {
+		}
+		std::memset(CallSites, 0, sizeof(CallSites));
+		CallSiteLock.clear(std::memory_order_release);
+	}
+
+	std::string describeFrame(void* address) {
+		char text[512];
+#ifdef _WIN32
+		static bool initialized = false;
+		HANDLE process = GetCurrentProcess();
+		if (!initialized) {
+			SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+			SymInitialize(process, NULL, TRUE);
+			initialized = true;
+		}
+
+		char buffer[sizeof(SYMBOL_INFO) + 256];
+		SYMBOL_INFO* symbol = (SYMBOL_INFO*)buffer;
+		std::memset(buffer, 0, sizeof(buffer));
+		symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+		symbol->MaxNameLen = 255;
+
+		DWORD64 displacement = 0;
+		if (SymFromAddr(process, (DWORD64)address, &displacement, symbol)) {
+			IMAGEHLP_LINE64 line;
+			DWORD lineDisplacement = 0;
+			line.SizeOfStruct = sizeof(line);
+			if (SymGetLineFromAddr64(process, (DWORD64)address, &lineDisplacement, &line)) {
+				std::snprintf(text, sizeof(text), "%s (%s:%lu)", symbol->Name, line.FileName, line.LineNumber);
+			} else {
+				std::snprintf(text, sizeof(text), "%s+0x%llx", symbol->Name, (unsigned long long)displacement);
+			}
+			return text;
+		}
+#else
+		char** symbols = backtrace_symbols(&address, 1);
+		if (symbols != NULL) {
+			std::string result = symbols[0];
+			std::free(symbols);
+			return result;
+		}
+#endif
+		std::snprintf(text, sizeof(text), "%p", address);
+		return text;
+	}
+}
+
+void* operator new(std::size_t size) {
+	void* pointer = std::malloc(size == 0 ? 1 : size);
+	if (pointer == nullptr) {
+		throw std::bad_alloc();
+	}
+	alloctracker::recordAllocation(size);
+	return pointer;
+}
+
+void* operator new[](std::size_t size) {
+	void* pointer = std::malloc(size == 0 ? 1 : size);
+	if (pointer == nullptr) {
+		throw std::bad_alloc();
+	}
+	alloctracker::recordAllocation(size);
+	return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	void* pointer = std::malloc(size == 0 ? 1 : size);
+	if (pointer != nullptr) {
+		alloctracker::recordAllocation(size);
+	}
+	return pointer;
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	void* pointer = std::malloc(size == 0 ? 1 : size);
+	if (pointer != nullptr) {
+		alloctracker::recordAllocation(size);
+	}
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+void operator delete[](void* pointer) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+	if (pointer != nullptr) {
+		alloctracker::recordFree();
+		std::free(pointer);
+	}
+}
+
+#endif // !BOIDS_NO_PROFILE
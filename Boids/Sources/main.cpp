@@ -2,7 +2,6 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include "../Headers/stb_image.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -15,36 +14,95 @@
 #include "../Headers/logging.h"
 #include "../Headers/mstack.h"
 #include "../Headers/shader.h"
+#include "../Headers/shadervariants.h"
+#include "../Headers/programcache.h"
 #include "../Headers/camera.h"
+#include "../Headers/spatialgrid.h"
 #include "../Headers/light.h"
+#include "../Headers/clusteredlights.h"
 #include "../Headers/fog.h"
+#include "../Headers/uniformbuffer.h"
 #include "../Headers/cylinder.h"
+#include "../Headers/billboard.h"
+#include "../Headers/impostor.h"
+#include "../Headers/renderqueue.h"
 #include "../Headers/boid.h"
+#include "../Headers/profiler.h"
+#include "../Headers/frametime.h"
+#include "../Headers/arena.h"
+#include "../Headers/threadpool.h"
+#include "../Headers/assets.h"
+#include "../Headers/headless.h"
+#include "../Headers/framecapture.h"
+#include "../Headers/dynamicresolution.h"
+#include "../Headers/qualitygovernor.h"
+#include "../Headers/framepacing.h"
+#include "../Headers/depthsort.h"
 
 #include <vector>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <cmath>
+#include <cstdlib>
 #include <ctime>
 #include <random>
 
-void shaderSetting(Shader shader);
+struct SceneUniforms;
+struct SkyboxUniforms;
+struct ImpostorUniforms;
+struct RecordContext;
+typedef ShaderVariants<SceneUniforms> LightingVariants;
+void shaderSetting(Shader& shader, const SceneUniforms& uniforms);
+SceneUniforms resolveSceneUniforms(const Shader& shader);
+SkyboxUniforms resolveSkyboxUniforms(const Shader& shader);
+ImpostorUniforms resolveImpostorUniforms(const Shader& shader);
+unsigned int sceneFeatures();
+LightingVariants::Variant& lightingVariant(LightingVariants& variants, unsigned int materialFeatures);
+Shader& useLightingVariant(LightingVariants& variants, unsigned int materialFeatures);
+RenderCommand lightingCommand(LightingVariants::Variant& variant, const glm::mat4& model, float depth);
+void setMaterial(RenderCommand& command, const SceneUniforms& uniforms, glm::vec4 ambient, glm::vec4 diffuse, glm::vec4 specular, float shininess);
+void updateUniformBuffers();
+LightStd140 toStd140(const Light& light);
+void updateBoids();
+void updateLightClusters();
+RecordContext prepareRecording(LightingVariants& lighting, LightingVariants& instance, LightingVariants& billboard, ShaderVariants<ImpostorUniforms>& impostor, ShaderVariants<SkyboxUniforms>& sky);
+void recordFrame(const RecordContext& context, ArenaVector<glm::mat4>& matrices, ArenaVector<BillboardInstance>& sprites, ArenaVector<ImpostorInstance>& impostors);
+void recordScene(const RecordContext& context, unsigned int thread);
 void showUI();
 void setViewMatrix();
 void setProjectionMatrix();
 void setViewport();
+void beginScene();
+void presentScene();
+void applyQuality();
+void applyVsync();
+void sampleInput();
 void geneObejectData();
 void geneSphereData();
 void drawFloor();
 void drawCube();
-void drawPlane(Shader shader, glm::vec3 position, float size_w, float size_h, int method);
-void drawFish(Shader shader, glm::vec3 position, float size);
-void drawGrass(Shader shader, glm::vec3 position, float size);
-void drawBox(Shader shader);
-void drawAxis(Shader shader);
+void queueFish(LightingVariants& variants);
+void queueGrass(const RecordContext& context, unsigned int thread);
+void queueBoidSprites(const RecordContext& context, unsigned int thread, unsigned int count);
+void queueImpostors(const RecordContext& context, unsigned int thread, unsigned int count);
+void queueBox(LightingVariants& variants);
+void queueAxis(const RecordContext& context, unsigned int thread);
+void queueLights(const RecordContext& context, unsigned int thread);
+void queueSky(const RecordContext& context, unsigned int thread);
 void updateROVFront();
 void drawSphere();
-void drawCone();
+float boidCullRadius();
+float coneRadius();
+void cullBoids(ArenaVector<unsigned int>& visible);
+void classifyBoids(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, unsigned int* counts);
+void scatterBoids(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, unsigned int* next, ArenaVector<glm::mat4>& matrices, ArenaVector<ImpostorInstance>& impostors);
+void packSprites(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, ArenaVector<BillboardInstance>& sprites);
+unsigned int selectConeLod(unsigned int current, float pixels);
+void queueCone(const RecordContext& context, unsigned int thread);
+void pointConeInstances(const RenderCommand& command);
 void setFullScreen();
 void frameBufferSizeCallback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
@@ -53,8 +111,16 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void scrollCallback(GLFWwindow* window, double xpos, double ypos);
 void errorCallback(int error, const char* description);
-unsigned int loadTexture(char const* path);
-unsigned int loadCubemap(std::vector<std::string> faces);
+void dumpTrace();
+void reportTimeToFirstFrame();
+bool parseArguments(int argc, char** argv);
+bool parseSwitch(const std::string& option, const std::string& value, bool& target);
+bool shouldClose();
+float appTime();
+#ifndef BOIDS_NO_PROFILE
+void checkSteadyStateAllocations();
+void captureAllocationReport();
+#endif
 glm::mat4 GetPerspectiveProjMatrix(float fovy, float ascept, float znear, float zfar);
 glm::mat4 GetOrthoProjMatrix(float left, float right, float bottom, float top, float near, float far);
 
@@ -69,6 +135,42 @@ unsigned int SCR_HEIGHT = 600;
 std::vector <int> window_position{ 0, 0 };
 std::vector <int> window_size{ 0, 0 };
 
+// Headless runs (--headless) draw into an offscreen framebuffer with a fixed time step, so every run sees the same flock.
+// --frames ends the run after that many frames and writes the per-frame timings to BENCHMARK_PATH.
+bool headless = false;
+HeadlessContext headlessContext;
+const float HEADLESS_TIME_STEP = 1.0f / 60.0f;
+const unsigned int HEADLESS_DEFAULT_FRAMES = 600;
+unsigned int frameLimit = 0;
+unsigned int framesDrawn = 0;
+const std::string BENCHMARK_PATH = "boids_frames.csv";
+BenchmarkLog benchmarkLog;
+
+// Scene frames (without the UI) streamed to a file, from --capture or the Frame Time tab
+FrameCapture frameCapture;
+const std::string CAPTURE_PATH = "boids_capture.y4m";
+std::string capturePath;
+
+// The scene is drawn into an offscreen target at a scale of the window and upscaled onto it, with the scale following
+// the frame time (Frame Time tab). MSAA belongs to that target, --msaa sets the samples.
+SceneTarget sceneTarget;
+ResolutionController resolution;
+GpuTimer sceneTimer;
+unsigned int msaaSamples = 4;
+unsigned int renderWidth = SCR_WIDTH;
+unsigned int renderHeight = SCR_HEIGHT;
+// Time the last frame spent up to its swap, i.e. without waiting on vsync
+float cpuMilliseconds = 0.0f;
+
+// Frame pacing (--vsync, --fps-cap, Frame Time tab). With late input the events are polled after the simulation,
+// right before the view matrix is built, so the camera sees the newest input whatever the flock costs.
+// --latency measures from that poll to the swap of the frame.
+Vsync_Mode vsyncMode = VSYNC_ON;
+FrameLimiter frameLimiter;
+bool lateInput = true;
+LatencyMeter inputLatency;
+std::chrono::steady_clock::time_point inputTime;
+
 // Matrix stack paramters
 StackArray modelMatrix;
 
@@ -111,6 +213,68 @@ std::vector<Light> pointLights = {
 std::vector<Light> spotLights = {
 	Light(camera.Position, camera.Front, true),
 };
+
+// Point and spot lights are binned into view-space clusters every frame, so each fragment only shades the few that reach it.
+// sceneLights is gathered from the lights above, one small light riding on every lead boid, and a field of scattered ones.
+// It never grows past MAX_CLUSTER_LIGHTS, the capacity reserved for it.
+LightClusters lightClusters;
+std::vector<Light> sceneLights;
+std::vector<Light> scatteredLights;
+const unsigned int MAX_SCATTERED_LIGHTS = 960;
+// Every stride-th boid leads, the stride chosen so the leads fit in this and in the room the other lights leave
+const unsigned int MAX_BOID_LIGHTS = 256;
+static bool enableBoidLights = false;
+unsigned int boidLightCount = 0;
+static int scatteredLightCount = 0;
+
+// Handles of the uniforms shaderSetting() and the render commands write every frame, resolved once per program variant.
+// Camera, lights and fog live in the shared uniform blocks instead, the toggles are compiled in as features.
+struct SceneUniforms {
+	UniformHandle<float> GammaValue;
+	UniformHandle<int> DiffuseTexture, SpecularTexture, EmissionTexture;
+	UniformHandle<glm::vec4> MaterialAmbient, MaterialDiffuse, MaterialSpecular;
+	UniformHandle<float> MaterialShininess;
+	UniformHandle<glm::mat4> Model;
+	// Only in the billboard vertex shader
+	UniformHandle<int> BillboardMode, FrameCount;
+	UniformHandle<float> FrameRate, Time;
+};
+
+struct SkyboxUniforms {
+	UniformHandle<int> Skybox;
+	UniformHandle<glm::mat4> Model;
+	UniformHandle<float> GammaValue;
+};
+
+struct ImpostorUniforms {
+	UniformHandle<int> Atlas;
+	UniformHandle<float> Radius;
+	UniformHandle<float> GammaValue;
+};
+
+// What the recording jobs need from GL, looked up on the GL thread before they start: picking a variant may compile it
+// and resolving a texture may start its load, neither can run on a worker. Null where nothing this frame draws with it.
+struct RecordContext {
+	LightingVariants::Variant* Emission;
+	LightingVariants::Variant* Billboard;
+	LightingVariants::Variant* Instance;
+	ShaderVariants<ImpostorUniforms>::Variant* Impostor;
+	ShaderVariants<SkyboxUniforms>::Variant* Sky;
+	unsigned int GrassTexture;
+	unsigned int BananaTexture;
+	unsigned int CubemapTexture;
+	glm::mat4 Model;
+	float Time;
+};
+
+// Shared uniform blocks, marked dirty by the widgets and keys that change them
+UniformBuffer<FrameStd140> frameUBO;
+UniformBuffer<LightsStd140> lightsUBO;
+UniformBuffer<FogStd140> fogUBO;
+
+// Scene draws of the frame, recorded as commands, then sorted and issued through the state cache in one go
+RenderQueue renderQueue;
+GLStateCache glState;
 static bool useBlinnPhong = true;
 static bool useSpotExponent = false;
 static bool useLighting = true;
@@ -133,8 +297,19 @@ std::vector<float> floorVertices;
 std::vector<unsigned int> floorIndices;
 unsigned int floorVAO, floorVBO, floorEBO;
 
+// Unit quad shared by the billboard batches, each sprite is placed by Shaders/billboard.vs
 std::vector<float> planeVertices;
-unsigned int planeVAO, planeVBO;
+unsigned int planeVBO;
+BillboardBatch grassBillboards, fishBillboards, boidBillboards;
+
+// The grass and the boid sprites have soft edges, they are drawn in the blended pass sorted back to front on the pool
+// (Headers/depthsort.h). The grass doesn't move, its order is only redone and uploaded when the camera moved.
+std::vector<BillboardInstance> grassInstances;
+std::vector<BillboardInstance> sortedGrass;
+DepthSorter grassSorter, spriteSorter;
+glm::vec3 grassSortEye, grassSortFront;
+bool grassSorted = false;
+bool grassUploadDue = false;
 
 std::vector<float> sphereVertices;
 std::vector<unsigned int> sphereIndices;
@@ -142,88 +317,242 @@ unsigned int sphereVAO, sphereVBO, sphereEBO;
 
 Cylinder cone(0.0f, 0.2f, 0.8f, 40, 20);
 unsigned int coneVAO, coneVBO, coneEBO;
+// Per-instance model matrices of the boids, streamed into coneVAO every frame
+unsigned int boidsInstanceVBO;
+const glm::vec4 CONE_AMBIENT(0.02f, 0.02f, 0.02f, 1.0f);
+const glm::vec4 CONE_DIFFUSE(0.60f, 0.20f, 0.0f, 1.0f);
+
+// Coarser cones appended to the mesh above as LOD 1 and 2 (sectors, stacks)
+const unsigned int CONE_LOD_SHAPES[][2] = { { 12, 2 }, { 6, 1 } };
+const unsigned int CONE_LOD_COUNT = 1 + sizeof(CONE_LOD_SHAPES) / sizeof(CONE_LOD_SHAPES[0]);
+// On-screen length of a boid in pixels below which it drops to the next coarser LOD
+const float CONE_LOD_PIXELS[CONE_LOD_COUNT - 1] = { 48.0f, 12.0f };
+// How far past a threshold a boid has to get before it switches, so one sitting on the edge doesn't pop every frame
+const float CONE_LOD_HYSTERESIS = 0.15f;
+static bool enableConeLod = true;
+// Bucket each boid was drawn in last frame (a LOD, or BOID_BUCKET_IMPOSTOR), and the range of boidsInstanceVBO each LOD draws this frame
+std::vector<unsigned char> boidLods;
+unsigned int coneLodFirst[CONE_LOD_COUNT] = {};
+unsigned int coneLodInstances[CONE_LOD_COUNT] = {};
+// Boid triangles sent to the GPU this frame, whichever way they are drawn
+unsigned int boidTriangles = 0;
+
+// Boids further than impostorDistance are drawn as one quad textured from baked views of the cone instead of the mesh
+ImpostorRenderer boidImpostors;
+static bool enableImpostors = true;
+static float impostorDistance = 60.0f;
+const unsigned int BOID_BUCKET_IMPOSTOR = CONE_LOD_COUNT;
+const unsigned int BOID_BUCKETS = CONE_LOD_COUNT + 1;
+
+// Settings the quality governor turns down under load, the values of each knob by level (Headers/qualitygovernor.h)
+QualityGovernor qualityGovernor;
+const unsigned int METRICS_INTERVALS[] = { 1, 4, 16 };
+const float CONE_LOD_SCALES[] = { 1.0f, 1.6f, 2.5f };
+const float IMPOSTOR_SCALES[] = { 1.0f, 0.6f, 0.35f };
+const unsigned int NEIGHBOR_CAPS[] = { 0, 24, 12, 6 };
+const unsigned int FORCE_INTERVALS[] = { 1, 2, 4 };
+// Frames between samples of the frame statistics and hardware counters
+unsigned int metricsInterval = 1;
+// Multiplies CONE_LOD_PIXELS, and impostorDistance
+float coneLodScale = 1.0f;
+float impostorScale = 1.0f;
+// 0 lets a boid steer by every neighbor it sees
+unsigned int neighborCap = 0;
+// Flocking forces are recomputed every forceInterval steps and held in between
+unsigned int forceInterval = 1;
+unsigned int simStep = 0;
 
 static bool enableBillboard = true;
+static bool showGrass = true;
 
-// Texture parameter
-unsigned int seaTexture, sandTexture, grassTexture, boxTexture, boxSpecularTexture, fishTexture, skyTexture;
+// Texture parameter, loaded in the background the first time they are bound
+AssetRegistry assets;
+TextureHandle seaTexture, sandTexture, grassTexture, boxTexture, boxSpecularTexture, fishTexture, skyTexture, cubemapTexture, bananaTexture;
 
 std::vector<glm::vec3> boxposition, plasticposition, grassposition, fishposition;
 std::vector<float> grassSize, fishSize;
 
 // Boids Flocking
 std::vector<Boid> boids;
+// Flock size (--boids N), a larger flock is spawned over a larger ball so it is as dense as the default one
+const unsigned int BOIDS_DEFAULT_COUNT = 50;
+unsigned int boidCount = BOIDS_DEFAULT_COUNT;
 static float separation = 1.0f, alignment = 1.0f, cohesion = 1.0f;
-
-int main() {
-
-	// Initialize GLFW
-	if (!glfwInit()) {
-		logging::loggingMessage(logging::LogType::ERROR, "Failed to initialize GLFW.");
-		glfwTerminate();
+// The flocking forces test every pair of boids; without them the boids fly straight on, which lets
+// flocks far past what the forces can keep up with be drawn (--flocking off)
+static bool enableFlocking = true;
+
+// How the flock is drawn: the instanced cone, or one animated quad per boid from the banana frames
+enum Boid_Render {
+	BOIDS_MESH,
+	BOIDS_SPRITES
+};
+static int boidRender = BOIDS_MESH;
+const unsigned int BANANA_FRAME_COUNT = 8;
+// Frames per second at speed 1, a faster boid spins faster
+const float BANANA_FRAME_RATE = 1.5f;
+const float BOID_SPRITE_SIZE = 1.0f;
+
+// Boids binned every frame so whole cells can be culled against the frustum at once
+SpatialGrid boidGrid;
+const float CULL_CELL_SIZE = 8.0f;
+static bool enableCulling = true;
+unsigned int boidsVisible = 0;
+
+// Workers for the simulation and the per-thread arenas for transient frame data
+ThreadPool threadPool;
+FrameArenas frameArenas;
+// The visible flock is classified and packed in this many blocks per thread, so uneven blocks balance out
+const unsigned int RECORD_BLOCKS_PER_THREAD = 4;
+
+// Profiling
+const std::string TRACE_PATH = "boids_trace.json";
+FrameTimeTracker frameTimes;
+FlightRecorder flightRecorder;
+SimCounters simCounters{};
+PerfCounters perfCounters;
+// Per thread counters of the phase running on the pool right now
+ThreadPerfSamples phaseSamples;
+#ifndef BOIDS_NO_PROFILE
+// Frames ignored before heap allocations count against the steady state (startup, first ImGui windows).
+const unsigned int ALLOC_WARMUP_FRAMES = 60;
+unsigned int allocatingFrames = 0;
+// --check-allocations, fail the run if a frame after warm-up allocated
+bool checkAllocations = false;
+unsigned int allocSamplePeriod = 16;
+std::vector<std::string> allocationReport;
+#endif
+
+// Taken first thing in main(), the start of the time-to-first-frame report
+std::chrono::steady_clock::time_point startupTime;
+
+int main(int argc, char** argv) {
+	startupTime = std::chrono::steady_clock::now();
+	if (!parseArguments(argc, argv)) {
 		return -1;
-	} else {
-		logging::loggingMessage(logging::LogType::DEBUG, "Initialize GLFW successful.");
 	}
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_SAMPLES, 32);
 
-	window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, WINDOW_TITLE.c_str(), NULL, NULL);
-	if (!window) {
-		logging::loggingMessage(logging::LogType::ERROR, "Failed to create GLFW window.");
-		glfwTerminate();
-		return -1;
+	GLADloadproc loadProc;
+	if (headless) {
+		// No window and no GLFW, the scene goes to an offscreen framebuffer
+		if (!headlessContext.create()) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to create headless context: " + headlessContext.getReason());
+			return -1;
+		} else {
+			logging::loggingMessage(logging::LogType::DEBUG, "Create headless context successful (" + headlessContext.getReason() + ").");
+		}
+		loadProc = (GLADloadproc)HeadlessContext::getProcAddress;
 	} else {
-		logging::loggingMessage(logging::LogType::DEBUG, "Create GLFW window successful.");
-	}
+		// Initialize GLFW
+		if (!glfwInit()) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to initialize GLFW.");
+			glfwTerminate();
+			return -1;
+		} else {
+			logging::loggingMessage(logging::LogType::DEBUG, "Initialize GLFW successful.");
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		// Multisampling happens in the scene target, the upscale can't be blitted into a multisampled window
+		glfwWindowHint(GLFW_SAMPLES, 0);
+
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, WINDOW_TITLE.c_str(), NULL, NULL);
+		if (!window) {
+			logging::loggingMessage(logging::LogType::ERROR, "Failed to create GLFW window.");
+			glfwTerminate();
+			return -1;
+		} else {
+			logging::loggingMessage(logging::LogType::DEBUG, "Create GLFW window successful.");
+		}
 
-	// Register callbacks
-	glfwMakeContextCurrent(window);
-	glfwSetErrorCallback(errorCallback);
-	glfwSetFramebufferSizeCallback(window, frameBufferSizeCallback);
-	glfwSetKeyCallback(window, keyCallback);
-	glfwSetCursorPosCallback(window, mouseCallback);
-	glfwSetMouseButtonCallback(window, mouseButtonCallback);
-	glfwSetScrollCallback(window, scrollCallback);
+		// Register callbacks
+		glfwMakeContextCurrent(window);
+		glfwSetErrorCallback(errorCallback);
+		glfwSetFramebufferSizeCallback(window, frameBufferSizeCallback);
+		glfwSetKeyCallback(window, keyCallback);
+		glfwSetCursorPosCallback(window, mouseCallback);
+		glfwSetMouseButtonCallback(window, mouseButtonCallback);
+		glfwSetScrollCallback(window, scrollCallback);
+		applyVsync();
+		loadProc = (GLADloadproc)glfwGetProcAddress;
+	}
 
 	// Initialize GLAD (Must behind the create window)
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+	if (!gladLoadGLLoader(loadProc)) {
 		logging::loggingMessage(logging::LogType::ERROR, "Failed to initialize GLAD.");
 		glfwTerminate();
 		return -1;
 	} else {
 		logging::loggingMessage(logging::LogType::DEBUG, "Initialize GLAD successful.");
 	}
+	if (headless && !headlessContext.createTarget(SCR_WIDTH, SCR_HEIGHT)) {
+		logging::loggingMessage(logging::LogType::ERROR, "Failed to create headless target: " + headlessContext.getReason());
+		return -1;
+	}
 
-	// Initialize ImGui and bind to GLFW and OpenGL3(glad)
-	std::string glsl_version = "#version 330";
-	IMGUI_CHECKVERSION();
-	ImGui::CreateContext();
-	ImGuiIO& io = ImGui::GetIO();
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
-	ImGui_ImplOpenGL3_Init(glsl_version.c_str());
-	ImGui::StyleColorsDark();
+	// Initialize ImGui and bind to GLFW and OpenGL3(glad), a headless run has no UI
+	if (!headless) {
+		std::string glsl_version = "#version 330";
+		IMGUI_CHECKVERSION();
+		ImGui::CreateContext();
+		ImGui_ImplGlfw_InitForOpenGL(window, true);
+		ImGui_ImplOpenGL3_Init(glsl_version.c_str());
+		ImGui::StyleColorsDark();
+	}
 
 	// Show version info
 	const GLubyte* renderer = glGetString(GL_RENDERER);
 	const GLubyte* version = glGetString(GL_VERSION);
 	logging::showInitInfo(renderer, version);
+	ProgramCache::instance().init(loadProc);
+	if (!perfCounters.isAvailable()) {
+		logging::loggingMessage(logging::LogType::WARNING, "Hardware counters disabled: " + perfCounters.getReason());
+	}
+	perfCounters.setThreadCount(threadPool.getThreadCount());
 
 	// Setting OpenGL
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// Create shader program
-	Shader myShader("Shaders/lighting.vs", "Shaders/lighting.fs");
-	Shader instanceShader("Shaders/instance.vs", "Shaders/lighting.fs");
-	Shader normalShader("Shaders/normal_visualization.vs", "Shaders/normal_visualization.fs", "Shaders/normal_visualization.gs");
+	// Create shader program, each feature combination is compiled the first time it is drawn with
+	LightingVariants lightingShaders("Shaders/lighting.vs", "Shaders/lighting.fs", resolveSceneUniforms);
+	LightingVariants instanceShaders("Shaders/instance.vs", "Shaders/lighting.fs", resolveSceneUniforms);
+	LightingVariants billboardShaders("Shaders/billboard.vs", "Shaders/lighting.fs", resolveSceneUniforms);
+	ShaderVariants<SkyboxUniforms> skyboxShaders("Shaders/skybox.vs", "Shaders/skybox.fs", resolveSkyboxUniforms);
+	ShaderVariants<ImpostorUniforms> impostorShaders("Shaders/impostor.vs", "Shaders/impostor.fs", resolveImpostorUniforms);
+	// Debug view only, built when it is first drawn
+	std::unique_ptr<Shader> normalShader;
+	frameUBO.init(BLOCK_FRAME);
+	lightsUBO.init(BLOCK_LIGHTS);
+	fogUBO.init(BLOCK_FOG);
+	lightClusters.init();
+	sceneTimer.init();
+	sceneLights.reserve(MAX_CLUSTER_LIGHTS);
 	
 	// Create object data
 	geneObejectData();
 
+	// Views of the full-detail cone for the far boids, rendered once with the material the mesh is drawn with
+	{
+		Shader bakeShader("Shaders/impostor_bake.vs", "Shaders/impostor_bake.fs");
+		const CylinderLod& lod = cone.getLod(0);
+		boidImpostors.bake(bakeShader, coneRadius(), CONE_AMBIENT, CONE_DIFFUSE, [&lod]() {
+			glBindVertexArray(coneVAO);
+			// The instance matrices are not filled yet and the bake shader doesn't read them
+			for (unsigned int i = 0; i < 4; i++) {
+				glDisableVertexAttribArray(3 + i);
+			}
+			glDrawElements(GL_TRIANGLES, lod.IndexCount, GL_UNSIGNED_INT, (void*)(lod.IndexOffset * sizeof(unsigned int)));
+			for (unsigned int i = 0; i < 4; i++) {
+				glEnableVertexAttribArray(3 + i);
+			}
+			glBindVertexArray(0);
+		});
+		glDeleteProgram(bakeShader.ID);
+	}
+
 	// Setting amount of fishes, boxed and grass. 
 	std::mt19937_64 rand_generator;
 	std::uniform_real_distribution<float> unif_g(-80.0, 80.0);
@@ -246,11 +575,18 @@ int main() {
 		grassSize.push_back(unif_gsize(rand_generator));
 	}
 
+	// The grass never moves, it is uploaded in depth order by the first frame
+	for (unsigned int i = 0; i < grassposition.size(); i++) {
+		grassInstances.push_back({ grassposition[i], grassSize[i], grassSize[i], 0.0f, 0.0f, 0.0f });
+	}
+
 	constexpr float radius_max = 10.0f;
 	float x, y, z, rotate_angle;
 	glm::vec3 boid_position;
 	glm::vec3 boid_direction;
-	for (int i = 0; i < 50; i++) {
+	float spawnScale = std::cbrt((float)boidCount / BOIDS_DEFAULT_COUNT);
+	boids.reserve(boidCount);
+	for (unsigned int i = 0; i < boidCount; i++) {
 		// fishposition.push_back(glm::vec3(unif_f(generator), 0.0f, unif_f(generator)));
 		// fishSize.push_back(unif_fsize(generator));
 		
@@ -261,7 +597,7 @@ int main() {
 			y = unif_boid_position(rand_generator) * radius_max;
 			z = unif_boid_position(rand_generator) * radius_max;
 		} while (x * x + y * y + z * z > radius_max);
-		boid_position = glm::vec3(x, y, z);
+		boid_position = glm::vec3(x, y, z) * spawnScale;
 
 		boid_direction = glm::vec3(unif_boid_direction(rand_generator), unif_boid_direction(rand_generator), unif_boid_direction(rand_generator));
 
@@ -272,20 +608,40 @@ int main() {
 		boids.push_back(temp_boid);
 	}
 
+	// Short-range colored lights over the floor, they bob up and down in updateLightClusters()
+	std::uniform_real_distribution<float> unif_light_color(0.2f, 1.0f);
+	for (unsigned int i = 0; i < MAX_SCATTERED_LIGHTS; i++) {
+		Light light(glm::vec3(unif_g(rand_generator), 1.0f + unif_gsize(rand_generator) * 2.0f, unif_g(rand_generator)), true);
+		light.Ambient = glm::vec3(0.0f);
+		light.Diffuse = glm::vec3(unif_light_color(rand_generator), unif_light_color(rand_generator), unif_light_color(rand_generator));
+		light.Specular = light.Diffuse;
+		light.Linear = 0.35f;
+		light.Quadratic = 0.44f;
+		scatteredLights.push_back(light);
+	}
+	frameArenas.init(threadPool.getThreadCount());
+
 	// Initial Light Setting
 	spotLights[0].Cutoff = 25.0f;
 	spotLights[0].OuterCutoff = 40.0f;
+	fog.Density = 0.003f;
 
-	// Loading textures
-	seaTexture = loadTexture("Resources\\Textures\\sea.jpg");
-	sandTexture = loadTexture("Resources\\Textures\\sand.jpg");
-	grassTexture = loadTexture("Resources\\Textures\\grass.png");
-	boxTexture = loadTexture("Resources\\Textures\\container2.png");
-	boxSpecularTexture = loadTexture("Resources\\Textures\\container2_specular.png");
-	fishTexture = loadTexture("Resources\\Textures\\fish.png");
-	skyTexture = loadTexture("Resources\\Textures\\sky.jpg");
+	// Register textures, nothing is read until it is first bound
+	assets.init();
+	seaTexture = assets.addTexture("Resources/Textures/sea.jpg");
+	sandTexture = assets.addTexture("Resources/Textures/sand.jpg");
+	grassTexture = assets.addTextureArray({ "Resources/Textures/grass.png" });
+	boxTexture = assets.addTexture("Resources/Textures/container2.png");
+	boxSpecularTexture = assets.addTexture("Resources/Textures/container2_specular.png");
+	fishTexture = assets.addTextureArray({ "Resources/Textures/fish.png" });
+	std::vector<std::string> bananaFrames;
+	for (unsigned int i = 0; i < BANANA_FRAME_COUNT; i++) {
+		bananaFrames.push_back("Resources/Textures/banana/banana-" + std::to_string(i) + ".png");
+	}
+	bananaTexture = assets.addTextureArray(bananaFrames);
+	skyTexture = assets.addTexture("Resources/Textures/sky.jpg");
 
-	// Loading Cubemap
+	// Register Cubemap
 	std::vector<std::string> faces{
 		"Resources/Textures/skybox/right.jpg",
 		"Resources/Textures/skybox/left.jpg",
@@ -294,143 +650,134 @@ int main() {
 		"Resources/Textures/skybox/front.jpg",
 		"Resources/Textures/skybox/back.jpg",
 	};
-	unsigned int cubemapTexture = loadCubemap(faces);
+	cubemapTexture = assets.addCubemap(faces);
+
+	if (frameLimit > 0) {
+		benchmarkLog.open(BENCHMARK_PATH, frameLimit);
+	}
+	if (!capturePath.empty()) {
+		frameCapture.start(capturePath, SCR_WIDTH, SCR_HEIGHT);
+	}
 
 	// The main loop
-	while (!glfwWindowShouldClose(window)) {
+	PROFILE_THREAD("Main");
+	while (!shouldClose()) {
+		PROFILE_FRAME();
+		PROFILE_SCOPE("Frame");
+
+		// Before the frame starts, so neither the work times nor the input carry the wait
+		if (!headless) {
+			PROFILE_SCOPE("Frame Limiter");
+			frameLimiter.wait();
+		}
+		inputLatency.poll();
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+		// Transient data of the previous frame is released all at once
+		frameArenas.reset();
+
+		// Textures decoded since the last frame, as many as fit in the budget
+		{
+			PROFILE_SCOPE("Asset Upload");
+			assets.update(ASSET_UPLOAD_BUDGET_MS);
+		}
 		
 		// Calculate the deltaFrame
-		float currentTime = (float)glfwGetTime();
-		deltaTime = currentTime - lastTime;
+		float currentTime = appTime();
+		float frameMilliseconds = (currentTime - lastTime) * 1000.0f;
+		deltaTime = headless ? HEADLESS_TIME_STEP : currentTime - lastTime;
 		lastTime = currentTime;
 
+		// Track the frame that just finished
+		frameTimes.addFrame(frameMilliseconds);
+		flightRecorder.addFrame(frameMilliseconds, simCounters);
+		perfCounters.setSampling(framesDrawn % metricsInterval == 0);
+
+		// Judged on the work of the frame, the wait for vsync would put every frame right at the budget
+		if (qualityGovernor.addFrame(std::max(cpuMilliseconds, resolution.getGpuMilliseconds()))) {
+			applyQuality();
+		}
+#ifndef BOIDS_NO_PROFILE
+		checkSteadyStateAllocations();
+#endif
+
 		// Process Input (Moving camera)
-		processInput(window);
+		if (!headless && !lateInput) {
+			sampleInput();
+		}
 
 		// Clear the buffer
+		beginScene();
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// feed inputs to dear imgui start new frame;
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
-		showUI();
-		// ImGui::ShowDemoWindow();
+		if (!headless) {
+			PROFILE_SCOPE("ImGui Build");
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
+			showUI();
+			// ImGui::ShowDemoWindow();
+		}
+
+		// The flock doesn't depend on the camera, it moves before the late input is read
+		updateBoids();
+		if (!headless && lateInput) {
+			sampleInput();
+		}
 
 		setViewMatrix();
 		setProjectionMatrix();
 		setViewport();
-
-		// Enable Shader and setting view & projection matrix
-		shaderSetting(myShader);
+		updateUniformBuffers();
 
 		// Render on the screen;
+		updateLightClusters();
 
-		// ==================== Draw origin and 3 axes ====================
-		if (showAxis) {
-			drawAxis(myShader);
-		}
-
-		// ==================== Draw Skybox (Using Cubemap) ====================
-		glDepthFunc(GL_LEQUAL);
-		myShader.setBool("isCubeMap", true);
-		modelMatrix.push();
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(5.0f)));
-		myShader.setMat4("model", modelMatrix.top());
-		drawCube();
-		modelMatrix.pop();
-		myShader.setBool("isCubeMap", false);
-		glDepthFunc(GL_LESS);
+		// ==================== Record ====================
+		// Commands and instance data are built on the pool, the GL thread only resolves what they need up front
+		RecordContext context = prepareRecording(lightingShaders, instanceShaders, billboardShaders, impostorShaders, skyboxShaders);
+		ArenaVector<glm::mat4> boidsMatrices(frameArenas.get(0));
+		ArenaVector<BillboardInstance> boidsSprites(frameArenas.get(0));
+		ArenaVector<ImpostorInstance> boidsImpostors(frameArenas.get(0));
+		renderQueue.begin(global_far, threadPool.getThreadCount());
+		recordFrame(context, boidsMatrices, boidsSprites, boidsImpostors);
 
 		/*
 		// ==================== Draw Sea ====================
+		Shader& seaShader = useLightingVariant(lightingShaders, FEATURE_DIFFUSE_TEXTURE | FEATURE_SPECULAR_TEXTURE);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, seaTexture);
+		glBindTexture(GL_TEXTURE_2D, assets.texture(seaTexture));
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, NULL);
 		glActiveTexture(GL_TEXTURE2);
 		glBindTexture(GL_TEXTURE_2D, NULL);
-		myShader.setBool("material.enableColorTexture", true);
-		myShader.setBool("material.enableSpecularTexture", true);
-		myShader.setBool("material.enableEmission", false);
-		myShader.setBool("material.enableEmissionTexture", false);
-		myShader.setFloat("material.shininess", 64.0f);
-		myShader.setMat4("model", modelMatrix.top());
+		seaShader.setFloat("material.shininess", 64.0f);
+		seaShader.setMat4("model", modelMatrix.top());
 		drawFloor();
 		*/
 
 		// ==================== Draw Boids ====================
 		/*
-		modelMatrix.push();
+		std::vector<BillboardInstance> fishInstances;
 		for (unsigned int i = 0; i < boids.size(); i++) {
 			boids[i].edges(20, 20, 20);
 			boids[i].flock(boids, separation, alignment, cohesion);
 			boids[i].update(deltaTime);
-			myShader.setMat4("model", modelMatrix.top());
-			drawFish(myShader, boids[i].Position, boids[i].Size);
+			fishInstances.push_back({ boids[i].Position, boids[i].Size, boids[i].Size * 0.5f, 0.0f });
 		}
-		modelMatrix.pop();
+		fishBillboards.upload(fishInstances, GL_STREAM_DRAW);
+		queueFish(billboardShaders);
 		*/
 
-		std::vector<glm::mat4> boidsMatrices;
-		for (unsigned int i = 0; i < boids.size(); i++) {
-			
-			boids[i].flock(boids, separation, alignment, cohesion);
-
-			//boids[i].ApplyForce(boids[i].Cohesion(boids, cohesion));
-			//boids[i].ApplyForce(boids[i].Alignment(boids, alignment));
-			//boids[i].ApplyForce(boids[i].Separation(boids, separation));
-			// boids[i].ApplyForce(boids[i].Edges());
-
-			boids[i].Update(deltaTime);
-			boids[i].ResetForce();
-
-			boidsMatrices.push_back(boids[i].getModel());
-			// instanceShader.setMat4("model", boids[i].getModel());
-		}
-
-		unsigned int buffer;
-		GLsizei vec4Size = sizeof(glm::vec4);
-		glGenBuffers(1, &buffer);		
-		glBindVertexArray(coneVAO);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, boidsMatrices.size() * sizeof(glm::mat4), boidsMatrices.data(), GL_STATIC_DRAW);
-			glEnableVertexAttribArray(3);
-			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)0);
-			glEnableVertexAttribArray(4);
-			glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(vec4Size));
-			glEnableVertexAttribArray(5);
-			glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(2 * vec4Size));
-			glEnableVertexAttribArray(6);
-			glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(3 * vec4Size));
-			glVertexAttribDivisor(3, 1);
-			glVertexAttribDivisor(4, 1);
-			glVertexAttribDivisor(5, 1);
-			glVertexAttribDivisor(6, 1);
-		glBindVertexArray(0);
-
-		shaderSetting(instanceShader);
-		instanceShader.use();
-		instanceShader.setBool("material.enableColorTexture", false);
-		instanceShader.setBool("material.enableSpecularTexture", false);
-		instanceShader.setBool("material.enableEmission", false);
-		instanceShader.setBool("material.enableEmissionTexture", false);
-		instanceShader.setVec4("material.ambient", glm::vec4(0.02f, 0.02f, 0.02f, 1.0));
-		instanceShader.setVec4("material.diffuse", glm::vec4(0.60f, 0.20f, 0.0f, 1.0));
-		instanceShader.setVec4("material.specular", glm::vec4(0.40f, 0.10f, 0.0f, 1.0));
-		instanceShader.setFloat("material.shininess", 16.0f);
-		instanceShader.setMat4("model", modelMatrix.top());
-		drawCone();
-
 		/*
-		normalShader.use();
-		normalShader.setMat4("view", view);
-		normalShader.setMat4("projection", projection);
+		if (!normalShader) {
+			normalShader.reset(new Shader("Shaders/normal_visualization.vs", "Shaders/normal_visualization.fs", "Shaders/normal_visualization.gs"));
+		}
+		normalShader->use();
 		modelMatrix.push();
-		normalShader.setMat4("model", modelMatrix.top());
+		normalShader->setMat4("model", modelMatrix.top());
 		drawCone();
 		modelMatrix.pop();
 		*/
@@ -441,8 +788,7 @@ int main() {
 		for (unsigned int i = 0; i < boxposition.size(); i++) {
 			modelMatrix.push();
 			modelMatrix.save(glm::translate(modelMatrix.top(), glm::vec3(boxposition[i].x, sin(currentTime * 3 + boxposition[i].z) / 4, boxposition[i].z)));
-			myShader.setMat4("model", modelMatrix.top());
-			drawBox(myShader);
+			queueBox(lightingShaders);
 			modelMatrix.pop();
 		}
 		modelMatrix.pop();
@@ -450,59 +796,92 @@ int main() {
 
 		/*
 		// ==================== Draw Plastic Object ====================
-		myShader.use();
-		myShader.setBool("material.enableColorTexture", false);
-		myShader.setBool("material.enableSpecularTexture", false);
-		myShader.setBool("material.enableEmission", false);
-		myShader.setBool("material.enableEmissionTexture", false);
-		myShader.setVec4("material.ambient", glm::vec4(0.02f, 0.02f, 0.02f, 1.0));
-		myShader.setVec4("material.diffuse", glm::vec4(0.1f, 0.35f, 0.1f, 1.0));
-		myShader.setVec4("material.specular", glm::vec4(0.45f, 0.55f, 0.45f, 1.0));
-		myShader.setFloat("material.shininess", 16.0f);
+		Shader& plasticShader = useLightingVariant(lightingShaders, 0);
+		plasticShader.setVec4("material.ambient", glm::vec4(0.02f, 0.02f, 0.02f, 1.0));
+		plasticShader.setVec4("material.diffuse", glm::vec4(0.1f, 0.35f, 0.1f, 1.0));
+		plasticShader.setVec4("material.specular", glm::vec4(0.45f, 0.55f, 0.45f, 1.0));
+		plasticShader.setFloat("material.shininess", 16.0f);
 		modelMatrix.push();
 		for (unsigned int i = 0; i < plasticposition.size(); i++) {
 			modelMatrix.push();
 			modelMatrix.save(glm::translate(modelMatrix.top(), glm::vec3(plasticposition[i].x, sin(currentTime * 3 + plasticposition[i].z) / 4, plasticposition[i].z)));
-			myShader.setMat4("model", modelMatrix.top());
+			plasticShader.setMat4("model", modelMatrix.top());
 			drawCube();
 			modelMatrix.pop();
 		}
 		modelMatrix.pop();
 		*/
 
-		
-
-		// ==================== draw light ball ====================
-		myShader.use();
-		myShader.setBool("material.enableColorTexture", false);
-		myShader.setBool("material.enableSpecularTexture", false);
-		myShader.setBool("material.enableEmission", true);
-		myShader.setBool("material.enableEmissionTexture", false);
-		for (unsigned int i = 0; i < pointLights.size(); i++) {
-			if (!pointLights[i].Enable) {
-				continue;
+		// ==================== Submit ====================
+		{
+			PROFILE_SCOPE("Instance Upload");
+			if (grassUploadDue) {
+				grassBillboards.upload(sortedGrass, GL_DYNAMIC_DRAW);
+				grassUploadDue = false;
 			}
-			modelMatrix.push();
-			modelMatrix.save(glm::translate(modelMatrix.top(), pointLights[i].Position));
-			modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(0.5f)));
-			myShader.setVec4("material.ambient", glm::vec4(pointLights[i].Ambient.x, pointLights[i].Ambient.y, pointLights[i].Ambient.z, 1.0f));
-			myShader.setVec4("material.diffuse", glm::vec4(pointLights[i].Diffuse.x, pointLights[i].Diffuse.y, pointLights[i].Diffuse.z, 1.0f));
-			myShader.setVec4("material.specular", glm::vec4(pointLights[i].Specular.x, pointLights[i].Specular.y, pointLights[i].Specular.z, 1.0f));
-			myShader.setFloat("material.shininess", 32.0f);
-			myShader.setMat4("model", modelMatrix.top());
-			drawSphere();
-			modelMatrix.pop();
+			if (boidRender == BOIDS_SPRITES) {
+				boidBillboards.upload(boidsSprites.data(), (unsigned int)boidsSprites.size(), GL_STREAM_DRAW);
+			} else {
+				// Orphan and refill the same buffer instead of creating a new one every frame
+				glBindBuffer(GL_ARRAY_BUFFER, boidsInstanceVBO);
+				glBufferData(GL_ARRAY_BUFFER, boidsMatrices.size() * sizeof(glm::mat4), boidsMatrices.data(), GL_STREAM_DRAW);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				boidImpostors.upload(boidsImpostors.data(), (unsigned int)boidsImpostors.size());
+			}
+		}
+
+		// Sorted by key, binds that are already in place are skipped
+		{
+			PROFILE_SCOPE("Render Queue");
+			renderQueue.execute(glState);
+		}
+
+		// Upscale the scene onto the window, the capture and the UI work at full size
+		{
+			PROFILE_SCOPE("Present Scene");
+			presentScene();
+		}
+
+		// Read back before the UI is drawn over the scene
+		if (frameCapture.isActive()) {
+			PROFILE_SCOPE("Capture");
+			frameCapture.capture(SCR_WIDTH, SCR_HEIGHT);
 		}
-		myShader.setBool("material.enableEmission", false);
 
 		// render on the screen
-		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		if (!headless) {
+			PROFILE_SCOPE("ImGui Render");
+			ImGui::Render();
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		}
 
 		// Swap Buffers and Trigger event
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		cpuMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+		{
+			PROFILE_SCOPE("Swap");
+			if (headless) {
+				// Nothing presents the frame, wait for it instead so the timing covers the GPU work
+				glFinish();
+			} else {
+				glfwSwapBuffers(window);
+				// Measured up to the GPU finishing the frame, the swap call alone may return before any of it is drawn.
+				// The fence is only polled, here and at the top of the next frames, the loop keeps running ahead.
+				inputLatency.addSwap(inputTime);
+				inputLatency.poll();
+			}
+		}
+		reportTimeToFirstFrame();
+		framesDrawn++;
+		if (benchmarkLog.isOpen()) {
+			float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+			benchmarkLog.addFrame(milliseconds, renderQueue.getDrawCalls(), (unsigned int)boids.size(), boidsVisible, resolution.getScale(), qualityGovernor.getStep(),
+				simCounters, perfCounters.isSampling());
+		}
 	}
+	dumpTrace();
+	benchmarkLog.close();
+	frameCapture.stop();
+
 	glDeleteVertexArrays(1, &cubeVAO);
 	glDeleteBuffers(1, &cubeVBO);
 	glDeleteBuffers(1, &cubeEBO);
@@ -511,8 +890,12 @@ int main() {
 	glDeleteBuffers(1, &floorVBO);
 	glDeleteBuffers(1, &floorEBO);
 
-	glDeleteVertexArrays(1, &planeVAO);
 	glDeleteBuffers(1, &planeVBO);
+	grassBillboards.release();
+	fishBillboards.release();
+	boidBillboards.release();
+	boidImpostors.release();
+	inputLatency.release();
 
 	glDeleteVertexArrays(1, &sphereVAO);
 	glDeleteBuffers(1, &sphereVBO);
@@ -521,96 +904,455 @@ int main() {
 	glDeleteVertexArrays(1, &coneVAO);
 	glDeleteBuffers(1, &coneVBO);
 	glDeleteBuffers(1, &coneEBO);
+	glDeleteBuffers(1, &boidsInstanceVBO);
+	frameUBO.release();
+	lightsUBO.release();
+	fogUBO.release();
+	lightClusters.release();
+	sceneTimer.release();
+	sceneTarget.release();
+	assets.release();
 
 	// Release the resources.
-	ImGui_ImplOpenGL3_Shutdown();
-	ImGui_ImplGlfw_Shutdown();
-	ImGui::DestroyContext();
+	if (headless) {
+		headlessContext.release();
+	} else {
+		ImGui_ImplOpenGL3_Shutdown();
+		ImGui_ImplGlfw_Shutdown();
+		ImGui::DestroyContext();
+	}
 	glfwTerminate();
+#ifndef BOIDS_NO_PROFILE
+	if (checkAllocations && allocatingFrames > 0) {
+		logging::loggingMessage(logging::LogType::ERROR, std::to_string(allocatingFrames) + " frames after warm-up made heap allocations.");
+		return -1;
+	}
+#endif
 	return 0;
 }
 
-void shaderSetting(Shader shader) {
+void shaderSetting(Shader& shader, const SceneUniforms& uniforms) {
+	PROFILE_SCOPE("Shader Setting");
 	shader.use();
-	
-	// Transform matrices setting
-	shader.setMat4("view", view);
-	shader.setMat4("projection", projection);
-
-	// Cubemap setting
-	shader.setInt("skybox", 3);
-	shader.setBool("isCubeMap", false);
 
 	// Global parameters setting
-	shader.setVec3("viewPos", camera.Position);
-	shader.setBool("useBlinnPhong", useBlinnPhong);
-	shader.setBool("useSpotExponent", useSpotExponent);
-	shader.setBool("useLighting", useLighting);
-	shader.setBool("useDiffuseTexture", useDiffuseTexture);
-	shader.setBool("useSpecularTexture", useSpecularTexture);
-	shader.setBool("useEmission", useEmission);
-	shader.setBool("useGamma", useGamma);
-	shader.setFloat("GammaValue", GammaValue);
+	shader.set(uniforms.GammaValue, GammaValue);
 	
 	// Material setting
-	shader.setInt("material.diffuse_texture", 0);
-	shader.setInt("material.specular_texture", 1);
-	shader.setInt("material.emission_texture", 2);
-
-	shader.setVec4("material.ambient", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-	shader.setVec4("material.diffuse", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-	shader.setVec4("material.specular", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-	shader.setFloat("material.shininess", 64.0f);
-
-	// Lightning setting (Directional Light)
-	shader.setVec3("lights[0].direction", dirLight.Direction);
-	shader.setVec3("lights[0].ambient", dirLight.Ambient);
-	shader.setVec3("lights[0].diffuse", dirLight.Diffuse);
-	shader.setVec3("lights[0].specular", dirLight.Specular);
-	shader.setBool("lights[0].enable", dirLight.Enable);
-	shader.setInt("lights[0].caster", dirLight.Caster);
-
-	// Lightning setting (Point Light)
-	for (unsigned int i = 0; i < pointLights.size(); i++) {
-		shader.setVec3("lights[" + std::to_string(i + 1) + "].position", pointLights[i].Position);
-		shader.setVec3("lights[" + std::to_string(i + 1) + "].ambient", pointLights[i].Ambient);
-		shader.setVec3("lights[" + std::to_string(i + 1) + "].diffuse", pointLights[i].Diffuse);
-		shader.setVec3("lights[" + std::to_string(i + 1) + "].specular", pointLights[i].Specular);
-		shader.setFloat("lights[" + std::to_string(i + 1) + "].constant", pointLights[i].Constant);
-		shader.setFloat("lights[" + std::to_string(i + 1) + "].linear", pointLights[i].Linear);
-		shader.setFloat("lights[" + std::to_string(i + 1) + "].quadratic", pointLights[i].Quadratic);
-		shader.setFloat("lights[" + std::to_string(i + 1) + "].enable", pointLights[i].Enable);
-		shader.setInt("lights[" + std::to_string(i + 1) + "].caster", pointLights[i].Caster);
-	}
-
-	// Lightning setting (Spotlight)
+	shader.set(uniforms.DiffuseTexture, 0);
+	shader.set(uniforms.SpecularTexture, 1);
+	shader.set(uniforms.EmissionTexture, 2);
+
+	shader.set(uniforms.MaterialAmbient, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	shader.set(uniforms.MaterialDiffuse, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	shader.set(uniforms.MaterialSpecular, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	shader.set(uniforms.MaterialShininess, 64.0f);
+}
+
+// Look up every uniform shaderSetting() writes, once per program.
+SceneUniforms resolveSceneUniforms(const Shader& shader) {
+	SceneUniforms uniforms;
+	uniforms.GammaValue = shader.getUniform<float>("GammaValue");
+	uniforms.DiffuseTexture = shader.getUniform<int>("material.diffuse_texture");
+	uniforms.SpecularTexture = shader.getUniform<int>("material.specular_texture");
+	uniforms.EmissionTexture = shader.getUniform<int>("material.emission_texture");
+	uniforms.MaterialAmbient = shader.getUniform<glm::vec4>("material.ambient");
+	uniforms.MaterialDiffuse = shader.getUniform<glm::vec4>("material.diffuse");
+	uniforms.MaterialSpecular = shader.getUniform<glm::vec4>("material.specular");
+	uniforms.MaterialShininess = shader.getUniform<float>("material.shininess");
+	uniforms.Model = shader.getUniform<glm::mat4>("model");
+	uniforms.BillboardMode = shader.getUniform<int>("billboardMode");
+	uniforms.FrameCount = shader.getUniform<int>("frameCount");
+	uniforms.FrameRate = shader.getUniform<float>("frameRate");
+	uniforms.Time = shader.getUniform<float>("time");
+	return uniforms;
+}
+
+SkyboxUniforms resolveSkyboxUniforms(const Shader& shader) {
+	SkyboxUniforms uniforms;
+	uniforms.Skybox = shader.getUniform<int>("skybox");
+	uniforms.Model = shader.getUniform<glm::mat4>("model");
+	uniforms.GammaValue = shader.getUniform<float>("GammaValue");
+	return uniforms;
+}
+
+ImpostorUniforms resolveImpostorUniforms(const Shader& shader) {
+	ImpostorUniforms uniforms;
+	uniforms.Atlas = shader.getUniform<int>("atlas");
+	uniforms.Radius = shader.getUniform<float>("radius");
+	uniforms.GammaValue = shader.getUniform<float>("GammaValue");
+	return uniforms;
+}
+
+// Features picked by the Illumination toggles, without the ones that have no effect in the current mode.
+unsigned int sceneFeatures() {
+	unsigned int features = 0;
+	if (useDiffuseTexture) {
+		features |= FEATURE_DIFFUSE_TEXTURE;
+	}
+	if (useLighting) {
+		features |= FEATURE_LIGHTING;
+		features |= useBlinnPhong ? FEATURE_BLINN_PHONG : 0;
+		features |= useSpotExponent ? FEATURE_SPOT_EXPONENT : 0;
+		features |= useSpecularTexture ? FEATURE_SPECULAR_TEXTURE : 0;
+		features |= useEmission ? FEATURE_EMISSION | FEATURE_EMISSION_TEXTURE : 0;
+		features |= useGamma ? FEATURE_GAMMA : 0;
+	}
+	return features;
+}
+
+// The variant for what the material has (textures, emission) that the toggles leave on.
+LightingVariants::Variant& lightingVariant(LightingVariants& variants, unsigned int materialFeatures) {
+	const unsigned int MATERIAL_FEATURES = FEATURE_DIFFUSE_TEXTURE | FEATURE_SPECULAR_TEXTURE | FEATURE_EMISSION | FEATURE_EMISSION_TEXTURE;
+	unsigned int features = sceneFeatures() & (~MATERIAL_FEATURES | materialFeatures);
+	if (!(features & FEATURE_EMISSION)) {
+		features &= ~FEATURE_EMISSION_TEXTURE;
+	}
+	// Only changes how the diffuse texture is sampled, so it goes wherever that texture does
+	if (features & FEATURE_DIFFUSE_TEXTURE) {
+		features |= materialFeatures & FEATURE_TEXTURE_ARRAY;
+	}
+
+	return variants.get(features);
+}
+
+// Bind the lighting variant for the material and set its uniforms, for drawing outside the render queue.
+Shader& useLightingVariant(LightingVariants& variants, unsigned int materialFeatures) {
+	LightingVariants::Variant& variant = lightingVariant(variants, materialFeatures);
+	shaderSetting(variant.Program, variant.Uniforms);
+	return variant.Program;
+}
+
+// An opaque command on a lighting variant, starting from the values shaderSetting() gives every draw.
+RenderCommand lightingCommand(LightingVariants::Variant& variant, const glm::mat4& model, float depth) {
+	const SceneUniforms& uniforms = variant.Uniforms;
+	RenderCommand command(RENDER_PASS_OPAQUE, variant.Program, depth);
+	command.set(uniforms.GammaValue, GammaValue);
+	command.set(uniforms.DiffuseTexture, 0);
+	command.set(uniforms.SpecularTexture, 1);
+	command.set(uniforms.EmissionTexture, 2);
+	setMaterial(command, uniforms, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 64.0f);
+	command.set(uniforms.Model, model);
+	return command;
+}
+
+void setMaterial(RenderCommand& command, const SceneUniforms& uniforms, glm::vec4 ambient, glm::vec4 diffuse, glm::vec4 specular, float shininess) {
+	command.set(uniforms.MaterialAmbient, ambient);
+	command.set(uniforms.MaterialDiffuse, diffuse);
+	command.set(uniforms.MaterialSpecular, specular);
+	command.set(uniforms.MaterialShininess, shininess);
+}
+
+// Write the shared blocks once per frame, each only when something in it changed.
+void updateUniformBuffers() {
+	PROFILE_SCOPE("Uniform Buffers");
+
+	// Camera: compared against the last upload, it moves most frames
+	FrameStd140 frame = {};
+	frame.View = view;
+	frame.Projection = projection;
+	frame.ViewPos = camera.Position;
+	if (std::memcmp(&frame, &frameUBO.Data, sizeof(frame)) != 0) {
+		frameUBO.Data = frame;
+		frameUBO.markDirty();
+	}
+	frameUBO.upload();
+
+	// The first spotlight is the flashlight, it follows the camera
 	spotLights[0].Position = camera.Position;
 	spotLights[0].Direction = camera.Front;
-	for (unsigned int i = 0; i < spotLights.size(); i++) {
-		shader.setVec3("lights[" + std::to_string(i + 5) + "].position", spotLights[i].Position);
-		shader.setVec3("lights[" + std::to_string(i + 5) + "].direction", spotLights[i].Direction);
-		shader.setVec3("lights[" + std::to_string(i + 5) + "].ambient", spotLights[i].Ambient);
-		shader.setVec3("lights[" + std::to_string(i + 5) + "].diffuse", spotLights[i].Diffuse);
-		shader.setVec3("lights[" + std::to_string(i + 5) + "].specular", spotLights[i].Specular);
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].constant", spotLights[i].Constant);
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].linear", spotLights[i].Linear);
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].quadratic", spotLights[i].Quadratic);
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].cutoff", glm::cos(glm::radians(spotLights[i].Cutoff)));
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].outerCutoff", glm::cos(glm::radians(spotLights[i].OuterCutoff)));
-		shader.setFloat("lights[" + std::to_string(i + 5) + "].exponent", spotLights[i].Exponent);
-		shader.setBool("lights[" + std::to_string(i + 5) + "].enable", spotLights[i].Enable);
-		shader.setInt("lights[" + std::to_string(i + 5) + "].caster", spotLights[i].Caster);
-	}
-
-	// Fog setting
-	fog.Density = 0.003f;
-	shader.setVec4("fog.color", fog.Color);
-	shader.setFloat("fog.density", fog.Density);
-	shader.setInt("fog.mode", fog.Mode);
-	shader.setInt("fog.depthType", fog.DepthType);
-	shader.setBool("fog.enable", fog.Enable);
-	shader.setFloat("fog.f_start", fog.F_start);
-	shader.setFloat("fog.f_end", fog.F_end);
+	// Only the directional light lives in the block, updateLightClusters() adds the cluster parameters and uploads it
+	if (lightsUBO.isDirty()) {
+		lightsUBO.Data.Sun = toStd140(dirLight);
+	}
+
+	if (fogUBO.isDirty()) {
+		FogStd140& data = fogUBO.Data;
+		data.Mode = fog.Mode;
+		data.DepthType = fog.DepthType;
+		data.Density = fog.Density;
+		data.Start = fog.F_start;
+		data.End = fog.F_end;
+		data.Enable = fog.Enable;
+		data.Color = fog.Color;
+		fogUBO.upload();
+	}
+}
+
+LightStd140 toStd140(const Light& light) {
+	LightStd140 data = {};
+	data.Position = light.Position;
+	data.Direction = light.Direction;
+	data.Ambient = light.Ambient;
+	data.Diffuse = light.Diffuse;
+	data.Specular = light.Specular;
+	data.Constant = light.Constant;
+	data.Linear = light.Linear;
+	data.Quadratic = light.Quadratic;
+	data.Cutoff = glm::cos(glm::radians(light.Cutoff));
+	data.OuterCutoff = glm::cos(glm::radians(light.OuterCutoff));
+	data.Exponent = light.Exponent;
+	data.Enable = light.Enable;
+	data.Caster = light.Caster;
+	return data;
+}
+
+// Advance the flock one step.
+// Forces are computed for every boid before any of them moves, so the result does not depend on the order of the vector.
+void updateBoids() {
+	PROFILE_SCOPE("Simulation");
+
+	simCounters.Boids = (unsigned int)boids.size();
+	if (perfCounters.isSampling()) {
+		std::memset(simCounters.Hardware, 0, sizeof(simCounters.Hardware));
+	}
+
+	// Steps in between keep the forces of the last update, the boids still move every step
+	bool forcesDue = enableFlocking && simStep % forceInterval == 0;
+	bool forcesNext = !enableFlocking || (simStep + 1) % forceInterval == 0;
+	simStep++;
+	if (forcesDue) {
+		simCounters.PairTests = (uint64_t)boids.size() * boids.size();
+		// Each boid only writes its own acceleration, so the flock is split across the pool.
+		// Every chunk is counted on the thread that runs it, the threads add up to the phase.
+		PROFILE_SCOPE("Forces");
+		phaseSamples.reset(threadPool.getThreadCount());
+		std::atomic<unsigned int> neighbors(0);
+		threadPool.parallelFor((unsigned int)boids.size(), [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			PROFILE_SCOPE("Forces Chunk");
+			ScopedPerfCounters counters(perfCounters, phaseSamples.get(thread), thread);
+			unsigned int count = 0;
+			for (unsigned int i = begin; i < end; i++) {
+				count += boids[i].flock(boids, separation, alignment, cohesion, neighborCap);
+
+				//boids[i].ApplyForce(boids[i].Cohesion(boids, cohesion));
+				//boids[i].ApplyForce(boids[i].Alignment(boids, alignment));
+				//boids[i].ApplyForce(boids[i].Separation(boids, separation));
+				// boids[i].ApplyForce(boids[i].Edges());
+			}
+			neighbors.fetch_add(count, std::memory_order_relaxed);
+		});
+		phaseSamples.addTo(simCounters.Hardware[SIM_FORCES]);
+		simCounters.Neighbors = neighbors.load();
+	} else {
+		simCounters.PairTests = 0;
+	}
+
+	{
+		// Every boid only reads and writes itself here, the model matrix inverse makes it worth splitting too
+		PROFILE_SCOPE("Integrate");
+		phaseSamples.reset(threadPool.getThreadCount());
+		threadPool.parallelFor((unsigned int)boids.size(), [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			ScopedPerfCounters counters(perfCounters, phaseSamples.get(thread), thread);
+			for (unsigned int i = begin; i < end; i++) {
+				boids[i].Update(deltaTime);
+				if (forcesNext) {
+					boids[i].ResetForce();
+				}
+			}
+		});
+		phaseSamples.addTo(simCounters.Hardware[SIM_INTEGRATE]);
+	}
+}
+
+// Gather the frame's point and spot lights, bin them into clusters for this view and send the result.
+// Runs after the flock moved, so the boid lights sit where the boids are drawn.
+void updateLightClusters() {
+	PROFILE_SCOPE("Light Clusters");
+
+	sceneLights.clear();
+	for (const Light& light : pointLights) {
+		if (light.Enable && sceneLights.size() < MAX_CLUSTER_LIGHTS) {
+			sceneLights.push_back(light);
+		}
+	}
+	for (const Light& light : spotLights) {
+		if (light.Enable && sceneLights.size() < MAX_CLUSTER_LIGHTS) {
+			sceneLights.push_back(light);
+		}
+	}
+	unsigned int scattered = std::min((unsigned int)scatteredLightCount, MAX_CLUSTER_LIGHTS - (unsigned int)sceneLights.size());
+	unsigned int leadBudget = std::min(MAX_BOID_LIGHTS, MAX_CLUSTER_LIGHTS - (unsigned int)sceneLights.size() - scattered);
+	boidLightCount = 0;
+	if (enableBoidLights && !boids.empty() && leadBudget > 0) {
+		unsigned int stride = ((unsigned int)boids.size() + leadBudget - 1) / leadBudget;
+		for (unsigned int i = 0; i < boids.size(); i += stride) {
+			const Boid& boid = boids[i];
+			Light light(boid.getPosition(), true);
+			light.Ambient = glm::vec3(0.0f);
+			light.Diffuse = glm::vec3(0.2f, 0.6f, 1.0f);
+			light.Specular = light.Diffuse;
+			light.Linear = 0.7f;
+			light.Quadratic = 1.8f;
+			sceneLights.push_back(light);
+			boidLightCount++;
+		}
+	}
+	float time = appTime();
+	for (unsigned int i = 0; i < scattered; i++) {
+		Light light = scatteredLights[i];
+		light.Position.y += std::sin(time + i) * 0.5f;
+		sceneLights.push_back(light);
+	}
+
+	lightClusters.build(sceneLights, view, projection, global_near, global_far, threadPool);
+
+	LightsStd140& data = lightsUBO.Data;
+	glm::ivec4 size(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, lightClusters.getLightCount());
+	glm::vec4 depth(global_near, lightClusters.getSliceScale(), lightClusters.getSliceBias(), 0.0f);
+	glm::vec4 screen(1.0f / renderWidth, 1.0f / renderHeight, 0.0f, 0.0f);
+	if (size != data.ClusterSize || depth != data.ClusterDepth || screen != data.ClusterScreen) {
+		data.ClusterSize = size;
+		data.ClusterDepth = depth;
+		data.ClusterScreen = screen;
+		lightsUBO.markDirty();
+	}
+	lightsUBO.upload();
+	lightClusters.upload(SHARED_SAMPLER_UNIT);
+}
+
+// Look up, on the GL thread, everything the recording jobs would otherwise have to ask GL or the asset cache for.
+RecordContext prepareRecording(LightingVariants& lighting, LightingVariants& instance, LightingVariants& billboard, ShaderVariants<ImpostorUniforms>& impostor, ShaderVariants<SkyboxUniforms>& sky) {
+	PROFILE_SCOPE("Prepare Recording");
+	RecordContext context = {};
+	bool sprites = boidRender == BOIDS_SPRITES;
+	context.Emission = &lightingVariant(lighting, FEATURE_EMISSION);
+	if (showGrass || sprites) {
+		context.Billboard = &lightingVariant(billboard, FEATURE_DIFFUSE_TEXTURE | FEATURE_TEXTURE_ARRAY);
+	}
+	if (!sprites) {
+		context.Instance = &lightingVariant(instance, 0);
+		if (enableImpostors) {
+			context.Impostor = &impostor.get(sceneFeatures() & (FEATURE_LIGHTING | FEATURE_GAMMA));
+		}
+	}
+	context.Sky = &sky.get(sceneFeatures() & (FEATURE_LIGHTING | FEATURE_GAMMA));
+	context.GrassTexture = showGrass ? assets.texture(grassTexture) : 0;
+	context.BananaTexture = sprites ? assets.texture(bananaTexture) : 0;
+	context.CubemapTexture = assets.texture(cubemapTexture);
+	context.Model = modelMatrix.top();
+	context.Time = appTime();
+	return context;
+}
+
+// Cull, bucket and pack the flock and record every command of the frame on the pool.
+// The scene commands are one job next to the flock's blocks. The flock goes in two passes, counting boids per bucket
+// and then writing each block's boids from its own offset, so the output is contiguous per bucket without locks.
+void recordFrame(const RecordContext& context, ArenaVector<glm::mat4>& matrices, ArenaVector<BillboardInstance>& sprites, ArenaVector<ImpostorInstance>& impostors) {
+	PROFILE_SCOPE("Record");
+
+	// Only boids whose bounding sphere reaches into the view are packed, in both render modes
+	ArenaVector<unsigned int> visible(frameArenas.get(0));
+	visible.reserve(boids.size());
+	cullBoids(visible);
+
+	// Everything the jobs write is sized here, workers must not allocate from the main thread's arena
+	bool useSprites = boidRender == BOIDS_SPRITES;
+	unsigned int visibleCount = (unsigned int)visible.size();
+	unsigned int blockCount = threadPool.getThreadCount() * RECORD_BLOCKS_PER_THREAD;
+	unsigned int blockSize = (visibleCount + blockCount - 1) / blockCount;
+	ArenaVector<unsigned int> counts(blockCount * BOID_BUCKETS, 0u, frameArenas.get(0));
+	ArenaVector<BillboardInstance> unsortedSprites(frameArenas.get(0));
+	if (useSprites) {
+		unsortedSprites.resize(visibleCount);
+		sprites.resize(visibleCount);
+	} else {
+		boidLods.resize(boids.size(), 0);
+	}
+
+	// Before the jobs, the sort runs on the pool itself and recordScene needs the grass depth
+	if (!grassInstances.empty() && (!grassSorted || camera.Position != grassSortEye || camera.Front != grassSortFront)) {
+		PROFILE_SCOPE("Depth Sort");
+		sortedGrass.resize(grassInstances.size());
+		grassSorter.sort(grassInstances.data(), (unsigned int)grassInstances.size(), camera.Position, camera.Front, global_far, threadPool, sortedGrass.data());
+		grassSortEye = camera.Position;
+		grassSortFront = camera.Front;
+		grassSorted = true;
+		grassUploadDue = true;
+	}
+
+	{
+		PROFILE_SCOPE("Classify");
+		threadPool.parallelFor(1 + blockCount, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int job = begin; job < end; job++) {
+				if (job == 0) {
+					recordScene(context, thread);
+					continue;
+				}
+				unsigned int block = job - 1;
+				unsigned int first = std::min(visibleCount, block * blockSize);
+				unsigned int last = std::min(visibleCount, first + blockSize);
+				if (useSprites) {
+					packSprites(visible, first, last, unsortedSprites);
+				} else {
+					classifyBoids(visible, first, last, &counts[block * BOID_BUCKETS]);
+				}
+			}
+		});
+	}
+
+	if (useSprites) {
+		{
+			PROFILE_SCOPE("Depth Sort");
+			spriteSorter.sort(unsortedSprites.data(), visibleCount, camera.Position, camera.Front, global_far, threadPool, sprites.data());
+		}
+		queueBoidSprites(context, 0, visibleCount);
+		boidTriangles = 2 * visibleCount;
+		return;
+	}
+
+	// Buckets in order, finest LOD first and the impostors last; inside a bucket the blocks in order
+	unsigned int bucketFirst[BOID_BUCKETS];
+	unsigned int offset = 0;
+	for (unsigned int bucket = 0; bucket < BOID_BUCKETS; bucket++) {
+		bucketFirst[bucket] = offset;
+		for (unsigned int block = 0; block < blockCount; block++) {
+			unsigned int count = counts[block * BOID_BUCKETS + bucket];
+			counts[block * BOID_BUCKETS + bucket] = offset;
+			offset += count;
+		}
+	}
+	for (unsigned int level = 0; level < CONE_LOD_COUNT; level++) {
+		coneLodFirst[level] = bucketFirst[level];
+		coneLodInstances[level] = bucketFirst[level + 1] - bucketFirst[level];
+	}
+	unsigned int impostorCount = visibleCount - bucketFirst[BOID_BUCKET_IMPOSTOR];
+	matrices.resize(bucketFirst[BOID_BUCKET_IMPOSTOR]);
+	impostors.resize(impostorCount);
+
+	{
+		PROFILE_SCOPE("Matrix Pack");
+		phaseSamples.reset(threadPool.getThreadCount());
+		threadPool.parallelFor(blockCount, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			ScopedPerfCounters counters(perfCounters, phaseSamples.get(thread), thread);
+			for (unsigned int block = begin; block < end; block++) {
+				unsigned int first = std::min(visibleCount, block * blockSize);
+				unsigned int last = std::min(visibleCount, first + blockSize);
+				scatterBoids(visible, first, last, &counts[block * BOID_BUCKETS], matrices, impostors);
+			}
+		});
+		phaseSamples.addTo(simCounters.Hardware[SIM_PACK]);
+	}
+
+	boidTriangles = 0;
+	queueCone(context, 0);
+	if (impostorCount > 0) {
+		queueImpostors(context, 0, impostorCount);
+		boidTriangles += 2 * impostorCount;
+	}
+}
+
+// Everything but the flock, recorded from one job.
+void recordScene(const RecordContext& context, unsigned int thread) {
+	PROFILE_SCOPE("Record Scene");
+	if (showAxis) {
+		queueAxis(context, thread);
+	}
+	if (showGrass) {
+		queueGrass(context, thread);
+	}
+	queueLights(context, thread);
+	queueSky(context, thread);
 }
 
 void showUI() {
@@ -666,6 +1408,7 @@ void showUI() {
 			if (ImGui::TreeNode("General")) {
 				ImGui::BulletText("Press X to show / hide the axes");
 				ImGui::BulletText("Press Y to switch the projection");
+				ImGui::BulletText("Press F9 to dump a Chrome trace");
 				ImGui::BulletText("Press F11 to Full Screen");
 				ImGui::BulletText("Press ESC to close the program");
 				ImGui::TreePop();
@@ -691,6 +1434,7 @@ void showUI() {
 		}
 		
 		if (ImGui::BeginTabItem("Illumination")) {
+			bool lightsChanged = false;
 			ImGui::Text("Lighting Model: %s", useBlinnPhong ? "Blinn-Phong" : "Phong");
 			ImGui::Checkbox("use Exponent", &useSpotExponent);
 			ImGui::Checkbox("Lighting", &useLighting);
@@ -702,28 +1446,27 @@ void showUI() {
 			ImGui::Spacing();
 			
 			if (ImGui::TreeNode("Direction Light")) {
-				ImGui::SliderFloat3("Direction", (float*)&dirLight.Direction, -10.0f, 10.0f);
-				ImGui::SliderFloat3("Ambient", (float*)&dirLight.Ambient, 0.0f, 1.0f);
-				ImGui::SliderFloat3("Diffuse", (float*)&dirLight.Diffuse, 0.0f, 1.0f);
-				ImGui::SliderFloat3("Specular", (float*)&dirLight.Specular, 0.0f, 1.0f);
-				ImGui::Checkbox("Enable", &dirLight.Enable);
+				lightsChanged |= ImGui::SliderFloat3("Direction", (float*)&dirLight.Direction, -10.0f, 10.0f);
+				lightsChanged |= ImGui::SliderFloat3("Ambient", (float*)&dirLight.Ambient, 0.0f, 1.0f);
+				lightsChanged |= ImGui::SliderFloat3("Diffuse", (float*)&dirLight.Diffuse, 0.0f, 1.0f);
+				lightsChanged |= ImGui::SliderFloat3("Specular", (float*)&dirLight.Specular, 0.0f, 1.0f);
+				lightsChanged |= ImGui::Checkbox("Enable", &dirLight.Enable);
 				ImGui::TreePop();
 			}
 			ImGui::Spacing();
 
 			for (unsigned int i = 0; i < pointLights.size(); i++) {
-				std::stringstream ss;
-				ss << i;
-				std::string index = ss.str();
-
-				if (ImGui::TreeNode(std::string("Point Light " + index).c_str())) {
-					ImGui::SliderFloat3(std::string("Position").c_str(), glm::value_ptr(pointLights[i].Position), -50.0f, 50.0f);
-					ImGui::SliderFloat3(std::string("Ambient").c_str(), (float*)&pointLights[i].Ambient, 0.0f, 1.0f);
-					ImGui::SliderFloat3(std::string("Diffuse").c_str(), (float*)&pointLights[i].Diffuse, 0.0f, 1.0f);
-					ImGui::SliderFloat3(std::string("Specular").c_str(), (float*)&pointLights[i].Specular, 0.0f, 1.0f);
-					ImGui::SliderFloat(std::string("Linear").c_str(), (float*)&pointLights[i].Linear, 0.00014f, 0.7f);
-					ImGui::SliderFloat(std::string("Quadratic").c_str(), (float*)&pointLights[i].Quadratic, 0.00007, 0.5f);
-					ImGui::Checkbox(std::string("Enable").c_str(), &pointLights[i].Enable);
+				char label[32];
+				std::snprintf(label, sizeof(label), "Point Light %u", i);
+
+				if (ImGui::TreeNode(label)) {
+					lightsChanged |= ImGui::SliderFloat3("Position", glm::value_ptr(pointLights[i].Position), -50.0f, 50.0f);
+					lightsChanged |= ImGui::SliderFloat3("Ambient", (float*)&pointLights[i].Ambient, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat3("Diffuse", (float*)&pointLights[i].Diffuse, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat3("Specular", (float*)&pointLights[i].Specular, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat("Linear", (float*)&pointLights[i].Linear, 0.00014f, 0.7f);
+					lightsChanged |= ImGui::SliderFloat("Quadratic", (float*)&pointLights[i].Quadratic, 0.00007, 0.5f);
+					lightsChanged |= ImGui::Checkbox("Enable", &pointLights[i].Enable);
 					ImGui::Spacing();
 					ImGui::TreePop();
 				}
@@ -731,32 +1474,67 @@ void showUI() {
 			}
 
 			for (unsigned int i = 0; i < spotLights.size(); i++) {
-				std::stringstream ss;
-				ss << i;
-				std::string index = ss.str();
-
-				if (ImGui::TreeNode(std::string("Spot Light " + index).c_str())) {
-					ImGui::Text(std::string("Position: (%.2f, %.2f, %.2f)").c_str(), spotLights[i].Position.x, spotLights[i].Position.y, spotLights[i].Position.z);
-					ImGui::Text(std::string("Direction: (%.2f, %.2f, %.2f)").c_str(), spotLights[i].Direction.x, spotLights[i].Direction.y, spotLights[i].Direction.z);
-					ImGui::SliderFloat3(std::string("Ambient").c_str(), (float*)&spotLights[i].Ambient, 0.0f, 1.0f);
-					ImGui::SliderFloat3(std::string("Diffuse").c_str(), (float*)&spotLights[i].Diffuse, 0.0f, 1.0f);
-					ImGui::SliderFloat3(std::string("Specular").c_str(), (float*)&spotLights[i].Specular, 0.0f, 1.0f);
-					ImGui::SliderFloat(std::string("Linear").c_str(), (float*)&spotLights[i].Linear, 0.00014f, 0.7f);
-					ImGui::SliderFloat(std::string("Quadratic").c_str(), (float*)&spotLights[i].Quadratic, 0.00007, 0.5f);
-					ImGui::SliderFloat(std::string("Cutoff").c_str(), (float*)&spotLights[i].Cutoff, 0.0f, spotLights[i].OuterCutoff - 1);
-					ImGui::SliderFloat(std::string("OuterCutoff").c_str(), (float*)&spotLights[i].OuterCutoff, spotLights[i].Cutoff + 1, 40.0f);
-					ImGui::SliderFloat(std::string("Exponent").c_str(), (float*)&spotLights[i].Exponent, 0.0f, 256.0f);
-					ImGui::Checkbox(std::string("Enable").c_str(), &spotLights[i].Enable);
+				char label[32];
+				std::snprintf(label, sizeof(label), "Spot Light %u", i);
+
+				if (ImGui::TreeNode(label)) {
+					ImGui::Text("Position: (%.2f, %.2f, %.2f)", spotLights[i].Position.x, spotLights[i].Position.y, spotLights[i].Position.z);
+					ImGui::Text("Direction: (%.2f, %.2f, %.2f)", spotLights[i].Direction.x, spotLights[i].Direction.y, spotLights[i].Direction.z);
+					lightsChanged |= ImGui::SliderFloat3("Ambient", (float*)&spotLights[i].Ambient, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat3("Diffuse", (float*)&spotLights[i].Diffuse, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat3("Specular", (float*)&spotLights[i].Specular, 0.0f, 1.0f);
+					lightsChanged |= ImGui::SliderFloat("Linear", (float*)&spotLights[i].Linear, 0.00014f, 0.7f);
+					lightsChanged |= ImGui::SliderFloat("Quadratic", (float*)&spotLights[i].Quadratic, 0.00007, 0.5f);
+					lightsChanged |= ImGui::SliderFloat("Cutoff", (float*)&spotLights[i].Cutoff, 0.0f, spotLights[i].OuterCutoff - 1);
+					lightsChanged |= ImGui::SliderFloat("OuterCutoff", (float*)&spotLights[i].OuterCutoff, spotLights[i].Cutoff + 1, 40.0f);
+					lightsChanged |= ImGui::SliderFloat("Exponent", (float*)&spotLights[i].Exponent, 0.0f, 256.0f);
+					lightsChanged |= ImGui::Checkbox("Enable", &spotLights[i].Enable);
 					ImGui::Spacing();
 					ImGui::TreePop();
 				}
 				ImGui::Spacing();
 			}
+			if (ImGui::TreeNode("Clustered Lights")) {
+				ImGui::Checkbox("Boid lights", &enableBoidLights);
+				if (enableBoidLights) {
+					ImGui::Text("  Lead boids lit: %u of %u", boidLightCount, (unsigned int)boids.size());
+				}
+				ImGui::SliderInt("Scattered lights", &scatteredLightCount, 0, (int)MAX_SCATTERED_LIGHTS);
+				ImGui::Text("Lights binned: %u (%u over the limit)", lightClusters.getLightCount(), lightClusters.getDropped());
+				ImGui::Text("Clusters lit: %u of %u, at most %u lights", lightClusters.getBusyClusters(), CLUSTER_COUNT, lightClusters.getMaxPerCluster());
+				ImGui::Text("Light indices: %u of %u", lightClusters.getIndexCount(), CLUSTER_INDEX_CAPACITY);
+				ImGui::TreePop();
+			}
+			if (lightsChanged) {
+				lightsUBO.markDirty();
+			}
 			ImGui::EndTabItem();
 		}
 		
 		if (ImGui::BeginTabItem("Texture")) {
 			ImGui::Checkbox("Billboard", &enableBillboard);
+			ImGui::Checkbox("Grass", &showGrass);
+			const char* boidItems[] = { "Cone mesh", "Banana sprites" };
+			ImGui::Combo("Boids", &boidRender, boidItems, IM_ARRAYSIZE(boidItems));
+			ImGui::Checkbox("Mesh LOD", &enableConeLod);
+			ImGui::Checkbox("Impostors", &enableImpostors);
+			if (enableImpostors) {
+				ImGui::SliderFloat("Impostor distance", &impostorDistance, 5.0f, global_far);
+			}
+			ImGui::Checkbox("Frustum culling", &enableCulling);
+			ImGui::Text("Boids visible: %u of %u", boidsVisible, (unsigned int)boids.size());
+			if (enableCulling) {
+				ImGui::Text("  Cells: %u inside, %u outside, %u split (%u boid tests)", boidGrid.getCellsInside(), boidGrid.getCellsOutside(), boidGrid.getCellsStraddling(), boidGrid.getPointTests());
+			}
+			ImGui::Text("Boid triangles: %u", boidTriangles);
+			if (boidRender == BOIDS_MESH) {
+				for (unsigned int i = 0; i < CONE_LOD_COUNT; i++) {
+					const CylinderLod& lod = cone.getLod(i);
+					ImGui::Text("  LOD %u (%u x %u): %u boids", i, lod.Longitude, lod.Latitude, coneLodInstances[i]);
+				}
+				ImGui::Text("  Impostors: %u boids", boidImpostors.getCount());
+			}
+			ImGui::Checkbox("Flocking", &enableFlocking);
 			ImGui::SliderFloat("Separation", &separation, 0, 10);
 			ImGui::SliderFloat("Alignment", &alignment, 0, 10);
 			ImGui::SliderFloat("Cohesion", &cohesion, 0, 10);
@@ -766,24 +1544,214 @@ void showUI() {
 		}
 		
 		if (ImGui::BeginTabItem("Fog")) {
-			ImGui::SliderFloat4(std::string("Color").c_str(), static_cast<float*>(&fog.Color.x), 0.0f, 1.0f);
-			ImGui::SliderFloat(std::string("Density").c_str(), (float*)&fog.Density, 0.0f, 1.0f);
+			bool fogChanged = false;
+			fogChanged |= ImGui::SliderFloat4("Color", static_cast<float*>(&fog.Color.x), 0.0f, 1.0f);
+			fogChanged |= ImGui::SliderFloat("Density", (float*)&fog.Density, 0.0f, 1.0f);
 
 			const char* items_a[] = { "LINEAR", "EXP", "EXP2" };
 			const char* items_b[] = { "PLANE_BASED", "RANGE_BASED" };
-			ImGui::Combo("Mode", (int*)&fog.Mode, items_a, IM_ARRAYSIZE(items_a));
-			ImGui::Combo("Depth Type", (int*)&fog.DepthType, items_b, IM_ARRAYSIZE(items_b));
+			fogChanged |= ImGui::Combo("Mode", (int*)&fog.Mode, items_a, IM_ARRAYSIZE(items_a));
+			fogChanged |= ImGui::Combo("Depth Type", (int*)&fog.DepthType, items_b, IM_ARRAYSIZE(items_b));
 
 			if (fog.Mode == 0) {
-				ImGui::SliderFloat(std::string("F_Start").c_str(), &fog.F_start, global_near, fog.F_end);
-				ImGui::SliderFloat(std::string("F_End").c_str(), &fog.F_end, fog.F_start, global_far);
+				fogChanged |= ImGui::SliderFloat("F_Start", &fog.F_start, global_near, fog.F_end);
+				fogChanged |= ImGui::SliderFloat("F_End", &fog.F_end, fog.F_start, global_far);
 			}
 			
-			ImGui::Checkbox(std::string("Enable").c_str(), &fog.Enable);
+			fogChanged |= ImGui::Checkbox("Enable", &fog.Enable);
 			ImGui::Spacing();
+			if (fogChanged) {
+				fogUBO.markDirty();
+			}
+
+			ImGui::EndTabItem();
+		}
+
+		if (ImGui::BeginTabItem("Frame Time")) {
+			ImGui::Text("p50: %.2f ms  p95: %.2f ms", frameTimes.getP50(), frameTimes.getP95());
+			ImGui::Text("p99: %.2f ms  max: %.2f ms", frameTimes.getP99(), frameTimes.getMax());
+			ImGui::PlotLines("History", frameTimes.getHistory(), FRAME_HISTORY, frameTimes.getHistoryOffset(), "ms", 0.0f, HISTOGRAM_BINS * HISTOGRAM_BIN_MS, ImVec2(0, 80));
+			ImGui::PlotHistogram("Histogram", frameTimes.getHistogram(), HISTOGRAM_BINS, 0, "2 ms bins", 0.0f, (float)frameTimes.getCount(), ImVec2(0, 80));
+			ImGui::Spacing();
+
+			if (ImGui::TreeNode("Flight Recorder")) {
+				ImGui::Checkbox("Enable", &flightRecorder.Enable);
+				ImGui::SliderFloat("Threshold (ms)", &flightRecorder.ThresholdMilliseconds, 5.0f, 100.0f);
+				ImGui::Text("Keeps the last %u frames, dumps: %u", FLIGHT_FRAMES, flightRecorder.getDumpCount());
+				if (flightRecorder.getDumpCount() > 0) {
+					ImGui::Text("Last dump: %s", flightRecorder.getLastDumpPath().c_str());
+				}
+				ImGui::TreePop();
+			}
+			ImGui::Spacing();
+
+			if (ImGui::TreeNode("Hardware Counters")) {
+				if (!perfCounters.isAvailable()) {
+					ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.5f, 1.0f), "%s", perfCounters.getReason().c_str());
+				} else {
+					ImGui::Checkbox("Enable", &perfCounters.Enable);
+					ImGui::Columns(PERF_COUNTER_COUNT + 2, "perfcolumns");
+					ImGui::Separator();
+					ImGui::Text("phase"); ImGui::NextColumn();
+					for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+						ImGui::Text("%s", PERF_COUNTER_NAMES[j]); ImGui::NextColumn();
+					}
+					ImGui::Text("IPC"); ImGui::NextColumn();
+					ImGui::Separator();
+					for (int i = 0; i < SIM_PHASE_COUNT; i++) {
+						const PerfSample& sample = simCounters.Hardware[i];
+						ImGui::Text("%s", SIM_PHASE_NAMES[i]); ImGui::NextColumn();
+						for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+							if (perfCounters.isCounterAvailable(j)) {
+								ImGui::Text("%llu", (unsigned long long)sample.Values[j]);
+							} else {
+								ImGui::Text("n/a");
+							}
+							ImGui::NextColumn();
+						}
+						uint64_t cycles = sample.Values[PERF_CYCLES];
+						ImGui::Text("%.2f", cycles > 0 ? (double)sample.Values[PERF_INSTRUCTIONS] / cycles : 0.0); ImGui::NextColumn();
+					}
+					ImGui::Columns(1);
+					ImGui::Separator();
+				}
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("Frame Arenas")) {
+				ImGui::Text("Threads: %u, capacity %.0f KB each", frameArenas.getCount(), FRAME_ARENA_CAPACITY / 1024.0);
+				for (unsigned int i = 0; i < frameArenas.getCount(); i++) {
+					const FrameArena& arena = frameArenas.get(i);
+					ImGui::BulletText("%s %u: %.1f KB used, %.1f KB high-water", i == 0 ? "Main" : "Worker", i, arena.getUsed() / 1024.0, arena.getHighWater() / 1024.0);
+				}
+				ImGui::TreePop();
+			}
+			ImGui::Text("Render queue: %u commands, %u draw calls", renderQueue.getCommandCount(), renderQueue.getDrawCalls());
+			ImGui::Text("  Depth sort: %u sprites in %.2f ms, %u grass in %.2f ms", boidRender == BOIDS_SPRITES ? spriteSorter.getCount() : 0, spriteSorter.getMilliseconds(), grassSorter.getCount(), grassSorter.getMilliseconds());
+			ImGui::Text("  State changes: %u binds, %u skipped, %u uniform uploads", glState.getChanges(), glState.getSkipped(), Shader::uniformUploads());
+			ImGui::Text("Textures: %u of %u uploaded, %u loading", assets.getReadyCount(), assets.getCount(), assets.getLoadingCount());
+			ImGui::Text("  %u from .btex cache (%.1f ms), %u converted (%.1f ms)", assets.getCachedCount(), assets.getCachedMilliseconds(), assets.getConvertedCount(), assets.getConvertedMilliseconds());
+			ImGui::Spacing();
+
+			if (ImGui::TreeNode("Resolution")) {
+				ImGui::Checkbox("Dynamic resolution", &resolution.Enable);
+				ImGui::SliderFloat("Target (ms)", &resolution.TargetMilliseconds, 4.0f, 50.0f);
+				ImGui::SliderFloat("Min scale", &resolution.MinScale, 0.25f, resolution.MaxScale);
+				ImGui::SliderFloat("Max scale", &resolution.MaxScale, resolution.MinScale, RESOLUTION_MAX_SCALE);
+				float scale = resolution.getScale();
+				if (!resolution.Enable) {
+					ImGui::SliderFloat("Scale", &scale, resolution.MinScale, resolution.MaxScale);
+				}
+				resolution.setScale(scale);
+				const char* msaaItems[] = { "Off", "2x", "4x", "8x" };
+				int msaaIndex = msaaSamples >= 8 ? 3 : msaaSamples >= 4 ? 2 : msaaSamples >= 2 ? 1 : 0;
+				if (ImGui::Combo("MSAA", &msaaIndex, msaaItems, IM_ARRAYSIZE(msaaItems))) {
+					msaaSamples = msaaIndex == 0 ? 0 : 1u << msaaIndex;
+				}
+				ImGui::Text("Render size: %ux%u of %ux%u, %u samples", renderWidth, renderHeight, SCR_WIDTH, SCR_HEIGHT, sceneTarget.getSamples());
+				ImGui::Text("Scene GPU: %.2f ms  CPU: %.2f ms%s", resolution.getGpuMilliseconds(), resolution.getCpuMilliseconds(), resolution.isCpuBound() ? " (CPU bound)" : "");
+				ImGui::Text("Scale changes: %u", resolution.getChanges());
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("Frame Pacing")) {
+				int vsync = (int)vsyncMode;
+				if (ImGui::Combo("Vsync", &vsync, VSYNC_MODE_NAMES, VSYNC_MODE_COUNT)) {
+					vsyncMode = (Vsync_Mode)vsync;
+					applyVsync();
+				}
+				ImGui::SliderFloat("FPS cap", &frameLimiter.TargetFps, 0.0f, 240.0f, frameLimiter.TargetFps > 0.0f ? "%.0f" : "Off");
+				ImGui::Text("Limiter wait: %.2f ms, woke %.3f ms late, sleep estimate %.2f ms", frameLimiter.getWaitMilliseconds(), frameLimiter.getLateMilliseconds(), frameLimiter.getSleepEstimate());
+				ImGui::Checkbox("Late input", &lateInput);
+				ImGui::Checkbox("Measure input latency", &inputLatency.Enable);
+				if (inputLatency.getReports() > 0) {
+					ImGui::Text("Input to swap: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms", inputLatency.getP50(), inputLatency.getP90(), inputLatency.getP99(), inputLatency.getMax());
+				}
+				if (inputLatency.Enable) {
+					ImGui::Text("Next report in %u frames, %u swaps in flight (%u dropped)", LATENCY_WINDOW - inputLatency.getPending(),
+						inputLatency.getInFlight(), inputLatency.getDroppedSwaps());
+				}
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("Quality Governor")) {
+				ImGui::Checkbox("Adaptive quality", &qualityGovernor.Enable);
+				ImGui::SliderFloat("Budget (ms)", &qualityGovernor.BudgetMilliseconds, 4.0f, 50.0f);
+				int step = (int)qualityGovernor.getStep();
+				if (ImGui::SliderInt("Step", &step, 0, (int)QUALITY_STEPS) && qualityGovernor.setStep((unsigned int)step)) {
+					applyQuality();
+				}
+				ImGui::Text("p%.0f work time: %.2f ms, %u changes", GOVERNOR_PERCENTILE * 100.0f, qualityGovernor.getPercentile(), qualityGovernor.getChanges());
+				for (unsigned int knob = 0; knob < QUALITY_KNOB_COUNT; knob++) {
+					ImGui::BulletText("%s: level %u", QUALITY_KNOB_NAMES[knob], qualityGovernor.getLevel((Quality_Knob)knob));
+				}
+				for (unsigned int i = 0; i < qualityGovernor.getHistoryCount(); i++) {
+					ImGui::TextWrapped("%s", qualityGovernor.getHistory(i).c_str());
+				}
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("Capture")) {
+				if (!frameCapture.isActive()) {
+					if (ImGui::Button("Start capture")) {
+						frameCapture.start(capturePath.empty() ? CAPTURE_PATH : capturePath, SCR_WIDTH, SCR_HEIGHT);
+					}
+				} else if (ImGui::Button("Stop capture")) {
+					frameCapture.stop();
+				}
+				if (frameCapture.getCaptured() > 0) {
+					ImGui::Text("%s: %u frames, %u dropped", frameCapture.getPath().c_str(), frameCapture.getCaptured(), frameCapture.getDropped());
+				}
+				ImGui::TreePop();
+			}
+			ImGui::EndTabItem();
+		}
+
+#ifndef BOIDS_NO_PROFILE
+		if (ImGui::BeginTabItem("Profiler")) {
+			const profiler::Profiler& prof = profiler::instance();
+			double frameMilliseconds = prof.getFrameMilliseconds();
+			ImGui::Text("Frame: %.2f ms (%.1f FPS)", frameMilliseconds, frameMilliseconds > 0.0 ? 1000.0 / frameMilliseconds : 0.0);
+			ImGui::Separator();
+
+			// Previous frame, indented by nesting depth
+			for (unsigned int i = 0; i < prof.getPhaseCount(); i++) {
+				const profiler::Phase& phase = prof.getPhases()[i];
+				float fraction = frameMilliseconds > 0.0 ? (float)(phase.Milliseconds / frameMilliseconds) : 0.0f;
+				ImGui::Text("%*s%-16s %7.3f ms %5.1f%% %6llu allocs", phase.Depth * 2, "", phase.Name, phase.Milliseconds, fraction * 100.0f, (unsigned long long)phase.Allocations);
+			}
+			ImGui::Spacing();
+
+			if (ImGui::Button("Dump Chrome Trace (F9)")) {
+				dumpTrace();
+			}
+			ImGui::Spacing();
+
+			if (ImGui::TreeNode("Heap Allocations")) {
+				const alloctracker::Counts& allocs = prof.getFrameAllocations();
+				ImGui::Text("Last frame: %llu allocations, %llu frees, %.1f KB", (unsigned long long)allocs.Allocations, (unsigned long long)allocs.Frees, allocs.Bytes / 1024.0);
+				ImGui::TextColored(allocatingFrames == 0 ? ImVec4(0.5f, 1.0f, 0.5f, 1.0f) : ImVec4(1.0f, 0.5f, 0.5f, 1.0f),
+					"Allocating frames after warm-up: %u", allocatingFrames);
 
+				bool sampling = alloctracker::getSamplePeriod() != 0;
+				if (ImGui::Checkbox("Sample call sites", &sampling)) {
+					alloctracker::setSamplePeriod(sampling ? allocSamplePeriod : 0);
+				}
+				if (ImGui::SliderInt("Every Nth", (int*)&allocSamplePeriod, 1, 256) && sampling) {
+					alloctracker::setSamplePeriod(allocSamplePeriod);
+				}
+				if (ImGui::Button("Capture Top Sites")) {
+					captureAllocationReport();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Clear")) {
+					alloctracker::clearCallSites();
+					allocationReport.clear();
+				}
+				for (const std::string& line : allocationReport) {
+					ImGui::TextUnformatted(line.c_str());
+				}
+				ImGui::TreePop();
+			}
 			ImGui::EndTabItem();
 		}
+#endif
 		
 		ImGui::EndTabBar();
 	}
@@ -812,7 +1780,42 @@ void setProjectionMatrix() {
 }
 
 void setViewport() {
-	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+	glViewport(0, 0, renderWidth, renderHeight);
+}
+
+// Pick this frame's render size from the timings of the last ones and start drawing the scene into its target.
+void beginScene() {
+	float gpuMilliseconds = -1.0f;
+	sceneTimer.poll(gpuMilliseconds);
+	resolution.update(gpuMilliseconds, cpuMilliseconds);
+
+	// A minimized window reports a zero size
+	unsigned int outputWidth = std::max(1u, SCR_WIDTH);
+	unsigned int outputHeight = std::max(1u, SCR_HEIGHT);
+	renderWidth = std::max(1u, (unsigned int)std::lround(outputWidth * resolution.getScale()));
+	renderHeight = std::max(1u, (unsigned int)std::lround(outputHeight * resolution.getScale()));
+	if (!sceneTarget.resize(outputWidth, outputHeight, msaaSamples) && msaaSamples > 0) {
+		logging::loggingMessage(logging::LogType::WARNING, "MSAA turned off for the scene target.");
+		msaaSamples = 0;
+		sceneTarget.resize(outputWidth, outputHeight, msaaSamples);
+	}
+	sceneTarget.bind();
+	sceneTimer.begin();
+}
+
+// Read the knob levels of the governor's current step back into the settings they drive.
+void applyQuality() {
+	metricsInterval = METRICS_INTERVALS[qualityGovernor.getLevel(QUALITY_METRICS)];
+	coneLodScale = CONE_LOD_SCALES[qualityGovernor.getLevel(QUALITY_LOD)];
+	impostorScale = IMPOSTOR_SCALES[qualityGovernor.getLevel(QUALITY_IMPOSTORS)];
+	neighborCap = NEIGHBOR_CAPS[qualityGovernor.getLevel(QUALITY_NEIGHBORS)];
+	forceInterval = FORCE_INTERVALS[qualityGovernor.getLevel(QUALITY_SIM_RATE)];
+	frameTimes.setStatsInterval(metricsInterval);
+}
+
+void presentScene() {
+	sceneTarget.present(headless ? headlessContext.getFramebuffer() : 0, renderWidth, renderHeight);
+	sceneTimer.end();
 }
 
 void geneObejectData() {
@@ -927,18 +1930,14 @@ void geneObejectData() {
 		 1.0,  0.0, 0.0,	0.0, 0.0, 1.0,		1.0, 1.0,
 		 1.0,  1.0, 0.0,	0.0, 0.0, 1.0,		1.0, 0.0,
 	};
-	glGenVertexArrays(1, &planeVAO);
 	glGenBuffers(1, &planeVBO);
-	glBindVertexArray(planeVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-		glBufferData(GL_ARRAY_BUFFER, planeVertices.size() * sizeof(float), planeVertices.data(), GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+	glBufferData(GL_ARRAY_BUFFER, planeVertices.size() * sizeof(float), planeVertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	grassBillboards.init(planeVBO);
+	fishBillboards.init(planeVBO);
+	boidBillboards.init(planeVBO);
+	boidImpostors.init(planeVBO);
 	// ==================================================
 	
 	// ========== Generate sphere vertex data ==========
@@ -947,6 +1946,9 @@ void geneObejectData() {
 
 
 	// ========== Generate cylinder vertex data ==========
+	for (unsigned int i = 0; i < CONE_LOD_COUNT - 1; i++) {
+		cone.addLod(CONE_LOD_SHAPES[i][0], CONE_LOD_SHAPES[i][1]);
+	}
 	glGenVertexArrays(1, &coneVAO);
 	glGenBuffers(1, &coneVBO);
 	glGenBuffers(1, &coneEBO);
@@ -961,6 +1963,16 @@ void geneObejectData() {
 		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+
+		// Instance matrices, one mat4 per boid spread over attributes 3-6 (filled every frame)
+		GLsizei vec4Size = sizeof(glm::vec4);
+		glGenBuffers(1, &boidsInstanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, boidsInstanceVBO);
+		for (unsigned int i = 0; i < 4; i++) {
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(size_t)(i * vec4Size));
+			glVertexAttribDivisor(3 + i, 1);
+		}
 	glBindVertexArray(0);
 	// ==================================================
 }
@@ -1050,156 +2062,129 @@ void drawCube() {
 	modelMatrix.pop();
 }
 
-void drawPlane(Shader shader, glm::vec3 position, float size_w, float size_h, int method) {
-	glm::mat4 view_model = view * modelMatrix.top();
-	
-	glm::vec3 billboard_x = glm::vec3(0.0f);
-	glm::vec3 billboard_y = glm::vec3(0.0f);
-	glm::vec3 billboard_z = glm::vec3(0.0f);
-	
-	if (enableBillboard) {
-		billboard_z = glm::vec3(view_model[0][2], view_model[1][2], view_model[2][2]);
-		if (method == 0) {
-			// k1GYbTw
-			billboard_x = glm::vec3(billboard_z.z, 0.0f, -billboard_z.x);
-			billboard_y = glm::vec3(0.0f, 1.0f, 0.0f);
-		} else {
-			// k2GYbTw
-			billboard_x = glm::vec3(view_model[0][0], view_model[1][0], view_model[2][0]);
-			billboard_y = glm::vec3(view_model[0][1], view_model[1][1], view_model[2][1]);
-		}
-	} else {
-		billboard_z = glm::vec3(0.0f, 0.0f, -1.0f);
-		billboard_x = glm::vec3(billboard_z.z, 0.0f, -billboard_z.x);
-		billboard_y = glm::vec3(0.0f, 1.0f, 0.0f);
+// Every boid as one sprite facing the screen, from the instances last uploaded to fishBillboards.
+void queueFish(LightingVariants& variants) {
+	if (fishBillboards.getCount() == 0) {
+		return;
 	}
-	
-	// p⳻I
-	glm::vec3 v0 = position - (size_w * billboard_x / 2.0f);
-	glm::vec3 v1 = position + (size_w * billboard_x / 2.0f);
-	glm::vec3 v2 = v1 + (size_h * billboard_y);
-	glm::vec3 v3 = v0 + (size_h * billboard_y);
+	LightingVariants::Variant& variant = lightingVariant(variants, FEATURE_DIFFUSE_TEXTURE | FEATURE_TEXTURE_ARRAY);
+	RenderCommand command = lightingCommand(variant, modelMatrix.top(), 0.0f);
+	command.set(variant.Uniforms.BillboardMode, enableBillboard ? BILLBOARD_FULL : BILLBOARD_FIXED);
+	command.set(variant.Uniforms.FrameCount, 1);
+	command.set(variant.Uniforms.MaterialShininess, 16.0f);
+	command.setTexture(0, GL_TEXTURE_2D_ARRAY, assets.texture(fishTexture));
+	command.drawArrays(fishBillboards.getVAO(), 0, 6, fishBillboards.getCount());
+	renderQueue.submit(command);
+}
 
-	// oyЪybOonWUA
-	planeVertices = {
-		// Positions		// Normals			// Texture coords
-		 v0.x, v0.y, v0.z,	0.0, 0.0, 1.0,		0.0, 1.0,
-		 v3.x, v3.y, v3.z,	0.0, 0.0, 1.0,		0.0, 0.0,
-		 v2.x, v2.y, v2.z,	0.0, 0.0, 1.0,		1.0, 0.0,
+// The whole grass field in one instanced draw, turning around the Y axis only so the blades stay upright.
+// One blended draw in the order grassSorter left the instances in. Recorded before the first upload, so the count
+// comes from the instances rather than the batch.
+void queueGrass(const RecordContext& context, unsigned int thread) {
+	if (grassInstances.empty()) {
+		return;
+	}
+	LightingVariants::Variant& variant = *context.Billboard;
+	RenderCommand command = lightingCommand(variant, context.Model, grassSorter.getMedianDepth());
+	command.Pass = RENDER_PASS_BLENDED;
+	command.set(variant.Uniforms.BillboardMode, enableBillboard ? BILLBOARD_Y_LOCKED : BILLBOARD_FIXED);
+	command.set(variant.Uniforms.FrameCount, 1);
+	command.set(variant.Uniforms.MaterialShininess, 16.0f);
+	command.setTexture(0, GL_TEXTURE_2D_ARRAY, context.GrassTexture);
+	command.drawArrays(grassBillboards.getVAO(), 0, 6, (unsigned int)grassInstances.size());
+	renderQueue.record(thread, command);
+}
 
-		 v0.x, v0.y, v0.z,	0.0, 0.0, 1.0,		0.0, 1.0,
-		 v2.x, v2.y, v2.z,	0.0, 0.0, 1.0,		1.0, 0.0,
-		 v1.x, v1.y, v1.z,	0.0, 0.0, 1.0,		1.0, 1.0,
-	};
+// The flock as two triangles per boid with a single texture bind, each quad picking its banana frame in the vertex shader.
+// count is the number of sprites this frame uploads, recorded before the upload happens, already sorted back to front.
+void queueBoidSprites(const RecordContext& context, unsigned int thread, unsigned int count) {
+	if (count == 0) {
+		return;
+	}
+	LightingVariants::Variant& variant = *context.Billboard;
+	RenderCommand command = lightingCommand(variant, context.Model, spriteSorter.getMedianDepth());
+	command.Pass = RENDER_PASS_BLENDED;
+	command.set(variant.Uniforms.BillboardMode, enableBillboard ? BILLBOARD_FULL : BILLBOARD_FIXED);
+	command.set(variant.Uniforms.FrameCount, (int)BANANA_FRAME_COUNT);
+	command.set(variant.Uniforms.FrameRate, BANANA_FRAME_RATE);
+	command.set(variant.Uniforms.Time, context.Time);
+	command.set(variant.Uniforms.MaterialShininess, 16.0f);
+	command.setTexture(0, GL_TEXTURE_2D_ARRAY, context.BananaTexture);
+	command.drawArrays(boidBillboards.getVAO(), 0, 6, count);
+	renderQueue.record(thread, command);
+}
 
-	glBindVertexArray(planeVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-	glBufferData(GL_ARRAY_BUFFER, planeVertices.size() * sizeof(float), planeVertices.data(), GL_STATIC_DRAW);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
+// The far boids, shaded when the atlas was baked so only fog and gamma are applied here.
+void queueImpostors(const RecordContext& context, unsigned int thread, unsigned int count) {
+	ShaderVariants<ImpostorUniforms>::Variant& impostor = *context.Impostor;
+	RenderCommand command(RENDER_PASS_OPAQUE, impostor.Program, impostorDistance * impostorScale);
+	command.set(impostor.Uniforms.Atlas, 0);
+	command.set(impostor.Uniforms.Radius, boidImpostors.getRadius());
+	command.set(impostor.Uniforms.GammaValue, GammaValue);
+	command.setTexture(0, GL_TEXTURE_2D_ARRAY, boidImpostors.getAtlas());
+	command.drawArrays(boidImpostors.getVAO(), 0, 6, count);
+	renderQueue.record(thread, command);
+}
+
+void queueBox(LightingVariants& variants) {
+	LightingVariants::Variant& variant = lightingVariant(variants, FEATURE_DIFFUSE_TEXTURE | FEATURE_SPECULAR_TEXTURE);
+	RenderCommand command = lightingCommand(variant, modelMatrix.top(), glm::distance(camera.Position, glm::vec3(modelMatrix.top()[3])));
+	command.setTexture(0, GL_TEXTURE_2D, assets.texture(boxTexture));
+	command.setTexture(1, GL_TEXTURE_2D, assets.texture(boxSpecularTexture));
+	command.drawElements(cubeVAO, 0, 36);
+	renderQueue.submit(command);
 }
 
-void drawFish(Shader shader, glm::vec3 position, float size) {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, fishTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, NULL);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, NULL);
-	shader.setBool("material.enableColorTexture", true);
-	shader.setBool("material.enableSpecularTexture", false);
-	shader.setBool("material.enableEmission", false);
-	shader.setBool("material.enableEmissionTexture", false);
-	shader.setFloat("material.shininess", 16.0f);
-	drawPlane(shader, position, size, size * 0.5, 1);
-}
-
-void drawGrass(Shader shader, glm::vec3 position, float size) {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, grassTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, NULL);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, NULL);
-	shader.setBool("material.enableColorTexture", true);
-	shader.setBool("material.enableSpecularTexture", false);
-	shader.setBool("material.enableEmission", false);
-	shader.setBool("material.enableEmissionTexture", false);
-	shader.setFloat("material.shininess", 16.0f);
-	drawPlane(shader, position, size, size, 0);
-}
-
-void drawBox(Shader shader) {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, boxTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, boxSpecularTexture);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, NULL);
-	shader.setBool("material.enableColorTexture", true);
-	shader.setBool("material.enableSpecularTexture", true);
-	shader.setBool("material.enableEmission", false);
-	shader.setBool("material.enableEmissionTexture", false);
-	shader.setFloat("material.shininess", 64.0f);
-	drawCube();
-}
-
-void drawAxis(Shader shader) {
-
-	shader.setBool("material.enableColorTexture", false);
-	shader.setBool("material.enableSpecularTexture", false);
-	shader.setBool("material.enableEmission", true);
-	shader.setBool("material.enableEmissionTexture", false);
+// The model matrices are built from the context rather than the modelMatrix stack, which belongs to the GL thread.
+void queueAxis(const RecordContext& context, unsigned int thread) {
+	LightingVariants::Variant& variant = *context.Emission;
+	float depth = glm::length(camera.Position);
 
 	// øs@ɧШtI]0, 0, 0^
-	modelMatrix.push();
-		modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(0.2f, 0.2f, 0.2f)));
-		shader.setVec4("material.ambient", glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
-		shader.setVec4("material.diffuse", glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
-		shader.setVec4("material.specular", glm::vec4(0.4f, 0.4f, 0.4f, 1.0f));
-		shader.setFloat("material.shininess", 64.0f);
-		shader.setMat4("model", modelMatrix.top());
-		drawSphere();
-	modelMatrix.pop();
+	RenderCommand origin = lightingCommand(variant, glm::scale(context.Model, glm::vec3(0.2f, 0.2f, 0.2f)), depth);
+	setMaterial(origin, variant.Uniforms, glm::vec4(0.1f, 0.1f, 0.1f, 1.0f), glm::vec4(0.2f, 0.2f, 0.2f, 1.0f), glm::vec4(0.4f, 0.4f, 0.4f, 1.0f), 64.0f);
+	origin.drawElements(sphereVAO, 0, (unsigned int)sphereIndices.size());
+	renderQueue.record(thread, origin);
 
 	// øsTӶb
-	modelMatrix.push();
-		modelMatrix.push();
-			modelMatrix.save(glm::translate(modelMatrix.top(), glm::vec3(1.5f, 0.0f, 0.0f)));
-			modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(3.0f, 0.1f, 0.1f)));
-			shader.setVec4("material.ambient", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-			shader.setVec4("material.diffuse", glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
-			shader.setVec4("material.specular", glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
-			shader.setFloat("material.shininess", 64.0f);
-			shader.setMat4("model", modelMatrix.top());
-			drawCube();
-		modelMatrix.pop();
-
-
-		modelMatrix.push();
-			modelMatrix.save(glm::translate(modelMatrix.top(), glm::vec3(0.0f, 1.5f, 0.0f)));
-			modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(0.1f, 3.0f, 0.1f)));
-			shader.setVec4("material.ambient", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-			shader.setVec4("material.diffuse", glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
-			shader.setVec4("material.specular", glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
-			shader.setFloat("material.shininess", 64.0f);
-			shader.setMat4("model", modelMatrix.top());
-			drawCube();
-		modelMatrix.pop();
+	for (int i = 0; i < 3; i++) {
+		glm::vec3 axis(0.0f);
+		axis[i] = 1.0f;
+		glm::vec4 color(axis, 1.0f);
+		glm::mat4 model = glm::scale(glm::translate(context.Model, axis * 1.5f), glm::vec3(0.1f) + axis * 2.9f);
+		RenderCommand command = lightingCommand(variant, model, depth);
+		setMaterial(command, variant.Uniforms, color, color, color, 64.0f);
+		command.drawElements(cubeVAO, 0, 36);
+		renderQueue.record(thread, command);
+	}
+}
 
-		modelMatrix.push();
-			modelMatrix.save(glm::translate(modelMatrix.top(), glm::vec3(0.0f, 0.0f, 1.5f)));
-			modelMatrix.save(glm::scale(modelMatrix.top(), glm::vec3(0.1f, 0.1f, 3.0f)));
-			shader.setVec4("material.ambient", glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
-			shader.setVec4("material.diffuse", glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
-			shader.setVec4("material.specular", glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
-			shader.setFloat("material.shininess", 64.0f);
-			shader.setMat4("model", modelMatrix.top());
-			drawCube();
-		modelMatrix.pop();
-	modelMatrix.pop();
+// A small emissive ball on every point light that is switched on.
+void queueLights(const RecordContext& context, unsigned int thread) {
+	LightingVariants::Variant& variant = *context.Emission;
+	for (unsigned int i = 0; i < pointLights.size(); i++) {
+		if (!pointLights[i].Enable) {
+			continue;
+		}
+		glm::mat4 model = glm::scale(glm::translate(context.Model, pointLights[i].Position), glm::vec3(0.5f));
+		RenderCommand command = lightingCommand(variant, model, glm::distance(camera.Position, pointLights[i].Position));
+		setMaterial(command, variant.Uniforms, glm::vec4(pointLights[i].Ambient, 1.0f), glm::vec4(pointLights[i].Diffuse, 1.0f), glm::vec4(pointLights[i].Specular, 1.0f), 32.0f);
+		command.drawElements(sphereVAO, 0, (unsigned int)sphereIndices.size());
+		renderQueue.record(thread, command);
+	}
+}
 
-	shader.setBool("material.enableEmission", false);
+// The sky pass runs after the opaque one at the far plane, so the cubemap is only sampled where nothing else was drawn.
+void queueSky(const RecordContext& context, unsigned int thread) {
+	ShaderVariants<SkyboxUniforms>::Variant& sky = *context.Sky;
+	RenderCommand command(RENDER_PASS_SKY, sky.Program, global_far);
+	command.set(sky.Uniforms.Skybox, 3);
+	command.set(sky.Uniforms.GammaValue, GammaValue);
+	command.set(sky.Uniforms.Model, glm::scale(context.Model, glm::vec3(5.0f)));
+	command.setTexture(3, GL_TEXTURE_CUBE_MAP, context.CubemapTexture);
+	command.DepthFunc = GL_LEQUAL;
+	command.drawElements(cubeVAO, 0, 36);
+	renderQueue.record(thread, command);
 }
 
 void drawSphere() {
@@ -1208,10 +2193,121 @@ void drawSphere() {
 	glBindVertexArray(0);
 }
 
-void drawCone() {
-	glBindVertexArray(coneVAO);
-	glDrawElementsInstanced(GL_TRIANGLES, cone.getIndexCount(), GL_UNSIGNED_INT, 0, boids.size());
-	glBindVertexArray(0);
+// One instanced command per LOD, each a contiguous range of boidsInstanceVBO.
+void queueCone(const RecordContext& context, unsigned int thread) {
+	LightingVariants::Variant& variant = *context.Instance;
+	for (unsigned int level = 0; level < CONE_LOD_COUNT; level++) {
+		if (coneLodInstances[level] == 0) {
+			continue;
+		}
+		const CylinderLod& lod = cone.getLod(level);
+		RenderCommand command = lightingCommand(variant, context.Model, 0.0f);
+		setMaterial(command, variant.Uniforms, CONE_AMBIENT, CONE_DIFFUSE, glm::vec4(0.40f, 0.10f, 0.0f, 1.0f), 16.0f);
+		command.drawElements(coneVAO, lod.IndexOffset * sizeof(unsigned int), lod.IndexCount, coneLodInstances[level]);
+		command.Prepare = pointConeInstances;
+		command.PrepareArg = coneLodFirst[level];
+		renderQueue.record(thread, command);
+		boidTriangles += lod.IndexCount / 3 * coneLodInstances[level];
+	}
+}
+
+// Without base instance (GL 4.2) the matrix attributes are pointed at the start of the LOD's range before its draw.
+void pointConeInstances(const RenderCommand& command) {
+	GLsizei vec4Size = sizeof(glm::vec4);
+	size_t first = (size_t)command.PrepareArg * sizeof(glm::mat4);
+	glBindBuffer(GL_ARRAY_BUFFER, boidsInstanceVBO);
+	for (unsigned int i = 0; i < 4; i++) {
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(first + i * vec4Size));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Bounding sphere of one boid as it is drawn, the cone is centered on its position and the sprite roughly so.
+float boidCullRadius() {
+	if (boidRender == BOIDS_SPRITES) {
+		return BOID_SPRITE_SIZE * 0.7072f;
+	}
+	return coneRadius();
+}
+
+// Sphere around the cone's center holding all of it, whatever its orientation.
+float coneRadius() {
+	return glm::length(glm::vec2(cone.getHeight() * 0.5f, std::max(cone.getBaseRadius(), cone.getTopRadius())));
+}
+
+// Append the boids whose bounding sphere reaches into the view, or all of them with culling off.
+void cullBoids(ArenaVector<unsigned int>& visible) {
+	PROFILE_SCOPE("Cull");
+	if (enableCulling) {
+		{
+			ScopedPerfCounters counters(perfCounters, simCounters.Hardware[SIM_GRID]);
+			boidGrid.build((unsigned int)boids.size(), [](unsigned int i) { return boids[i].getPosition(); }, CULL_CELL_SIZE);
+		}
+		boidGrid.cull(camera.GetFrustum(projection), boidCullRadius(), visible);
+	} else {
+		for (unsigned int i = 0; i < boids.size(); i++) {
+			visible.push_back(i);
+		}
+	}
+	boidsVisible = (unsigned int)visible.size();
+}
+
+// Pick the bucket of visible[first, last) and count them into counts[bucket]. The bucket is kept in boidLods,
+// so the LOD hysteresis sees it next frame; a boid coming back from the impostors starts from the coarsest LOD.
+void classifyBoids(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, unsigned int* counts) {
+	// projection[1][1] is 1 / tan(fovy / 2) in perspective and 2 / height in orthographic, pixels per unit at distance 1 either way
+	float pixelsPerUnit = projection[1][1] * renderHeight * 0.5f;
+	float split = impostorDistance * impostorScale;
+	float splitSquared = split * split;
+	for (unsigned int v = first; v < last; v++) {
+		unsigned int i = visible[v];
+		glm::vec3 offset = boids[i].getPosition() - camera.Position;
+		float distanceSquared = glm::dot(offset, offset);
+		unsigned int bucket = 0;
+		if (enableImpostors && distanceSquared > splitSquared) {
+			// Past the split distance a boid is a single quad
+			bucket = BOID_BUCKET_IMPOSTOR;
+		} else if (enableConeLod) {
+			float pixels = cone.getHeight() * pixelsPerUnit;
+			if (isPerspective) {
+				pixels /= std::max(std::sqrt(distanceSquared), global_near);
+			}
+			bucket = selectConeLod(boidLods[i], pixels);
+		}
+		boidLods[i] = (unsigned char)bucket;
+		counts[bucket]++;
+	}
+}
+
+// Write visible[first, last) to their buckets, next[bucket] being the block's first free slot in each.
+// An impostor's axis is the -Z column of the model matrix the mesh would use.
+void scatterBoids(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, unsigned int* next, ArenaVector<glm::mat4>& matrices, ArenaVector<ImpostorInstance>& impostors) {
+	unsigned int impostorFirst = (unsigned int)matrices.size();
+	for (unsigned int v = first; v < last; v++) {
+		unsigned int i = visible[v];
+		unsigned int bucket = boidLods[i];
+		unsigned int slot = next[bucket]++;
+		if (bucket == BOID_BUCKET_IMPOSTOR) {
+			impostors[slot - impostorFirst] = { boids[i].getPosition(), -glm::vec3(boids[i].getModel()[2]) };
+		} else {
+			matrices[slot] = boids[i].getModel();
+		}
+	}
+}
+
+// Centered on the boid, the phase spreads the flock over the frames so they don't spin in lockstep.
+void packSprites(const ArenaVector<unsigned int>& visible, unsigned int first, unsigned int last, ArenaVector<BillboardInstance>& sprites) {
+	for (unsigned int v = first; v < last; v++) {
+		unsigned int i = visible[v];
+		glm::vec3 position = boids[i].getPosition() - glm::vec3(0.0f, BOID_SPRITE_SIZE * 0.5f, 0.0f);
+		float phase = (float)((i * 5u) % BANANA_FRAME_COUNT);
+		sprites[v] = { position, BOID_SPRITE_SIZE, BOID_SPRITE_SIZE, 0.0f, phase, glm::length(boids[i].getVelocity()) };
+	}
+}
+
+// The coarsest LOD the boid is big enough for, a boid has to cross a threshold by CONE_LOD_HYSTERESIS before it changes.
+unsigned int selectConeLod(unsigned int current, float pixels) {
+	return selectLod(current, pixels, CONE_LOD_PIXELS, CONE_LOD_COUNT, coneLodScale, CONE_LOD_HYSTERESIS);
 }
 
 void setFullScreen() {
@@ -1239,6 +2335,26 @@ void frameBufferSizeCallback(GLFWwindow* window, int width, int height) {
 	setViewport();
 }
 
+// Poll the window events (the mouse moves the camera from their callbacks) and the held keys, and note when,
+// so the latency measurement starts from the input the frame is drawn with.
+void sampleInput() {
+	PROFILE_SCOPE("Input");
+	glfwPollEvents();
+	processInput(window);
+	inputTime = std::chrono::steady_clock::now();
+}
+
+// Set the swap interval of the window for vsyncMode. Drivers without tearing support get plain vsync for adaptive.
+void applyVsync() {
+	Vsync_Mode mode = vsyncMode;
+	if (mode == VSYNC_ADAPTIVE && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+		logging::loggingMessage(logging::LogType::WARNING, "Adaptive vsync isn't supported by the driver, using vsync on.");
+		mode = VSYNC_ON;
+	}
+	glfwSwapInterval(VSYNC_SWAP_INTERVALS[mode]);
+	logging::loggingMessage(logging::LogType::INFO, std::string("Vsync: ") + VSYNC_MODE_NAMES[mode] + ".");
+}
+
 // Handle the input which in the main loop
 void processInput(GLFWwindow* window) {
 	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
@@ -1297,6 +2413,11 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		}
 	}
 	
+	// Dump the recorded zones for chrome://tracing
+	if (key == GLFW_KEY_F9) {
+		dumpTrace();
+	}
+
 	if (key == GLFW_KEY_Y) {
 		if (isPerspective) {
 			isPerspective = false;
@@ -1311,9 +2432,11 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	if (key == GLFW_KEY_F) {
 		if (spotLights[0].Enable) {
 			spotLights[0].Enable = false;
+			lightsUBO.markDirty();
 			logging::loggingMessage(logging::LogType::INFO, "Spot Light is turn off.");
 		} else {
 			spotLights[0].Enable = true;
+			lightsUBO.markDirty();
 			logging::loggingMessage(logging::LogType::INFO, "Spot Light is turn on.");
 		}
 	}
@@ -1372,71 +2495,179 @@ void errorCallback(int error, const char* description) {
 	logging::loggingMessage(logging::LogType::ERROR, description);
 }
 
-// Loading Texture
-unsigned int loadTexture(char const* path) {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+// Log once how long it took from start to the first presented frame, the number the program cache is there to cut
+void reportTimeToFirstFrame() {
+	static bool reported = false;
+	if (reported) {
+		return;
+	}
+	reported = true;
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupTime).count();
+	const ProgramCache& cache = ProgramCache::instance();
+	std::string programs = cache.isAvailable()
+		? std::to_string(cache.getHits()) + " programs from the binary cache, " + std::to_string(cache.getMisses()) + " compiled"
+		: std::string("program cache unavailable");
+	logging::loggingMessage(logging::LogType::INFO, "Time to first frame: " + std::to_string((int)milliseconds) + " ms (" + programs + ").");
+}
 
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data) {
-		GLenum format;
-		if (nrComponents == 1) {
-			format = GL_RED;
-		}
-		else if (nrComponents == 3) {
-			format = GL_RGB;
-		}
-		else if (nrComponents == 4) {
-			format = GL_RGBA;
+// --headless, --frames N, --width N, --height N, --capture PATH, --msaa N, --adaptive (keep the dynamic resolution
+// and the quality governor running in a headless run), --vsync off|on|adaptive, --fps-cap N and --latency (log the
+// input-to-swap percentiles), --boids N, --impostors on|off, --flocking on|off and --check-allocations (exit with an
+// error if a frame after warm-up touched the heap). Unknown options print the usage and stop the program.
+bool parseArguments(int argc, char** argv) {
+	bool adaptive = false;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (argument == "--headless") {
+			headless = true;
+		} else if (argument == "--frames" && hasValue) {
+			frameLimit = (unsigned int)std::max(0, std::atoi(argv[++i]));
+		} else if (argument == "--width" && hasValue) {
+			SCR_WIDTH = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		} else if (argument == "--height" && hasValue) {
+			SCR_HEIGHT = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		} else if (argument == "--capture" && hasValue) {
+			capturePath = argv[++i];
+		} else if (argument == "--msaa" && hasValue) {
+			msaaSamples = (unsigned int)std::max(0, std::atoi(argv[++i]));
+		} else if (argument == "--adaptive") {
+			adaptive = true;
+		} else if (argument == "--vsync" && hasValue) {
+			std::string mode = argv[++i];
+			if (mode == "off") {
+				vsyncMode = VSYNC_OFF;
+			} else if (mode == "on") {
+				vsyncMode = VSYNC_ON;
+			} else if (mode == "adaptive") {
+				vsyncMode = VSYNC_ADAPTIVE;
+			} else {
+				logging::loggingMessage(logging::LogType::ERROR, "Unknown vsync mode " + mode + ", expected off, on or adaptive.");
+				return false;
+			}
+		} else if (argument == "--fps-cap" && hasValue) {
+			frameLimiter.TargetFps = (float)std::max(0, std::atoi(argv[++i]));
+		} else if (argument == "--latency") {
+			inputLatency.Enable = true;
+		} else if (argument == "--boids" && hasValue) {
+			boidCount = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		} else if (argument == "--impostors" && hasValue) {
+			if (!parseSwitch(argument, argv[++i], enableImpostors)) {
+				return false;
+			}
+		} else if (argument == "--flocking" && hasValue) {
+			if (!parseSwitch(argument, argv[++i], enableFlocking)) {
+				return false;
+			}
+		} else if (argument == "--check-allocations") {
+#ifndef BOIDS_NO_PROFILE
+			checkAllocations = true;
+#else
+			logging::loggingMessage(logging::LogType::WARNING, "--check-allocations is ignored, allocation tracking is compiled out (BOIDS_NO_PROFILE).");
+#endif
+		} else {
+			logging::loggingMessage(logging::LogType::ERROR, "Unknown option " + argument + ", usage: Boids [--headless] [--frames N] [--width N] [--height N] [--capture PATH] [--msaa N] [--adaptive] [--vsync off|on|adaptive] [--fps-cap N] [--latency] [--boids N] [--impostors on|off] [--flocking on|off] [--check-allocations]");
+			return false;
 		}
+	}
+	// Nobody is there to close a headless run
+	if (headless && frameLimit == 0) {
+		frameLimit = HEADLESS_DEFAULT_FRAMES;
+	}
+#ifndef BOIDS_NO_PROFILE
+	if (checkAllocations && frameLimit > 0 && frameLimit <= ALLOC_WARMUP_FRAMES) {
+		logging::loggingMessage(logging::LogType::ERROR, "--check-allocations needs --frames above the " + std::to_string(ALLOC_WARMUP_FRAMES) + " warm-up frames.");
+		return false;
+	}
+#endif
+	// Benchmark frames all render the same number of pixels with the same settings, unless the run is meant to adapt.
+	// The flight recorder stays off too: a slow driver would trip it every frame, and its dumps land inside the timed frames.
+	if (headless && !adaptive) {
+		resolution.Enable = false;
+		qualityGovernor.Enable = false;
+		flightRecorder.Enable = false;
+	}
+	return true;
+}
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_MIRRORED_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_MIRRORED_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+// Value of an on|off option
+bool parseSwitch(const std::string& option, const std::string& value, bool& target) {
+	if (value == "on") {
+		target = true;
+	} else if (value == "off") {
+		target = false;
+	} else {
+		logging::loggingMessage(logging::LogType::ERROR, "Unknown value " + value + " for " + option + ", expected on or off.");
+		return false;
 	}
-	else {
-		std::cout << "Failed to load texture at path:" << path << std::endl;
-		stbi_image_free(data);
+	return true;
+}
+
+// The window was closed, or a run limited by --frames has drawn all of them.
+bool shouldClose() {
+	if (frameLimit > 0 && framesDrawn >= frameLimit) {
+		return true;
 	}
+	return !headless && glfwWindowShouldClose(window);
+}
 
-	return textureID;
+// Seconds since startup, GLFW's clock isn't there in a headless run.
+float appTime() {
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - startupTime).count();
 }
 
-// Loading Cubemap
-unsigned int loadCubemap(std::vector<std::string> faces) {
+// Write the profiler's ring buffers as Chrome trace JSON
+void dumpTrace() {
+#ifndef BOIDS_NO_PROFILE
+	profiler::instance().writeChromeTrace(TRACE_PATH);
+#endif
+}
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+#ifndef BOIDS_NO_PROFILE
+// After warm-up the render loop is expected not to touch the heap; count the frames that do and report the first one
+void checkSteadyStateAllocations() {
+	static unsigned int frame = 0;
+	const profiler::Profiler& prof = profiler::instance();
+	const alloctracker::Counts& allocs = prof.getFrameAllocations();
+	if (++frame <= ALLOC_WARMUP_FRAMES || allocs.Allocations == 0) {
+		return;
+	}
+	if (allocatingFrames++ > 0) {
+		return;
+	}
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++) {
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data) {
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else {
-			std::cout << "Failed to load Cubemap texture at path:" << faces[i] << std::endl;
-			stbi_image_free(data);
+	// Name the deepest zone with the most allocations, it's the closest to the culprit
+	const profiler::Phase* worst = nullptr;
+	for (unsigned int i = 0; i < prof.getPhaseCount(); i++) {
+		const profiler::Phase& phase = prof.getPhases()[i];
+		if (phase.Allocations > 0 && (worst == nullptr || phase.Allocations > worst->Allocations || (phase.Allocations == worst->Allocations && phase.Depth > worst->Depth))) {
+			worst = &phase;
 		}
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	logging::loggingMessage(logging::LogType::WARNING, "Frame " + std::to_string(frame) + " made " + std::to_string(allocs.Allocations) + " heap allocations (" + std::to_string(allocs.Bytes)
+		+ " bytes) after warm-up" + (worst != nullptr ? std::string(", mostly in \"") + worst->Name + "\"" : std::string()) + ". Sample call sites in the Profiler tab to find them.");
+}
+
+// Symbolize the heaviest sampled call sites for the Profiler tab
+void captureAllocationReport() {
+	const unsigned int MAX_SITES = 8;
+	const unsigned int MAX_FRAMES = 4;
+	alloctracker::CallSite sites[MAX_SITES];
+	unsigned int count = alloctracker::getTopCallSites(sites, MAX_SITES);
 
-	return textureID;
+	allocationReport.clear();
+	if (count == 0) {
+		allocationReport.push_back("No samples yet, enable sampling first.");
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		allocationReport.push_back(std::to_string(sites[i].Allocations) + " samples, " + std::to_string(sites[i].Bytes) + " bytes");
+		for (unsigned int j = 0; j < sites[i].Depth && j < MAX_FRAMES; j++) {
+			allocationReport.push_back("    " + alloctracker::describeFrame(sites[i].Frames[j]));
+		}
+	}
 }
+#endif
 
 glm::mat4 GetPerspectiveProjMatrix(float fovy, float ascept, float znear, float zfar) {
 
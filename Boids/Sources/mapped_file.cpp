@@ -0,0 +1,81 @@
+#include "../Headers/mappedfile.h"
+
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& path) {
+	this->close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	Data = static_cast<const unsigned char*>(view);
+	Size = (size_t)size.QuadPart;
+	FileHandle = file;
+	MappingHandle = mapping;
+#else
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+		::close(descriptor);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	if (view == MAP_FAILED) {
+		::close(descriptor);
+		return false;
+	}
+	Data = static_cast<const unsigned char*>(view);
+	Size = (size_t)status.st_size;
+	FileHandle = reinterpret_cast<void*>((intptr_t)descriptor);
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+	if (Data == nullptr) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(Data);
+	CloseHandle((HANDLE)MappingHandle);
+	CloseHandle((HANDLE)FileHandle);
+#else
+	munmap(const_cast<unsigned char*>(Data), Size);
+	::close((int)reinterpret_cast<intptr_t>(FileHandle));
+#endif
+	Data = nullptr;
+	Size = 0;
+	FileHandle = nullptr;
+	MappingHandle = nullptr;
+}
@@ -0,0 +1,382 @@
+// Checks of the CPU side that runs without a GL context: the depth sort, the grid cull, LOD selection, the quality
+// governor, the frame limiter, and that their steady state leaves the heap alone.
+// BoidsTests NAME runs one check, without arguments it runs all of them. CTest runs each by name.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../Headers/alloctracker.h"
+#include "../Headers/camera.h"
+#include "../Headers/cylinder.h"
+#include "../Headers/depthsort.h"
+#include "../Headers/framepacing.h"
+#include "../Headers/qualitygovernor.h"
+#include "../Headers/spatialgrid.h"
+#include "../Headers/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+unsigned int failures = 0;
+
+void check(bool passed, const char* condition, const char* file, int line) {
+	if (!passed) {
+		failures++;
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+	}
+}
+
+// Sprites spread around the eye, some behind it and past the far plane, every seventh at the same spot so ties show
+std::vector<BillboardInstance> makeSprites(unsigned int count) {
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> spread(-200.0f, 200.0f);
+	std::vector<BillboardInstance> sprites(count);
+	for (unsigned int i = 0; i < count; i++) {
+		glm::vec3 position = i % 7 == 0 ? glm::vec3(3.0f, 1.0f, 40.0f) : glm::vec3(spread(random), spread(random) * 0.1f, spread(random));
+		sprites[i] = { position, 1.0f, 2.0f, 0.0f, (float)i, 0.0f };
+	}
+	return sprites;
+}
+
+// The radix sort against std::stable_sort on the same keys, on one thread and on four
+void testDepthSort() {
+	const unsigned int count = 3 * DEPTH_SORT_MIN_BLOCK + 123;
+	const glm::vec3 eye(0.0f, 2.0f, 0.0f);
+	const glm::vec3 forward = glm::normalize(glm::vec3(0.3f, -0.1f, 1.0f));
+	const float farPlane = 150.0f;
+	std::vector<BillboardInstance> sprites = makeSprites(count);
+
+	float scale = DEPTH_SORT_MAX_KEY / farPlane;
+	std::vector<uint32_t> keys(count);
+	std::vector<unsigned int> expected(count);
+	for (unsigned int i = 0; i < count; i++) {
+		glm::vec3 center = sprites[i].Position + glm::vec3(0.0f, sprites[i].Height * 0.5f, 0.0f);
+		float depth = glm::clamp(glm::dot(center - eye, forward) * scale, 0.0f, (float)DEPTH_SORT_MAX_KEY);
+		keys[i] = DEPTH_SORT_MAX_KEY - (uint32_t)depth;
+		expected[i] = i;
+	}
+	std::stable_sort(expected.begin(), expected.end(), [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+
+	ThreadPool serial(0);
+	ThreadPool parallel(3);
+	ThreadPool* pools[] = { &serial, &parallel };
+	for (ThreadPool* pool : pools) {
+		DepthSorter sorter;
+		std::vector<BillboardInstance> sorted(count);
+		// The second sort reuses the scratch arrays of the first
+		for (int pass = 0; pass < 2; pass++) {
+			std::fill(sorted.begin(), sorted.end(), BillboardInstance{ glm::vec3(0.0f), 0.0f, 0.0f, 0.0f, -1.0f, 0.0f });
+			sorter.sort(sprites.data(), count, eye, forward, farPlane, *pool, sorted.data());
+			unsigned int mismatches = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				mismatches += sorted[i].Phase != (float)expected[i];
+			}
+			CHECK(mismatches == 0);
+			CHECK(sorter.getCount() == count);
+		}
+		// More blocks than one thread splits into, or the four threads didn't share the work
+		CHECK(pool == &serial ? sorter.getBlocks() <= DEPTH_SORT_BLOCKS_PER_THREAD : sorter.getBlocks() > DEPTH_SORT_BLOCKS_PER_THREAD);
+
+		sorter.sort(sprites.data(), 0, eye, forward, farPlane, *pool, sorted.data());
+		CHECK(sorter.getCount() == 0);
+	}
+}
+
+// Every point whose sphere is clearly inside all six planes is returned once, every one clearly outside one isn't.
+// Points within a hair of a plane may go either way, the grid tests four at a time.
+void testGridCull() {
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> spread(-100.0f, 100.0f);
+	std::normal_distribution<float> cluster(0.0f, 2.0f);
+	std::vector<glm::vec3> points;
+	for (unsigned int i = 0; i < 20000; i++) {
+		points.push_back(glm::vec3(spread(random), spread(random) * 0.3f, spread(random)));
+	}
+	for (unsigned int i = 0; i < 5000; i++) {
+		points.push_back(glm::vec3(20.0f + cluster(random), cluster(random), -30.0f + cluster(random)));
+	}
+	const unsigned int count = (unsigned int)points.size();
+	const float radius = 1.5f;
+	const float tolerance = 1e-3f;
+
+	SpatialGrid grid;
+	grid.build(count, [&](unsigned int i) { return points[i]; }, 4.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 80.0f);
+	const float yaws[] = { -90.0f, -45.0f, 0.0f, 30.0f, 135.0f };
+	std::vector<unsigned int> visible;
+	for (float yaw : yaws) {
+		Camera camera(glm::vec3(0.0f, 5.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), yaw, -10.0f);
+		Frustum frustum = camera.GetFrustum(projection);
+		visible.clear();
+		grid.cull(frustum, radius, visible);
+		std::sort(visible.begin(), visible.end());
+		CHECK(std::adjacent_find(visible.begin(), visible.end()) == visible.end());
+
+		unsigned int missed = 0;
+		unsigned int extra = 0;
+		unsigned int inside = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			float margin = radius + 1e9f;
+			for (const glm::vec4& plane : frustum.Planes) {
+				margin = std::min(margin, glm::dot(glm::vec3(plane), points[i]) + plane.w + radius);
+			}
+			bool found = std::binary_search(visible.begin(), visible.end(), i);
+			if (margin > tolerance) {
+				inside++;
+				missed += !found;
+			} else if (margin < -tolerance) {
+				extra += found;
+			}
+		}
+		CHECK(missed == 0);
+		CHECK(extra == 0);
+		CHECK(inside > 0 && inside < count);
+		CHECK(grid.getCellsInside() + grid.getCellsOutside() + grid.getCellsStraddling() > 0);
+	}
+}
+
+// The cone LOD thresholds, a boid has to get 15% past one to switch
+void testLodHysteresis() {
+	const float thresholds[] = { 48.0f, 12.0f };
+	const unsigned int lods = 3;
+	const float hysteresis = 0.15f;
+
+	// Far from any threshold the current LOD makes no difference
+	for (unsigned int current = 0; current < lods; current++) {
+		CHECK(selectLod(current, 100.0f, thresholds, lods, 1.0f, hysteresis) == 0);
+		CHECK(selectLod(current, 30.0f, thresholds, lods, 1.0f, hysteresis) == 1);
+		CHECK(selectLod(current, 5.0f, thresholds, lods, 1.0f, hysteresis) == 2);
+	}
+	// Inside the band the boid keeps its LOD, past it it moves
+	CHECK(selectLod(0, 45.0f, thresholds, lods, 1.0f, hysteresis) == 0);
+	CHECK(selectLod(0, 40.0f, thresholds, lods, 1.0f, hysteresis) == 1);
+	CHECK(selectLod(1, 50.0f, thresholds, lods, 1.0f, hysteresis) == 1);
+	CHECK(selectLod(1, 56.0f, thresholds, lods, 1.0f, hysteresis) == 0);
+	CHECK(selectLod(1, 11.0f, thresholds, lods, 1.0f, hysteresis) == 1);
+	CHECK(selectLod(2, 13.0f, thresholds, lods, 1.0f, hysteresis) == 2);
+	// The quality governor scales every threshold
+	CHECK(selectLod(0, 45.0f, thresholds, lods, 2.0f, hysteresis) == 1);
+	CHECK(selectLod(0, 1.0f, thresholds, 1, 1.0f, hysteresis) == 0);
+
+	// A boid wobbling around a threshold never switches, one flying away and back switches once per threshold each way
+	unsigned int lod = 0;
+	unsigned int changes = 0;
+	for (int frame = 0; frame < 200; frame++) {
+		unsigned int next = selectLod(lod, 48.0f + 5.0f * std::sin(frame * 0.3f), thresholds, lods, 1.0f, hysteresis);
+		changes += next != lod;
+		lod = next;
+	}
+	CHECK(changes == 0);
+	for (int frame = 0; frame <= 200; frame++) {
+		float pixels = 100.0f * std::pow(0.01f, frame < 100 ? frame / 100.0f : (200 - frame) / 100.0f);
+		unsigned int next = selectLod(lod, pixels, thresholds, lods, 1.0f, hysteresis);
+		changes += next != lod;
+		lod = next;
+		if (frame == 100) {
+			CHECK(lod == 2);
+		}
+	}
+	CHECK(changes == 4);
+	CHECK(lod == 0);
+}
+
+// Feed a whole window of the same frame time, true when the last frame changed the step
+bool feedWindow(QualityGovernor& governor, float milliseconds, unsigned int slowFrames = 0, float slowMilliseconds = 0.0f) {
+	bool changed = false;
+	for (unsigned int i = 0; i < GOVERNOR_WINDOW; i++) {
+		bool frameChanged = governor.addFrame(i < slowFrames ? slowMilliseconds : milliseconds);
+		CHECK(!frameChanged || i == GOVERNOR_WINDOW - 1);
+		changed = changed || frameChanged;
+	}
+	return changed;
+}
+
+// Down one step per window over budget to the end of the ladder, back up one step per GOVERNOR_RAISE_WINDOWS calm windows
+void testGovernorLadder() {
+	const float fast = GOVERNOR_BUDGET_MS * 0.3f;
+	const float close = GOVERNOR_BUDGET_MS * 0.9f;
+	const float slow = GOVERNOR_BUDGET_MS * 2.0f;
+	QualityGovernor governor;
+	CHECK(!feedWindow(governor, fast));
+	CHECK(governor.getStep() == 0);
+	for (unsigned int knob = 0; knob < QUALITY_KNOB_COUNT; knob++) {
+		CHECK(governor.getLevel((Quality_Knob)knob) == 0);
+	}
+
+	unsigned int levels[QUALITY_KNOB_COUNT] = {};
+	for (unsigned int step = 1; step <= QUALITY_STEPS; step++) {
+		CHECK(feedWindow(governor, slow));
+		CHECK(governor.getStep() == step);
+		const QualityStep& taken = QUALITY_LADDER[step - 1];
+		CHECK(governor.getLevel(taken.Knob) == taken.Level);
+		for (unsigned int knob = 0; knob < QUALITY_KNOB_COUNT; knob++) {
+			unsigned int level = governor.getLevel((Quality_Knob)knob);
+			CHECK(level >= levels[knob]);
+			levels[knob] = level;
+		}
+	}
+	CHECK(!feedWindow(governor, slow));
+	CHECK(governor.getStep() == QUALITY_STEPS);
+	CHECK(governor.getLevel(QUALITY_NEIGHBORS) == 3);
+	CHECK(governor.getLevel(QUALITY_SIM_RATE) == 2);
+
+	for (unsigned int window = 1; window < GOVERNOR_RAISE_WINDOWS; window++) {
+		CHECK(!feedWindow(governor, fast));
+	}
+	CHECK(feedWindow(governor, fast));
+	CHECK(governor.getStep() == QUALITY_STEPS - 1);
+	// A window that fits but without room to spare starts the count over
+	CHECK(!feedWindow(governor, fast));
+	CHECK(!feedWindow(governor, close));
+	for (unsigned int window = 1; window < GOVERNOR_RAISE_WINDOWS; window++) {
+		CHECK(!feedWindow(governor, fast));
+	}
+	CHECK(feedWindow(governor, fast));
+	CHECK(governor.getStep() == QUALITY_STEPS - 2);
+
+	// Spikes in under a tenth of the window stay below the percentile, a few more push it over
+	unsigned int spikes = GOVERNOR_WINDOW - (unsigned int)(GOVERNOR_PERCENTILE * (GOVERNOR_WINDOW - 1) + 0.5f) - 1;
+	CHECK(!feedWindow(governor, close, spikes, slow));
+	CHECK(feedWindow(governor, close, spikes + 1, slow));
+	CHECK(governor.getStep() == QUALITY_STEPS - 1);
+
+	CHECK(governor.setStep(1000));
+	CHECK(governor.getStep() == QUALITY_STEPS);
+	CHECK(governor.setStep(0));
+	governor.Enable = false;
+	CHECK(!feedWindow(governor, slow));
+	CHECK(governor.getStep() == 0);
+	CHECK(governor.getPercentile() == slow);
+}
+
+// Frames come out one period apart on average and never early, the deadline doesn't drift with late wake-ups
+void testFrameLimiter() {
+	typedef std::chrono::steady_clock Clock;
+	FrameLimiter limiter;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < 100; i++) {
+		limiter.wait();
+		CHECK(limiter.getWaitMilliseconds() == 0.0f);
+	}
+	CHECK(Clock::now() - start < std::chrono::milliseconds(50));
+
+	const unsigned int frames = 30;
+	limiter.TargetFps = 100.0f;
+	start = Clock::now();
+	for (unsigned int i = 0; i < frames; i++) {
+		limiter.wait();
+		CHECK(limiter.getLateMilliseconds() >= 0.0f);
+	}
+	float elapsed = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	CHECK(elapsed >= frames * 10.0f - 0.1f);
+	CHECK(elapsed < frames * 10.0f + 100.0f);
+	CHECK(limiter.getSleepEstimate() > 0.0f);
+
+	// Turning it off returns to not waiting at all
+	limiter.TargetFps = 0.0f;
+	limiter.wait();
+	CHECK(limiter.getWaitMilliseconds() == 0.0f);
+}
+
+#ifndef BOIDS_NO_PROFILE
+// A frame of the CPU pipeline at a steady flock size: move the points on the pool, rebuild the grid, cull and sort.
+// After the first frames have grown the scratch arrays nothing may touch the heap.
+void testSteadyStateAllocations() {
+	const unsigned int count = 20000;
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> spread(-50.0f, 50.0f);
+	std::vector<glm::vec3> points(count);
+	std::vector<glm::vec3> velocities(count);
+	for (unsigned int i = 0; i < count; i++) {
+		points[i] = glm::vec3(spread(random), spread(random), spread(random));
+		velocities[i] = glm::vec3(spread(random), spread(random), spread(random)) * 0.01f;
+	}
+
+	ThreadPool pool(3);
+	SpatialGrid grid;
+	DepthSorter sorter;
+	QualityGovernor governor;
+	std::vector<unsigned int> visible;
+	std::vector<BillboardInstance> sprites(count);
+	std::vector<BillboardInstance> sorted(count);
+	visible.reserve(count);
+	Camera camera(glm::vec3(0.0f, 0.0f, 80.0f));
+	Frustum frustum = camera.GetFrustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 150.0f));
+
+	auto frame = [&](unsigned int number) {
+		float phase = std::sin(number * 0.5f);
+		pool.parallelFor(count, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+			for (unsigned int i = begin; i < end; i++) {
+				// Two points pin the corners, so the grid keeps its dimensions
+				glm::vec3 position = i < 2 ? glm::vec3(i == 0 ? -60.0f : 60.0f) : points[i] + velocities[i] * phase;
+				sprites[i] = { position, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f };
+			}
+		});
+		grid.build(count, [&](unsigned int i) { return sprites[i].Position; }, 4.0f);
+		visible.clear();
+		grid.cull(frustum, 1.0f, visible);
+		sorter.sort(sprites.data(), count, camera.Position, camera.Front, 150.0f, pool, sorted.data());
+		governor.addFrame(1.0f);
+	};
+
+	for (unsigned int i = 0; i < 4; i++) {
+		frame(i);
+	}
+	alloctracker::Counts before = alloctracker::getGlobalCounts();
+	for (unsigned int i = 4; i < 20; i++) {
+		frame(i);
+	}
+	alloctracker::Counts after = alloctracker::getGlobalCounts();
+	CHECK(after.Allocations == before.Allocations);
+	CHECK(after.Bytes == before.Bytes);
+	CHECK(!visible.empty());
+
+	// The tracker sees this thread's allocations at all
+	std::vector<int>* probe = new std::vector<int>(16);
+	delete probe;
+	CHECK(alloctracker::getGlobalCounts().Allocations > after.Allocations);
+}
+#endif
+
+struct TestCase {
+	const char* Name;
+	void (*Run)();
+};
+
+const TestCase TESTS[] = {
+	{ "depth_sort", testDepthSort },
+	{ "grid_cull", testGridCull },
+	{ "lod_hysteresis", testLodHysteresis },
+	{ "governor_ladder", testGovernorLadder },
+	{ "frame_limiter", testFrameLimiter },
+#ifndef BOIDS_NO_PROFILE
+	{ "steady_state_allocations", testSteadyStateAllocations },
+#endif
+};
+
+int main(int argc, char** argv) {
+	const char* only = argc > 1 ? argv[1] : nullptr;
+	bool ran = false;
+	for (const TestCase& test : TESTS) {
+		if (only != nullptr && std::strcmp(only, test.Name) != 0) {
+			continue;
+		}
+		unsigned int before = failures;
+		test.Run();
+		std::printf("%s %s\n", failures == before ? "passed" : "FAILED", test.Name);
+		ran = true;
+	}
+	if (!ran) {
+		std::fprintf(stderr, "No test named %s\n", only);
+		return 1;
+	}
+	return failures == 0 ? 0 : 1;
+}